@@ -0,0 +1,75 @@
+// admission.h
+
+#ifndef ADMISSION_H
+#define ADMISSION_H
+
+#include <stdint.h>
+#include <sys/types.h>
+#include "cgroup.h"
+#include "state.h"
+
+#define ADMISSION_FILE RUNBOX_STATE_DIR "/admission"
+#define ADMISSION_MAGIC 0x72626164u
+#define ADMISSION_MAX_ENTRIES 1024
+#define ADMISSION_RECHECK_MS 1000
+
+enum AdmissionMode {
+    ADMISSION_NONE,
+    ADMISSION_WAIT,   // Queue until the request fits
+    ADMISSION_FAIL,   // Refuse immediately if it does not fit
+};
+
+enum AdmissionState {
+    ADMISSION_FREE,
+    ADMISSION_WAITING,
+    ADMISSION_ADMITTED,
+};
+
+/**
+ * AdmissionEntry - One launch known to the admission gate.
+ *
+ * Fields:
+ *   pid, start_time - Launcher process holding the entry. An entry whose
+ *                     process is gone (or whose PID was reused) is stale and
+ *                     gets reclaimed by the next launch that looks at the table.
+ *   state           - enum AdmissionState.
+ *   ticket          - Queue position; waiters are admitted strictly in order.
+ *   cpus, memory, pids - Requested limits. Unlimited resources count as the
+ *                     whole host capacity.
+ */
+struct AdmissionEntry {
+    pid_t pid;
+    uint32_t state;
+    unsigned long long start_time;
+    uint64_t ticket;
+    double cpus;
+    unsigned long long memory;
+    long long pids;
+};
+
+/**
+ * AdmissionTable - Layout of the shared admission file.
+ *
+ * Every runbox process maps /run/runbox/admission and takes an flock on it
+ * to modify the table. Waiters sleep on `generation`, a futex word bumped
+ * whenever a slot is released or admitted, and recheck every
+ * ADMISSION_RECHECK_MS in case a holder died without releasing.
+ */
+struct AdmissionTable {
+    uint32_t magic;
+    uint32_t generation;
+    uint64_t next_ticket;
+    struct AdmissionEntry entries[ADMISSION_MAX_ENTRIES];
+};
+
+// Handle for the slot held by this launcher
+struct Admission {
+    int fd;
+    struct AdmissionTable *table;
+    int slot;
+};
+
+int admission_acquire(enum AdmissionMode mode, const struct CgroupLimits *limits, struct Admission *admission);
+void admission_release(struct Admission *admission);
+
+#endif
@@ -0,0 +1,57 @@
+// autotune.h
+
+#ifndef AUTOTUNE_H
+#define AUTOTUNE_H
+
+#define AUTOTUNE_INTERVAL_MS 1000
+
+/**
+ * AutotuneConfig - Operator-set bounds for the PSI-driven limit controller.
+ *
+ * Fields:
+ *   cpu_enabled    - Whether cpu.max is tuned (1 = enabled, 0 = disabled).
+ *   cpu_min        - Lowest CPU quota the controller may set, in CPUs.
+ *   cpu_max        - Highest CPU quota the controller may set, in CPUs.
+ *
+ *   memory_enabled - Whether memory.high is tuned (1 = enabled, 0 = disabled).
+ *   memory_min     - Lowest memory.high the controller may set, in bytes.
+ *   memory_max     - Highest memory.high the controller may set, in bytes.
+ */
+struct AutotuneConfig {
+    int cpu_enabled;
+    double cpu_min;
+    double cpu_max;
+
+    int memory_enabled;
+    unsigned long long memory_min;
+    unsigned long long memory_max;
+};
+
+/**
+ * Autotuner - Controller state for one sandbox cgroup.
+ *
+ * The controller keeps its current settings rather than reading them back, and
+ * remembers the cpu.stat counters of the previous step to compute how much of
+ * the last interval was throttled.
+ */
+struct Autotuner {
+    const struct AutotuneConfig *config;
+    const char *cgroup;
+
+    double cpus;
+    unsigned long long memory_high;
+
+    unsigned long long last_nr_periods;
+    unsigned long long last_nr_throttled;
+    int cpu_calm_steps;
+    int memory_calm_steps;
+};
+
+int parse_autotune_cpu(const char *arg, struct AutotuneConfig *config);
+int parse_autotune_memory(const char *arg, struct AutotuneConfig *config);
+
+int autotune_init(struct Autotuner *tuner, const struct AutotuneConfig *config,
+                  const char *cgroup, double cpus, const char *memory_max);
+void autotune_step(struct Autotuner *tuner);
+
+#endif
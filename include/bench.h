@@ -0,0 +1,8 @@
+// bench.h
+
+#ifndef BENCH_H
+#define BENCH_H
+
+int bench_main(int argc, char **argv);
+
+#endif
@@ -0,0 +1,47 @@
+// cache.h
+
+#ifndef CACHE_H
+#define CACHE_H
+
+#include <limits.h>
+#include <pthread.h>
+#include "sha256.h"
+
+#define RESULT_CACHE_DIR "/var/cache/runbox/results"
+#define RESULT_CACHE_DEFAULT_SIZE (1ULL << 30)
+#define MAX_CACHE_INPUTS 32
+
+struct Config;
+struct CgroupLimits;
+struct Manifest;
+
+/**
+ * ResultCache - State of one --cache run.
+ *
+ * On a miss the sandbox's stdout and stderr are pipes. A relay thread copies them to
+ * the real stdout/stderr and also records them, in order, in the staging entry. Its
+ * stdin is /dev/null, since what it would read is not part of the key.
+ *
+ * Fields:
+ *   key       - sha256 of everything that determines the result.
+ *   staging   - Entry directory being filled, published under its key when done.
+ *   output_fd - Recorded output (1 byte stream, 4 byte length, data, repeated).
+ *   stdin_fd  - /dev/null, given to the sandbox as stdin.
+ *   pipes     - Read/write ends of the stdout and stderr pipes.
+ */
+struct ResultCache {
+    char key[SHA256_HEX_SIZE];
+    char staging[PATH_MAX];
+    int output_fd;
+    int stdin_fd;
+    int pipes[2][2];
+    pthread_t relay;
+    int relaying;
+};
+
+int cache_lookup(struct Config *config, struct CgroupLimits *limits, const struct Manifest *manifest,
+                 struct ResultCache *cache, int *status);
+int cache_begin(struct Config *config, struct ResultCache *cache);
+void cache_finish(struct Config *config, struct ResultCache *cache, int status, int store);
+
+#endif
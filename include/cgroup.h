@@ -6,6 +6,9 @@
 #include <unistd.h>
 #define MAX_CPU_LIMIT 1024
 #define PIDS_MAX_ALIAS -2
+#define TENANT_NAME_MAX 64
+#define CPU_WEIGHT_MIN 1
+#define CPU_WEIGHT_MAX 10000
 
 /**
  * CgroupLimits - Structure to specify resource limits for a cgroup.
@@ -13,6 +16,8 @@
  * Fields:
  *   cpu_enabled    - Whether CPU controller is enabled (1 = enabled, 0 = disabled).
  *   cpus           - Number of CPUs allowed (floating-point value, e.g., 1.5 for 1.5 CPUs).
+ *   cpu_weight     - Share of CPU time against sibling cgroups (cpu.weight), 0 to leave it alone.
+ *                   Only `runbox tenant set` changes it.
  *
  *   memory_max     - Maximum memory limit (string, e.g., "256M", "1G", or "max" for unlimited).
  *   memory_enabled - Whether memory controller is enabled (1 = enabled, 0 = disabled).
@@ -20,18 +25,36 @@
  *   pids_max       - Maximum number of processes (integer).
  *                   Special value: -2 means "max" (unlimited).
  *   pids_enabled   - Whether pids controller is enabled (1 = enabled, 0 = disabled).
+ *
+ *   group          - Intermediate cgroup path under runbox/ that holds the sandbox cgroup,
+ *                   such as a tenant, the shared parent of a pod, or both ("<tenant>/pod-<name>").
+ *                   NULL places it directly in runbox/.
  */
 struct CgroupLimits {
     int  cpu_enabled;     // 1 if CPU controller is enabled, 0 otherwise
     double cpus;          // Number of CPUs allowed (floating-point value recommended, e.g., 1.5)
+    int cpu_weight;       // cpu.weight, 0 to leave unchanged
 
     char *memory_max;     // Maximum memory limit (e.g., "256M", "1G", or "max" for unlimited)
     int  memory_enabled;  // 1 if memory controller is enabled, 0 otherwise
 
     int pids_max;         // Maximum number of processes; -2 means "max" (unlimited)
     int pids_enabled;     // 1 if pids controller is enabled, 0 otherwise
+
+    const char *group;    // Parent cgroup below runbox/, NULL for none
 };
 
 int setup_cgroup(struct CgroupLimits *limits, pid_t child_pid);
+void sandbox_cgroup_path(const struct CgroupLimits *limits, pid_t child_pid, char *buffer, size_t size);
+int attach_to_cgroup(const char *cgroup_dir, pid_t pid);
+int update_cgroup_limits(const char *cgroup, struct CgroupLimits *limits);
+int validate_tenant_name(const char *name);
+int set_tenant_limits(const char *tenant, struct CgroupLimits *limits);
+int remove_tenant(const char *tenant);
+int parse_memory_bytes(const char *mem, unsigned long long *bytes);
+int write_file(const char *path, const char *text);
+int read_file(const char *path, char *buffer, size_t size);
+int read_pressure(const char *cgroup, const char *file, double *avg10);
+unsigned long long read_stat_field(const char *buffer, const char *key);
 
 #endif
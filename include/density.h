@@ -0,0 +1,43 @@
+// density.h
+
+#ifndef DENSITY_H
+#define DENSITY_H
+
+#define DENSITY_INTERVAL_MS 1000
+
+// Older headers do not have it yet (Linux 6.4)
+#ifndef PR_SET_MEMORY_MERGE
+#define PR_SET_MEMORY_MERGE 67
+#endif
+
+// Never reclaim more than this share of the cgroup's usage in a single step
+#define RECLAIM_MAX_STEP_RATIO 0.10
+
+// Skip reclaim while the sandbox is already short on memory (memory.pressure "some avg10")
+#define RECLAIM_PRESSURE_LIMIT 1.0
+
+/**
+ * DensityMonitor - Per-sandbox state of the memory density controls.
+ *
+ * Fields:
+ *   cgroup            - Sandbox cgroup directory.
+ *   idle_ratio        - Target share of inactive memory (0 disables reclaim).
+ *   merged_pages_peak - Highest sum of ksm_merging_pages over the sandbox
+ *                       processes seen so far (their counters vanish on exit).
+ *   reclaimed_bytes   - Total memory.current drop caused by memory.reclaim.
+ */
+struct DensityMonitor {
+    const char *cgroup;
+    double idle_ratio;
+    int merge;
+
+    unsigned long long merged_pages_peak;
+    unsigned long long reclaimed_bytes;
+};
+
+int enable_memory_merge(void);
+void check_ksm_running(void);
+void density_init(struct DensityMonitor *monitor, const char *cgroup, int merge, double idle_ratio);
+void density_step(struct DensityMonitor *monitor);
+
+#endif
@@ -0,0 +1,27 @@
+// export.h
+
+#ifndef EXPORT_H
+#define EXPORT_H
+
+#include <sys/types.h>
+
+#define MAX_EXPORTS 16
+#define EXPORT_MAX_PENDING_FILES 256
+
+/**
+ * ExportSpec - One --export <sandbox_path>:<host_dir> request.
+ *
+ * Fields:
+ *   sandbox_path - Absolute path inside the sandbox (file or directory).
+ *   host_dir     - Host directory the path is copied into, keeping its base name.
+ */
+struct ExportSpec {
+    const char *sandbox_path;
+    const char *host_dir;
+};
+
+int parse_export(char *arg, struct ExportSpec *spec);
+int export_artifacts(pid_t pid, const struct ExportSpec *exports, int count);
+int copy_tree(const char *root, const struct ExportSpec *exports, int count);
+
+#endif
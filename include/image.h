@@ -0,0 +1,28 @@
+// image.h
+
+#ifndef IMAGE_H
+#define IMAGE_H
+
+#include <stddef.h>
+
+#define RUNBOX_IMAGE_DIR "/var/lib/runbox"
+#define IMAGE_BLOB_DIR RUNBOX_IMAGE_DIR "/blobs"
+#define IMAGE_LAYER_DIR RUNBOX_IMAGE_DIR "/layers"
+#define IMAGE_NAME_DIR RUNBOX_IMAGE_DIR "/images"
+#define IMAGE_NAME_MAX 128
+
+// overlayfs takes its options from a single page, which bounds how many layers can be stacked
+#define IMAGE_MAX_LAYERS 32
+#define IMAGE_LOWERDIR_MAX 3072
+
+// Files up to this size are buffered and handed to the hashing/writing workers; larger ones
+// are streamed to disk by the reader itself so memory use stays bounded
+#define IMAGE_INLINE_FILE_SIZE (32ull << 20)
+#define IMAGE_IMPORT_BUDGET (256ull << 20)
+#define IMAGE_MAX_PENDING_FILES 256
+
+int image_main(int argc, char **argv);
+int image_lowerdir(const char *name, char *buf, size_t size);
+int image_commit(int source_fd, const char *name, const char *parent);
+
+#endif
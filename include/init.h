@@ -0,0 +1,8 @@
+// init.h
+
+#ifndef INIT_H
+#define INIT_H
+
+int run_init(int (*workload)(void *arg), void *arg);
+
+#endif
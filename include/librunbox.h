@@ -0,0 +1,82 @@
+// librunbox.h
+
+#ifndef LIBRUNBOX_H
+#define LIBRUNBOX_H
+
+#include <sys/types.h>
+
+/*
+ * Embedding API of librunbox.a / librunbox.so, for schedulers that launch many sandboxes
+ * from their own event loop instead of running the runbox CLI for each.
+ *
+ * runbox_spawn() forks a launcher that sets up and supervises the sandbox exactly like
+ * the CLI, and returns right away. The handle's fd is a pidfd of that launcher: it polls
+ * readable once the sandbox has exited, and runbox_report() then collects the result.
+ * The caller needs the same privileges as the CLI.
+ */
+
+enum runbox_limit {
+    RUNBOX_LIMIT_NONE = 0,
+    RUNBOX_LIMIT_TIMEOUT,
+    RUNBOX_LIMIT_CPU_TIME,
+};
+
+/**
+ * runbox_spec - What to run and under which limits. Start from runbox_spec_init().
+ *
+ * Fields:
+ *   argv           - Command and arguments, NULL-terminated. Required.
+ *   memory         - memory.max (e.g. "256M", "1G"), NULL for no limit.
+ *   cpus           - Number of CPUs for cpu.max, 0 for no limit.
+ *   pids           - pids.max, 0 for the default.
+ *   timeout        - Wall-clock limit in seconds, 0 for none.
+ *   cpu_time       - CPU time limit in seconds, 0 for none. Needs cgroups.
+ *   enable_network - Keep the host network instead of an isolated one.
+ *   disable_cgroups - Run without a cgroup; no limits are applied.
+ *   netns_pool     - Take the network namespace from the pool (`runbox netns-pool`).
+ *   image          - Boot from this imported image, NULL for the host directories.
+ *   tenant         - Tenant cgroup the sandbox cgroup goes under, NULL for none.
+ *   stdio_fds      - stdin, stdout and stderr of the sandbox, -1 to inherit the caller's.
+ */
+struct runbox_spec {
+    char *const *argv;
+    const char *memory;
+    double cpus;
+    int pids;
+    double timeout;
+    double cpu_time;
+    int enable_network;
+    int disable_cgroups;
+    int netns_pool;
+    const char *image;
+    const char *tenant;
+    int stdio_fds[3];
+};
+
+/**
+ * runbox_report - Result of a finished sandbox.
+ *
+ * Fields:
+ *   status       - Exit status of the sandbox (128 + signal if it was killed), -1 if
+ *                  it could not be set up.
+ *   limit        - Which limit ended it, RUNBOX_LIMIT_NONE if none did.
+ *   wall_seconds - Wall-clock time from the workload start to the sandbox exit.
+ *   cpu_seconds  - CPU time of the whole sandbox cgroup, -1 if unknown.
+ */
+struct runbox_report {
+    int status;
+    enum runbox_limit limit;
+    double wall_seconds;
+    double cpu_seconds;
+};
+
+struct runbox_handle;
+
+void runbox_spec_init(struct runbox_spec *spec);
+int runbox_spawn(const struct runbox_spec *spec, struct runbox_handle **handle);
+int runbox_handle_fd(const struct runbox_handle *handle);
+pid_t runbox_handle_pid(const struct runbox_handle *handle);
+int runbox_report(struct runbox_handle *handle, struct runbox_report *report);
+void runbox_release(struct runbox_handle *handle);
+
+#endif
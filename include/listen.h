@@ -0,0 +1,32 @@
+// listen.h
+
+#ifndef LISTEN_H
+#define LISTEN_H
+
+#define MAX_LISTEN 8
+
+// First fd handed to the workload, as in systemd's sd_listen_fds()
+#define LISTEN_FDS_START 3
+
+/**
+ * ListenSpec - One --listen <proto>:<host>:<port> socket.
+ *
+ * Fields:
+ *   proto - "tcp" or "udp".
+ *   host  - Address to bind, empty for all addresses. IPv6 addresses go in brackets.
+ *   port  - Port number or service name.
+ *   fd    - Socket bound in the host network namespace, -1 until open_listeners().
+ */
+struct ListenSpec {
+    const char *proto;
+    const char *host;
+    const char *port;
+    int fd;
+};
+
+int parse_listen(char *arg, struct ListenSpec *spec);
+int open_listeners(struct ListenSpec *specs, int count);
+void close_listeners(struct ListenSpec *specs, int count);
+int pass_listeners(const struct ListenSpec *specs, int count);
+
+#endif
@@ -0,0 +1,49 @@
+// minroot.h
+
+#ifndef MINROOT_H
+#define MINROOT_H
+
+#define MINROOT_CACHE_DIR "/var/cache/runbox/manifests"
+
+// Guards against runaway dependency graphs and symlink loops
+#define MINROOT_MAX_ENTRIES 1024
+#define MINROOT_MAX_SYMLINKS 40
+
+enum ManifestEntryType {
+    MANIFEST_FILE,
+    MANIFEST_SYMLINK,
+};
+
+/**
+ * ManifestEntry - One path the minimal root has to provide.
+ *
+ * Fields:
+ *   type   - MANIFEST_FILE is bind-mounted read-only from the host,
+ *            MANIFEST_SYMLINK is recreated as a symlink.
+ *   path   - Absolute path. Its parent directories contain no symlinks.
+ *   target - Link target for MANIFEST_SYMLINK, NULL otherwise.
+ */
+struct ManifestEntry {
+    enum ManifestEntryType type;
+    char *path;
+    char *target;
+};
+
+/**
+ * Manifest - Every file and symlink needed to run one binary.
+ *
+ * Built from the PT_INTERP / DT_NEEDED closure of the binary and cached under
+ * MINROOT_CACHE_DIR, keyed by the binary's device, inode and mtime. The cache
+ * records the same identity for every file and is dropped when one changes.
+ */
+struct Manifest {
+    struct ManifestEntry *entries;
+    int count;
+    int capacity;
+};
+
+int load_manifest(char **command, struct Manifest *manifest);
+void free_manifest(struct Manifest *manifest);
+int mount_minimal_root(const char *root, const struct Manifest *manifest);
+
+#endif
@@ -3,16 +3,46 @@
 #ifndef NAMESPACES_H
 #define NAMESPACES_H
 
+#include <sys/types.h>
+#include "volume.h"
+#include "minroot.h"
+
+// The sandbox init keeps its writable area open on this descriptor for `runbox commit`
+#define SANDBOX_WRITABLE_FD 900
+
+/**
+ * MountSpec - Describes where the sandbox root filesystem comes from.
+ *
+ * Fields:
+ *   lowerdir     - overlayfs lowerdir= list of image layers, top layer first.
+ *                  NULL binds the host's /bin, /lib and /usr directories instead.
+ *   base         - The layers are a --base: bind the host directories on top of them.
+ *   manifest     - Build the root from just these files instead (--minimal-root),
+ *                  NULL if unused.
+ *   volumes      - Host paths mounted into the sandbox on top of the root.
+ *   volume_count - Number of entries in `volumes`.
+ */
+struct MountSpec {
+    const char *lowerdir;
+    int base;
+    const struct Manifest *manifest;
+    const struct VolumeSpec *volumes;
+    int volume_count;
+};
+
 int setup_user_namespace(void);
-int setup_mount_namespace(void);
+int setup_mount_namespace(const struct MountSpec *mounts);
 int setup_pid_namespace(void);
 int setup_network_namespace(int enable_network);
+int bring_up_loopback(void);
 int setup_ipc_and_uts_namespace(void);
+int join_namespaces(int pidfd, pid_t pid);
 
 int apply_default_capabilities(void);
 int drop_bounding_caps(void);
 
 int exec_shell(void);
+int exec_command(char **argv);
 int setup_pivot_root(void);
 
 #endif // NAMESPACES_H
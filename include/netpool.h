@@ -0,0 +1,26 @@
+// netpool.h
+
+#ifndef NETPOOL_H
+#define NETPOOL_H
+
+#include "state.h"
+
+#define NETNS_POOL_DIR RUNBOX_STATE_DIR "/netns-pool"
+#define NETNS_POOL_MUTEX NETNS_POOL_DIR "/.lock"
+#define NETNS_POOL_MAX 4096
+
+/*
+ * Pool of network namespaces created ahead of time for --netns-pool.
+ *
+ * Each namespace has loopback up and is pinned by bind-mounting it over a file in
+ * NETNS_POOL_DIR. Taking one unpins it and hands back an open descriptor, which the
+ * sandbox init joins with setns() instead of creating its own. Used namespaces are not
+ * put back: whoever took one adds a fresh one once its sandbox has exited.
+ */
+int netns_pool_take(void);
+int netns_pool_add(int count);
+int netns_pool_fill(int size);
+int netns_pool_drain(void);
+int netns_pool_count(void);
+
+#endif
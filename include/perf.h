@@ -0,0 +1,53 @@
+// perf.h
+
+#ifndef PERF_H
+#define PERF_H
+
+// Upper bound on the CPUs counters are opened on (one fd per counter and CPU)
+#define PERF_MAX_CPUS 1024
+
+enum PerfCounterKind {
+    PERF_TASK_CLOCK,
+    PERF_CONTEXT_SWITCHES,
+    PERF_PAGE_FAULTS,
+    PERF_CPU_MIGRATIONS,
+    PERF_CYCLES,
+    PERF_INSTRUCTIONS,
+    PERF_CACHE_MISSES,
+    PERF_COUNTER_COUNT,
+};
+
+/**
+ * PerfCounters - Cgroup-scoped perf_event counters of one sandbox.
+ *
+ * A cgroup event only counts on the CPU it was opened for, so every counter
+ * is opened once per online CPU and summed when read.
+ *
+ * Fields:
+ *   fds   - fds[counter][i] for the i-th online CPU, -1 where unavailable.
+ *   ncpus - Number of CPUs in `fds`.
+ */
+struct PerfCounters {
+    int *fds[PERF_COUNTER_COUNT];
+    int ncpus;
+};
+
+/**
+ * PerfTotals - Counter totals for the exit report.
+ *
+ * Fields:
+ *   values    - Sum over all CPUs, scaled up if the kernel had to multiplex
+ *               the counter. task_clock is in nanoseconds.
+ *   supported - Whether the counter could be opened (hardware events need a PMU).
+ */
+struct PerfTotals {
+    unsigned long long values[PERF_COUNTER_COUNT];
+    int supported[PERF_COUNTER_COUNT];
+};
+
+int perf_open(struct PerfCounters *perf, const char *cgroup);
+void perf_read(const struct PerfCounters *perf, struct PerfTotals *totals);
+void perf_close(struct PerfCounters *perf);
+const char *perf_counter_name(enum PerfCounterKind kind);
+
+#endif
@@ -0,0 +1,30 @@
+// pipeline.h
+
+#ifndef PIPELINE_H
+#define PIPELINE_H
+
+#include "cgroup.h"
+#include "runbox.h"
+
+#define MAX_PIPELINE_STAGES 16
+
+// Pipes between stages are grown to this size so a stage can run ahead of the next one
+#define PIPELINE_PIPE_SIZE (1 << 20)
+
+/**
+ * PipelineStage - One sandbox of a `runbox pipe` chain.
+ *
+ * Fields:
+ *   config - Sandbox options of the stage. stdio_fds is filled in by run_pipeline.
+ *   limits - Cgroup limits of the stage.
+ *   label  - The stage's command as typed, used in the report.
+ */
+struct PipelineStage {
+    struct Config config;
+    struct CgroupLimits limits;
+    const char *label;
+};
+
+int run_pipeline(struct PipelineStage *stages, int count, int tap);
+
+#endif
@@ -0,0 +1,53 @@
+// pod.h
+
+#ifndef POD_H
+#define POD_H
+
+#include "state.h"
+#include "cgroup.h"
+
+#define POD_DIR RUNBOX_STATE_DIR "/pods"
+#define POD_MUTEX POD_DIR "/.lock"
+#define POD_NAME_MAX 64
+#define POD_PATH_MAX (sizeof(POD_DIR) + POD_NAME_MAX + 16)
+
+// Pod-wide POSIX shared memory, visible to every member at the usual place
+#define POD_SHM_SANDBOX_DIR "/dev/shm"
+
+/**
+ * Pod - Namespaces shared by the members of one --pod.
+ *
+ * The first member creates a network, IPC and UTS namespace (with loopback up
+ * and the pod name as hostname) and pins them by bind-mounting them under
+ * POD_DIR/<name>, together with a tmpfs for /dev/shm. Every member holds a
+ * shared flock on the pod for as long as it runs; the last one to leave
+ * unpins everything. POD_MUTEX serializes creating, joining and removing.
+ *
+ * Fields:
+ *   name     - Pod name, also its hostname.
+ *   tenant   - Tenant whose cgroup holds the pod's, NULL for none.
+ *   group    - Parent cgroup of the members below runbox/ ("pod-<name>", or
+ *              "<tenant>/pod-<name>").
+ *   lock_fd  - Open pod lock, -1 when not a member.
+ *   net_fd   - Pinned namespaces, joined by the sandbox init with setns().
+ *   ipc_fd
+ *   uts_fd
+ *   shm_path - Host directory mounted at POD_SHM_SANDBOX_DIR in every member.
+ */
+struct Pod {
+    const char *name;
+    const char *tenant;
+    char group[TENANT_NAME_MAX + POD_NAME_MAX + 8];
+    int lock_fd;
+    int net_fd;
+    int ipc_fd;
+    int uts_fd;
+    char shm_path[POD_PATH_MAX];
+};
+
+int validate_pod_name(const char *name);
+int open_pod(struct Pod *pod);
+int join_pod_namespaces(const struct Pod *pod);
+void close_pod(struct Pod *pod);
+
+#endif
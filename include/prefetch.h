@@ -0,0 +1,82 @@
+// prefetch.h
+
+#ifndef PREFETCH_H
+#define PREFETCH_H
+
+#include <limits.h>
+#include <pthread.h>
+#include <sys/types.h>
+#include "image.h"
+#include "volume.h"
+
+#define PREFETCH_DIR "/var/cache/runbox/prefetch"
+#define PREFETCH_DEFAULT_WINDOW_MS 1000
+#define PREFETCH_THREADS 4
+#define PREFETCH_MAX_FILES 4096
+
+// The namespace child opens the recording fanotify group on this descriptor; the launcher
+// takes a copy from the init with pidfd_getfd before the workload starts
+#define PREFETCH_FANOTIFY_FD 901
+
+struct Config;
+
+/**
+ * PrefetchFile - One file of a prefetch list and the byte ranges to read ahead.
+ *
+ * Fields:
+ *   path    - Path on the host (volumes and image layers already resolved).
+ *   ranges  - Offset and length pairs, in file order.
+ *   count   - Number of ranges.
+ */
+struct PrefetchFile {
+    char *path;
+    off_t (*ranges)[2];
+    int count;
+};
+
+/**
+ * Prefetch - State of one --prefetch run.
+ *
+ * A workload (command line and root layers) without a list is recorded: the files it
+ * opens during the first window_ms are collected and stored with the ranges of them that
+ * are in the page cache when the window closes. Later runs read those ranges ahead from
+ * worker threads while the namespaces are being set up.
+ *
+ * Fields:
+ *   list_path   - Prefetch list of this workload under PREFETCH_DIR.
+ *   recording   - No list yet, this run records one.
+ *   window_ms   - How long to record after the workload is released.
+ *   lowerdir    - Image layers of the root, top first, empty for none.
+ *   host_dirs   - The host's /bin, /lib and /usr are (also) part of the root.
+ *   files       - Files being prefetched or recorded.
+ *   next        - Next file for a prefetch worker to take.
+ *   fanotify_fd - Launcher's copy of the recording group, -1 if not recording.
+ */
+struct Prefetch {
+    char list_path[PATH_MAX];
+    int recording;
+    int window_ms;
+
+    char lowerdir[IMAGE_LOWERDIR_MAX];
+    int host_dirs;
+    const struct VolumeSpec *volumes;
+    int volume_count;
+
+    struct PrefetchFile *files;
+    int count;
+    int next;
+
+    pthread_t threads[PREFETCH_THREADS];
+    int nthreads;
+    int fanotify_fd;
+    pthread_t recorder;
+    int recorder_running;
+};
+
+int prefetch_begin(struct Prefetch *prefetch, const struct Config *config, const char *lowerdir,
+                   const struct VolumeSpec *volumes, int volume_count);
+int prefetch_mark_mounts(const char *root);
+void prefetch_record(struct Prefetch *prefetch, pid_t init_pid);
+void prefetch_finish(struct Prefetch *prefetch);
+
+#endif
@@ -4,12 +4,79 @@
 #define RUNBOX_H
 
 #include "cgroup.h"
+#include "autotune.h"
+#include "admission.h"
+#include "export.h"
+#include "volume.h"
+#include "pod.h"
+#include "shared.h"
+#include "listen.h"
+#include "cache.h"
+#include "prefetch.h"
+
+// Backoff between sandbox restarts, doubled after each quick failure
+#define RESTART_DELAY_MIN_MS 100
+#define RESTART_DELAY_MAX_MS 10000
+// A sandbox that ran at least this long starts over from the minimum delay
+#define RESTART_RESET_SECONDS 10.0
+
+struct ExitReport;
+
+enum RestartPolicy {
+    RESTART_NO = 0,
+    RESTART_ON_FAILURE,
+    RESTART_ALWAYS,
+};
 
 struct Config {
     int enable_network;
     int disable_cgroups;
+    char **command;       // Command to run inside the sandbox (NULL-terminated), NULL for a shell
+    int (*payload)(void *arg); // In-process workload run instead of `command` (used by benchmarks)
+    void *payload_arg;
+
+    double timeout;       // Wall-clock limit in seconds, 0 for none
+    double cpu_time;      // CPU time limit in seconds for the whole sandbox cgroup, 0 for none
+    double kill_grace;    // Seconds between SIGTERM and cgroup.kill once a limit fires
+    int report;           // Print the exit report when the sandbox exits
+    const char *trace_file; // Write a Chrome trace of the setup phases here, NULL to disable
+    int no_init;          // Exec the workload as PID 1 instead of running the built-in init
+    const char *image;    // Boot from this imported image instead of the host directories, NULL for host
+    const char *base;     // Mount this image's layers under the writable area of a host-root sandbox, NULL for none
+    int minimal_root;     // Build the root from only the command's ELF dependency closure
+    enum AdmissionMode admission; // Wait for / require room in the host-wide admission gate before launching
+    int memory_merge;     // Let KSM merge identical anonymous pages of the workload
+    double memory_reclaim; // Target share of idle memory kept by proactive reclaim, 0 to disable
+    int perf_counters;    // Count CPU and scheduler events of the sandbox cgroup with perf_event
+    int prefetch;         // Record the files opened in this many ms after start, or read them ahead if recorded; 0 to disable
+
+    struct ExportSpec exports[MAX_EXPORTS]; // Paths copied out of the sandbox after the workload exits
+    int export_count;
+    struct VolumeSpec volumes[MAX_VOLUMES]; // Host paths mounted into the sandbox
+    int volume_count;
+    struct SharedDataSpec shared[MAX_SHARED_DATA]; // Files loaded once into memory and shared read-only
+    int shared_count;
+    struct ListenSpec listeners[MAX_LISTEN]; // Sockets bound on the host and passed in as LISTEN_FDS
+    int listen_count;
+    enum RestartPolicy restart; // Run the sandbox again after it exits
+    const char *tenant;   // Tenant cgroup below runbox/ that the sandbox cgroup is created in, NULL for none
+    struct Pod pod;       // Pod whose network, IPC and UTS namespaces are shared, pod.name NULL for none
+    int netns_pool;       // Join a pre-created network namespace from the pool instead of creating one
+
+    int cache;            // Replay the stored result of an identical earlier run instead of running
+    unsigned long long cache_size; // Size limit of the result cache in bytes
+    const char *inputs[MAX_CACHE_INPUTS]; // Host files and directories hashed into the cache key
+    int input_count;
+    int stdio_fds[3];     // stdin/stdout/stderr given to the sandbox (result cache, pipelines), -1 to inherit ours
+    struct ExitReport *exit_report; // Filled in with the report of the last run (librunbox), NULL if not wanted
+
+    struct AutotuneConfig autotune; // Bounds for PSI-driven cpu.max / memory.high tuning
 };
 
+void default_config(struct Config *config, struct CgroupLimits *limits);
 int setup_sandbox(struct Config *config, struct CgroupLimits *limits);
+int exec_in_sandbox(const char *id, char **command);
+int update_sandbox(const char *id, struct CgroupLimits *limits);
+int commit_sandbox(const char *id, const char *name);
 
 #endif
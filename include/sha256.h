@@ -0,0 +1,24 @@
+// sha256.h
+
+#ifndef SHA256_H
+#define SHA256_H
+
+#include <stddef.h>
+#include <stdint.h>
+
+#define SHA256_DIGEST_SIZE 32
+#define SHA256_HEX_SIZE (SHA256_DIGEST_SIZE * 2 + 1)
+
+struct Sha256 {
+    uint32_t state[8];
+    uint64_t length;      // Total bytes hashed so far
+    uint8_t block[64];
+    size_t block_len;
+};
+
+void sha256_init(struct Sha256 *ctx);
+void sha256_update(struct Sha256 *ctx, const void *data, size_t len);
+void sha256_final(struct Sha256 *ctx, uint8_t digest[SHA256_DIGEST_SIZE]);
+void sha256_final_hex(struct Sha256 *ctx, char hex[SHA256_HEX_SIZE]);
+
+#endif
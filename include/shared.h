@@ -0,0 +1,38 @@
+// shared.h
+
+#ifndef SHARED_H
+#define SHARED_H
+
+#include "state.h"
+#include "volume.h"
+
+#define SHARED_DATA_DIR RUNBOX_STATE_DIR "/shared"
+#define SHARED_DATA_HUGE_DIR SHARED_DATA_DIR "/huge"
+#define SHARED_DATA_SANDBOX_DIR "/run/shared"
+#define SHARED_DATA_NAME_MAX 64
+#define MAX_SHARED_DATA 8
+#define SHARED_DATA_PATH_MAX (sizeof(SHARED_DATA_HUGE_DIR) + SHARED_DATA_NAME_MAX + 16)
+
+/**
+ * SharedDataSpec - One --shared-data <name>=<file>[:huge] request.
+ *
+ * Fields:
+ *   name         - Name of the copy, also its file name inside the sandbox.
+ *   source       - Host file loaded into memory.
+ *   huge         - Back the copy with transparent huge pages.
+ *   host_path    - In-memory copy on the host, filled in by prepare_shared_data().
+ *   sandbox_path - Where the copy appears inside the sandbox.
+ */
+struct SharedDataSpec {
+    const char *name;
+    const char *source;
+    int huge;
+
+    char host_path[SHARED_DATA_PATH_MAX];
+    char sandbox_path[sizeof(SHARED_DATA_SANDBOX_DIR) + SHARED_DATA_NAME_MAX + 1];
+};
+
+int parse_shared_data(char *arg, struct SharedDataSpec *spec);
+int prepare_shared_data(struct SharedDataSpec *spec, struct VolumeSpec *volume);
+
+#endif
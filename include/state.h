@@ -0,0 +1,40 @@
+// state.h
+
+#ifndef STATE_H
+#define STATE_H
+
+#include <sys/types.h>
+#include "image.h"
+
+#define RUNBOX_STATE_DIR "/run/runbox"
+#define RUNBOX_SANDBOX_STATE_DIR RUNBOX_STATE_DIR "/sandboxes"
+
+/**
+ * SandboxState - Registry entry describing a running sandbox.
+ *
+ * Each sandbox is identified by the host PID of its init process (the same
+ * number used for its cgroup). The supervisor records the entry under
+ * /run/runbox/sandboxes/<id> once the sandbox is up and removes it on exit.
+ *
+ * Fields:
+ *   pid        - Host PID of the sandbox init (PID 1 inside the sandbox).
+ *   start_time - Start time of that process (field 22 of /proc/<pid>/stat),
+ *                used to detect PID reuse after the sandbox has exited.
+ *   cgroup     - Cgroup directory of the sandbox, empty if cgroups are disabled.
+ *   root       - Where the root filesystem comes from: "host", "base", "image" or "minimal".
+ *   image      - Image given to --image or --base, empty for none.
+ */
+struct SandboxState {
+    pid_t pid;
+    unsigned long long start_time;
+    char cgroup[256];
+    char root[16];
+    char image[IMAGE_NAME_MAX + 1];
+};
+
+int save_sandbox_state(const struct SandboxState *state);
+int load_sandbox_state(const char *id, struct SandboxState *state);
+int remove_sandbox_state(pid_t pid);
+int read_process_start_time(pid_t pid, unsigned long long *start_time);
+
+#endif
@@ -0,0 +1,52 @@
+// supervisor.h
+
+#ifndef SUPERVISOR_H
+#define SUPERVISOR_H
+
+#include <sys/types.h>
+#include "runbox.h"
+#include "perf.h"
+
+#define CPU_TIME_POLL_MS 100
+#define DEFAULT_KILL_GRACE_SECONDS 5.0
+
+enum LimitKind {
+    LIMIT_NONE = 0,
+    LIMIT_TIMEOUT,
+    LIMIT_CPU_TIME,
+};
+
+/**
+ * ExitReport - Summary of a finished sandbox, filled in by the supervisor.
+ *
+ * Fields:
+ *   exit_status  - Exit status of the sandbox (128 + signal if it was killed).
+ *   limit        - Which supervisor-enforced limit fired, LIMIT_NONE if none did.
+ *   wall_seconds - Wall-clock time from the workload start to the sandbox exit.
+ *   cpu_seconds  - CPU time used by the whole sandbox cgroup (usage_usec in
+ *                  cpu.stat), or -1 if it could not be read.
+ *   merged_pages - Peak number of KSM-merged pages of the sandbox processes,
+ *                  or -1 without --memory-merge.
+ *   reclaimed_bytes - Memory freed by proactive reclaim, or -1 without
+ *                  --memory-reclaim.
+ *   perf_measured - Whether `perf` holds --perf-counters totals.
+ *   perf         - perf_event totals of the sandbox cgroup; counters without
+ *                  hardware support are marked unsupported and left out.
+ */
+struct ExitReport {
+    int exit_status;
+    enum LimitKind limit;
+    double wall_seconds;
+    double cpu_seconds;
+    long long merged_pages;
+    long long reclaimed_bytes;
+    int perf_measured;
+    struct PerfTotals perf;
+};
+
+int supervise_sandbox(struct Config *config, struct CgroupLimits *limits, pid_t child_pid,
+                      pid_t init_pid, int init_pidfd, const char *cgroup, int hold_fd,
+                      struct ExitReport *report);
+void print_exit_report(const struct ExitReport *report);
+
+#endif
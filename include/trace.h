@@ -0,0 +1,77 @@
+// trace.h
+
+#ifndef TRACE_H
+#define TRACE_H
+
+#include <stdint.h>
+
+#define TRACE_CAPACITY 1024
+
+// Processes taking part in sandbox setup; used as the thread ids of the trace
+enum TraceRole {
+    TRACE_ROLE_LAUNCHER = 1,
+    TRACE_ROLE_NAMESPACE_CHILD,
+    TRACE_ROLE_INIT,
+};
+
+enum TracePhase {
+    TRACE_SANDBOX,
+    TRACE_ADMISSION,
+    TRACE_MINIMAL_ROOT,
+    TRACE_MOUNT_NS,
+    TRACE_PID_NS,
+    TRACE_FORK,
+    TRACE_PIVOT_ROOT,
+    TRACE_MOUNT_PROC,
+    TRACE_IPC_UTS_NS,
+    TRACE_USER_NS,
+    TRACE_NET_NS,
+    TRACE_CGROUP,
+    TRACE_WAIT_START,
+    TRACE_LOCKDOWN,
+    TRACE_EXEC,
+    TRACE_SUPERVISE,
+    TRACE_PHASE_COUNT,
+};
+
+/**
+ * TraceEvent - One slot of the shared trace ring.
+ *
+ * Fields:
+ *   seq   - Index of the event plus one, stored last with release ordering.
+ *           A slot is only dumped if its seq matches the index being read,
+ *           so half-written or overwritten slots are skipped.
+ *   ts_ns - CLOCK_MONOTONIC timestamp (comparable across processes).
+ *   pid   - PID of the writer as seen in its own PID namespace.
+ *   err   - errno recorded when a phase ends in failure, 0 otherwise.
+ *   role  - enum TraceRole of the writer.
+ *   phase - enum TracePhase.
+ *   type  - Chrome trace-event phase: 'B' (begin), 'E' (end) or 'i' (instant).
+ */
+struct TraceEvent {
+    uint64_t seq;
+    uint64_t ts_ns;
+    int32_t pid;
+    int32_t err;
+    uint8_t role;
+    uint8_t phase;
+    char type;
+};
+
+struct TraceBuffer {
+    uint64_t head;
+    struct TraceEvent events[TRACE_CAPACITY];
+};
+
+int trace_open(void);
+void trace_close(void);
+int trace_enabled(void);
+void trace_set_role(enum TraceRole role);
+
+void trace_begin(enum TracePhase phase);
+void trace_end(enum TracePhase phase, int ret);
+void trace_instant(enum TracePhase phase);
+
+int trace_dump(const char *path);
+
+#endif
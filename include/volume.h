@@ -0,0 +1,25 @@
+// volume.h
+
+#ifndef VOLUME_H
+#define VOLUME_H
+
+#define MAX_VOLUMES 16
+
+/**
+ * VolumeSpec - One --volume <host>:<sandbox>[:ro|rw] request.
+ *
+ * Fields:
+ *   host_path    - Directory or file on the host.
+ *   sandbox_path - Absolute path it appears at inside the sandbox.
+ *   read_only    - Mount it read-only (1) or writable (0, the default).
+ */
+struct VolumeSpec {
+    const char *host_path;
+    const char *sandbox_path;
+    int read_only;
+};
+
+int parse_volume(char *arg, struct VolumeSpec *spec);
+int mount_volumes(const char *root, const struct VolumeSpec *volumes, int count);
+
+#endif
@@ -0,0 +1,52 @@
+// workqueue.h
+
+#ifndef WORKQUEUE_H
+#define WORKQUEUE_H
+
+#include <pthread.h>
+#include <stddef.h>
+
+#define WORKQUEUE_MAX_THREADS 64
+
+struct WorkItem;
+
+/**
+ * WorkQueue - Fixed pool of worker threads fed from a FIFO of jobs.
+ *
+ * Submitting blocks while the queued and running jobs hold more than
+ * `max_bytes` (or more than `max_jobs` jobs are outstanding), so a producer
+ * reading a stream never buffers far ahead of what the workers can write.
+ *
+ * Fields:
+ *   threads     - Worker threads, `nthreads` of them.
+ *   head, tail  - Pending jobs in submission order.
+ *   in_flight   - Jobs submitted but not yet finished.
+ *   bytes       - Sum of the byte weights of those jobs.
+ *   max_jobs    - Outstanding job limit before submit blocks.
+ *   max_bytes   - Outstanding byte limit before submit blocks; a single job
+ *                 larger than this is still admitted once the queue is idle.
+ *   stopping    - Set by workqueue_destroy() to let the workers exit.
+ */
+struct WorkQueue {
+    pthread_t threads[WORKQUEUE_MAX_THREADS];
+    int nthreads;
+
+    pthread_mutex_t lock;
+    pthread_cond_t work_ready;   // Signalled when a job is queued or on shutdown
+    pthread_cond_t work_done;    // Signalled when a job finishes
+
+    struct WorkItem *head;
+    struct WorkItem *tail;
+    size_t in_flight;
+    size_t bytes;
+    size_t max_jobs;
+    size_t max_bytes;
+    int stopping;
+};
+
+int workqueue_init(struct WorkQueue *wq, int nthreads, size_t max_jobs, size_t max_bytes);
+int workqueue_submit(struct WorkQueue *wq, void (*fn)(void *arg), void *arg, size_t bytes);
+void workqueue_wait(struct WorkQueue *wq);
+void workqueue_destroy(struct WorkQueue *wq);
+
+#endif
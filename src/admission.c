@@ -0,0 +1,349 @@
+#define _GNU_SOURCE
+
+#include <sys/file.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/syscall.h>
+#include <linux/futex.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "admission.h"
+
+struct HostCapacity {
+    double cpus;
+    unsigned long long memory;
+    long long pids;
+};
+
+// Counts the CPUs in a sysfs cpulist such as "0-3,8-11"
+static int count_cpulist(const char *list) {
+    int count = 0;
+    const char *p = list;
+
+    while (*p && *p != '\n') {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p) return -1;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+            if (end == p) return -1;
+        }
+
+        count += (int)(last - first + 1);
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return count;
+}
+
+static void read_host_capacity(struct HostCapacity *cap) {
+    char buf[4096];
+
+    cap->cpus = (double)sysconf(_SC_NPROCESSORS_ONLN);
+    if (read_file("/sys/devices/system/cpu/online", buf, sizeof(buf)) == 0) {
+        int n = count_cpulist(buf);
+        if (n > 0) cap->cpus = n;
+    }
+
+    cap->memory = (unsigned long long)sysconf(_SC_PHYS_PAGES) * (unsigned long long)sysconf(_SC_PAGESIZE);
+    if (read_file("/proc/meminfo", buf, sizeof(buf)) == 0) {
+        char *line = strstr(buf, "MemTotal:");
+        unsigned long long kb;
+        if (line && sscanf(line, "MemTotal: %llu kB", &kb) == 1) {
+            cap->memory = kb * 1024;
+        }
+    }
+
+    cap->pids = 32768;
+    if (read_file("/proc/sys/kernel/pid_max", buf, sizeof(buf)) == 0) {
+        cap->pids = atoll(buf);
+    }
+}
+
+/*
+ * An unlimited resource may use everything the host has, so it reserves the full capacity.
+ * Such a launch is admitted only when nothing else holds any of that resource.
+ */
+static void request_from_limits(const struct CgroupLimits *limits, const struct HostCapacity *cap,
+                                struct AdmissionEntry *entry) {
+    entry->cpus = limits->cpu_enabled && limits->cpus > 0 ? limits->cpus : cap->cpus;
+    entry->memory = cap->memory;
+    entry->pids = cap->pids;
+
+    // "max" is rejected by the parser and keeps the full capacity
+    if (limits->memory_enabled && limits->memory_max) {
+        parse_memory_bytes(limits->memory_max, &entry->memory);
+    }
+
+    if (limits->pids_enabled && limits->pids_max != PIDS_MAX_ALIAS) {
+        entry->pids = limits->pids_max;
+    }
+}
+
+static long futex(uint32_t *uaddr, int op, uint32_t val, const struct timespec *timeout) {
+    return syscall(SYS_futex, uaddr, op, val, timeout, NULL, 0);
+}
+
+// The table lives in a file mapping shared between processes, so no FUTEX_PRIVATE_FLAG
+static void wake_waiters(struct AdmissionTable *table) {
+    __atomic_add_fetch(&table->generation, 1, __ATOMIC_RELEASE);
+    futex(&table->generation, FUTEX_WAKE, INT_MAX, NULL);
+}
+
+static int lock_table(struct Admission *admission) {
+    while (flock(admission->fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            printf("failed locking %s: %s\n", ADMISSION_FILE, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void unlock_table(struct Admission *admission) {
+    flock(admission->fd, LOCK_UN);
+}
+
+static int open_table(struct Admission *admission) {
+    if (mkdir(RUNBOX_STATE_DIR, 0755) == -1 && errno != EEXIST) {
+        printf("failed creating %s: %s\n", RUNBOX_STATE_DIR, strerror(errno));
+        return -1;
+    }
+
+    admission->fd = open(ADMISSION_FILE, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (admission->fd == -1) {
+        printf("Error opening %s: %s\n", ADMISSION_FILE, strerror(errno));
+        return -1;
+    }
+
+    if (lock_table(admission) != 0) {
+        close(admission->fd);
+        return -1;
+    }
+
+    // Growing a file to its final size is idempotent, so whoever creates it first does not matter
+    struct stat st;
+    if (fstat(admission->fd, &st) == -1 ||
+        ((size_t)st.st_size < sizeof(struct AdmissionTable) &&
+         ftruncate(admission->fd, sizeof(struct AdmissionTable)) == -1)) {
+        printf("failed sizing %s: %s\n", ADMISSION_FILE, strerror(errno));
+        unlock_table(admission);
+        close(admission->fd);
+        return -1;
+    }
+
+    void *p = mmap(NULL, sizeof(struct AdmissionTable), PROT_READ | PROT_WRITE, MAP_SHARED, admission->fd, 0);
+    if (p == MAP_FAILED) {
+        printf("failed mapping %s: %s\n", ADMISSION_FILE, strerror(errno));
+        unlock_table(admission);
+        close(admission->fd);
+        return -1;
+    }
+
+    admission->table = p;
+
+    // A table from an incompatible build is discarded; its holders are not tracked any more
+    if (admission->table->magic != ADMISSION_MAGIC) {
+        memset(admission->table, 0, sizeof(struct AdmissionTable));
+        admission->table->magic = ADMISSION_MAGIC;
+    }
+
+    unlock_table(admission);
+    return 0;
+}
+
+static void close_table(struct Admission *admission) {
+    munmap(admission->table, sizeof(struct AdmissionTable));
+    close(admission->fd);
+    admission->table = NULL;
+    admission->fd = -1;
+}
+
+// Drops entries whose launcher is gone. Called with the table locked
+static int reclaim_stale(struct AdmissionTable *table) {
+    int reclaimed = 0;
+
+    for (int i = 0; i < ADMISSION_MAX_ENTRIES; i++) {
+        struct AdmissionEntry *entry = &table->entries[i];
+        unsigned long long start_time;
+
+        if (entry->state == ADMISSION_FREE) continue;
+
+        if (read_process_start_time(entry->pid, &start_time) != 0 || start_time != entry->start_time) {
+            memset(entry, 0, sizeof(*entry));
+            reclaimed = 1;
+        }
+    }
+
+    return reclaimed;
+}
+
+// Whether `slot` is the oldest waiter and fits next to everything already admitted
+static int can_admit(struct AdmissionTable *table, int slot, const struct HostCapacity *cap,
+                     struct AdmissionEntry *committed) {
+    struct AdmissionEntry *self = &table->entries[slot];
+    memset(committed, 0, sizeof(*committed));
+
+    for (int i = 0; i < ADMISSION_MAX_ENTRIES; i++) {
+        struct AdmissionEntry *entry = &table->entries[i];
+
+        if (entry->state == ADMISSION_ADMITTED) {
+            committed->cpus += entry->cpus;
+            committed->memory += entry->memory;
+            committed->pids += entry->pids;
+        } else if (entry->state == ADMISSION_WAITING && entry->ticket < self->ticket) {
+            committed->ticket++;   // Waiters queued ahead of us
+        }
+    }
+
+    return committed->ticket == 0 &&
+           committed->cpus + self->cpus <= cap->cpus + 1e-9 &&
+           committed->memory + self->memory <= cap->memory &&
+           committed->pids + self->pids <= cap->pids;
+}
+
+static void print_usage(const char *what, const struct AdmissionEntry *self,
+                        const struct AdmissionEntry *committed, const struct HostCapacity *cap) {
+    fprintf(stderr, "runbox: %s: request cpu=%.2f memory=%lluM pids=%lld; committed cpu=%.2f/%.0f "
+                    "memory=%lluM/%lluM pids=%lld/%lld, %llu queued ahead\n",
+            what, self->cpus, self->memory >> 20, self->pids,
+            committed->cpus, cap->cpus, committed->memory >> 20, cap->memory >> 20,
+            committed->pids, cap->pids, (unsigned long long)committed->ticket);
+}
+
+/*
+ * Takes a slot in the host-wide admission table for the given limits. In ADMISSION_WAIT
+ * mode this blocks, in queue order, until the limits fit next to those of all live
+ * sandboxes; in ADMISSION_FAIL mode it returns -1 straight away when they do not.
+ */
+int admission_acquire(enum AdmissionMode mode, const struct CgroupLimits *limits, struct Admission *admission) {
+    struct HostCapacity cap;
+    struct AdmissionEntry request = { 0 };
+    struct AdmissionEntry committed;
+
+    admission->fd = -1;
+    admission->table = NULL;
+    admission->slot = -1;
+
+    read_host_capacity(&cap);
+    request_from_limits(limits, &cap, &request);
+
+    if (request.cpus > cap.cpus || request.memory > cap.memory || request.pids > cap.pids) {
+        memset(&committed, 0, sizeof(committed));
+        print_usage("admission impossible, request exceeds host capacity", &request, &committed, &cap);
+        return -1;
+    }
+
+    request.pid = getpid();
+    if (read_process_start_time(request.pid, &request.start_time) != 0) {
+        return -1;
+    }
+
+    if (open_table(admission) != 0) {
+        return -1;
+    }
+
+    struct AdmissionTable *table = admission->table;
+
+    if (lock_table(admission) != 0) {
+        close_table(admission);
+        return -1;
+    }
+
+    if (reclaim_stale(table)) {
+        wake_waiters(table);
+    }
+
+    for (int i = 0; i < ADMISSION_MAX_ENTRIES; i++) {
+        if (table->entries[i].state == ADMISSION_FREE) {
+            admission->slot = i;
+            break;
+        }
+    }
+
+    if (admission->slot < 0) {
+        printf("admission table %s is full\n", ADMISSION_FILE);
+        unlock_table(admission);
+        close_table(admission);
+        return -1;
+    }
+
+    struct AdmissionEntry *self = &table->entries[admission->slot];
+    *self = request;
+    self->state = ADMISSION_WAITING;
+    self->ticket = table->next_ticket++;
+
+    int announced = 0;
+
+    for (;;) {
+        if (can_admit(table, admission->slot, &cap, &committed)) {
+            self->state = ADMISSION_ADMITTED;
+
+            // The next waiter in line may fit as well
+            wake_waiters(table);
+            unlock_table(admission);
+            return 0;
+        }
+
+        if (mode == ADMISSION_FAIL) {
+            print_usage("admission denied", self, &committed, &cap);
+            memset(self, 0, sizeof(*self));
+            unlock_table(admission);
+            close_table(admission);
+            return -1;
+        }
+
+        if (!announced) {
+            print_usage("waiting for admission", self, &committed, &cap);
+            announced = 1;
+        }
+
+        uint32_t seen = __atomic_load_n(&table->generation, __ATOMIC_ACQUIRE);
+        unlock_table(admission);
+
+        // The timeout bounds how long a crashed holder can block us before reclaim_stale() runs
+        struct timespec timeout = {
+            .tv_sec = ADMISSION_RECHECK_MS / 1000,
+            .tv_nsec = (ADMISSION_RECHECK_MS % 1000) * 1000000L
+        };
+        futex(&table->generation, FUTEX_WAIT, seen, &timeout);
+
+        if (lock_table(admission) != 0) {
+            close_table(admission);
+            return -1;
+        }
+
+        if (reclaim_stale(table)) {
+            wake_waiters(table);
+        }
+    }
+}
+
+void admission_release(struct Admission *admission) {
+    if (!admission->table) {
+        return;
+    }
+
+    if (lock_table(admission) == 0) {
+        struct AdmissionEntry *entry = &admission->table->entries[admission->slot];
+
+        if (entry->pid == getpid()) {
+            memset(entry, 0, sizeof(*entry));
+        }
+
+        wake_waiters(admission->table);
+        unlock_table(admission);
+    }
+
+    close_table(admission);
+}
@@ -0,0 +1,240 @@
+#include "autotune.h"
+#include "cgroup.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+// Pressure (PSI "some avg10", in percent) above which a resource counts as starved
+#define CPU_PRESSURE_HIGH 10.0
+#define MEMORY_PRESSURE_HIGH 5.0
+
+// Pressure below which a resource counts as comfortably provisioned
+#define CPU_PRESSURE_LOW 1.0
+#define MEMORY_PRESSURE_LOW 0.5
+
+// Share of CFS periods throttled in the last interval that triggers a raise / allows a cut
+#define THROTTLE_RATIO_HIGH 0.10
+#define THROTTLE_RATIO_LOW 0.01
+
+// Grow fast when starved, shrink slowly and only after this many calm intervals in a row
+#define GROW_FACTOR 1.25
+#define SHRINK_FACTOR 0.90
+#define CALM_STEPS_BEFORE_SHRINK 5
+
+// memory.high is only lowered while usage stays below this share of it
+#define MEMORY_SHRINK_USAGE_RATIO 0.60
+
+#define CPU_PERIOD_USEC 100000
+
+static int parse_range(const char *arg, char *low, char *high, size_t size) {
+    const char *sep = strchr(arg, ':');
+    if (!sep || (size_t)(sep - arg) >= size || strlen(sep + 1) >= size) {
+        return -1;
+    }
+
+    memcpy(low, arg, sep - arg);
+    low[sep - arg] = '\0';
+    strcpy(high, sep + 1);
+
+    return 0;
+}
+
+int parse_autotune_cpu(const char *arg, struct AutotuneConfig *config) {
+    char low[32], high[32];
+
+    if (parse_range(arg, low, high, sizeof(low)) != 0) {
+        return -1;
+    }
+
+    config->cpu_min = atof(low);
+    config->cpu_max = atof(high);
+
+    if (config->cpu_min <= 0 || config->cpu_max < config->cpu_min || config->cpu_max > MAX_CPU_LIMIT) {
+        return -1;
+    }
+
+    config->cpu_enabled = 1;
+    return 0;
+}
+
+int parse_autotune_memory(const char *arg, struct AutotuneConfig *config) {
+    char low[32], high[32];
+
+    if (parse_range(arg, low, high, sizeof(low)) != 0) {
+        return -1;
+    }
+
+    if (parse_memory_bytes(low, &config->memory_min) != 0 ||
+        parse_memory_bytes(high, &config->memory_max) != 0 ||
+        config->memory_max < config->memory_min) {
+        return -1;
+    }
+
+    config->memory_enabled = 1;
+    return 0;
+}
+
+static int write_cpu_max(const char *cgroup, double cpus) {
+    char path[256];
+    char value[64];
+
+    snprintf(path, sizeof(path), "%s/cpu.max", cgroup);
+    snprintf(value, sizeof(value), "%d %d", (int)(cpus * CPU_PERIOD_USEC), CPU_PERIOD_USEC);
+
+    return write_file(path, value);
+}
+
+static int write_memory_high(const char *cgroup, unsigned long long bytes) {
+    char path[256];
+    char value[32];
+
+    snprintf(path, sizeof(path), "%s/memory.high", cgroup);
+    snprintf(value, sizeof(value), "%llu", bytes);
+
+    return write_file(path, value);
+}
+
+static double clamp(double value, double low, double high) {
+    if (value < low) return low;
+    if (value > high) return high;
+    return value;
+}
+
+int autotune_init(struct Autotuner *tuner, const struct AutotuneConfig *config,
+                  const char *cgroup, double cpus, const char *memory_max) {
+    memset(tuner, 0, sizeof(*tuner));
+    tuner->config = config;
+    tuner->cgroup = cgroup;
+
+    if (config->cpu_enabled) {
+        // Start from the static --cpu value if there is one, otherwise from the upper bound
+        tuner->cpus = clamp(cpus > 0 ? cpus : config->cpu_max, config->cpu_min, config->cpu_max);
+
+        if (write_cpu_max(cgroup, tuner->cpus) != 0) {
+            printf("autotune: failed to set initial cpu.max\n");
+            return -1;
+        }
+    }
+
+    if (config->memory_enabled) {
+        unsigned long long start = config->memory_max;
+        parse_memory_bytes(memory_max, &start);
+
+        tuner->memory_high = (unsigned long long)clamp((double)start, (double)config->memory_min,
+                                                       (double)config->memory_max);
+
+        if (write_memory_high(cgroup, tuner->memory_high) != 0) {
+            printf("autotune: failed to set initial memory.high\n");
+            return -1;
+        }
+    }
+
+    fprintf(stderr, "runbox: autotune start cpus=%.2f memory.high=%llu\n", tuner->cpus, tuner->memory_high);
+    return 0;
+}
+
+static void tune_cpu(struct Autotuner *tuner) {
+    const struct AutotuneConfig *config = tuner->config;
+    char path[256];
+    char buffer[1024];
+
+    double pressure = 0;
+    int have_pressure = read_pressure(tuner->cgroup, "cpu.pressure", &pressure) == 0;
+
+    snprintf(path, sizeof(path), "%s/cpu.stat", tuner->cgroup);
+    if (read_file(path, buffer, sizeof(buffer)) != 0) {
+        return;
+    }
+
+    unsigned long long periods = read_stat_field(buffer, "nr_periods");
+    unsigned long long throttled = read_stat_field(buffer, "nr_throttled");
+    unsigned long long delta_periods = periods - tuner->last_nr_periods;
+    double throttle_ratio = delta_periods ? (double)(throttled - tuner->last_nr_throttled) / delta_periods : 0;
+
+    tuner->last_nr_periods = periods;
+    tuner->last_nr_throttled = throttled;
+
+    double next = tuner->cpus;
+
+    if (throttle_ratio > THROTTLE_RATIO_HIGH || (have_pressure && pressure > CPU_PRESSURE_HIGH)) {
+        next = clamp(tuner->cpus * GROW_FACTOR, config->cpu_min, config->cpu_max);
+        tuner->cpu_calm_steps = 0;
+    } else if (throttle_ratio < THROTTLE_RATIO_LOW && (!have_pressure || pressure < CPU_PRESSURE_LOW)) {
+        if (++tuner->cpu_calm_steps >= CALM_STEPS_BEFORE_SHRINK) {
+            next = clamp(tuner->cpus * SHRINK_FACTOR, config->cpu_min, config->cpu_max);
+            tuner->cpu_calm_steps = 0;
+        }
+    } else {
+        tuner->cpu_calm_steps = 0;
+    }
+
+    if ((int)(next * CPU_PERIOD_USEC) == (int)(tuner->cpus * CPU_PERIOD_USEC)) {
+        return;
+    }
+
+    if (write_cpu_max(tuner->cgroup, next) != 0) {
+        return;
+    }
+
+    fprintf(stderr, "runbox: autotune cpu.max %.2f -> %.2f CPUs (cpu.pressure avg10=%.2f, throttled=%.1f%%)\n",
+            tuner->cpus, next, pressure, throttle_ratio * 100);
+    tuner->cpus = next;
+}
+
+static void tune_memory(struct Autotuner *tuner) {
+    const struct AutotuneConfig *config = tuner->config;
+    char path[256];
+    char buffer[64];
+
+    double pressure;
+    if (read_pressure(tuner->cgroup, "memory.pressure", &pressure) != 0) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/memory.current", tuner->cgroup);
+    if (read_file(path, buffer, sizeof(buffer)) != 0) {
+        return;
+    }
+    unsigned long long current = strtoull(buffer, NULL, 10);
+
+    double next = (double)tuner->memory_high;
+
+    if (pressure > MEMORY_PRESSURE_HIGH) {
+        next = tuner->memory_high * GROW_FACTOR;
+        tuner->memory_calm_steps = 0;
+    } else if (pressure < MEMORY_PRESSURE_LOW && current < tuner->memory_high * MEMORY_SHRINK_USAGE_RATIO) {
+        if (++tuner->memory_calm_steps >= CALM_STEPS_BEFORE_SHRINK) {
+            // Never cut below what the workload is using right now plus headroom
+            next = tuner->memory_high * SHRINK_FACTOR;
+            if (next < current * GROW_FACTOR) {
+                next = current * GROW_FACTOR;
+            }
+            tuner->memory_calm_steps = 0;
+        }
+    } else {
+        tuner->memory_calm_steps = 0;
+    }
+
+    unsigned long long high = (unsigned long long)clamp(next, (double)config->memory_min, (double)config->memory_max);
+    if (high == tuner->memory_high) {
+        return;
+    }
+
+    if (write_memory_high(tuner->cgroup, high) != 0) {
+        return;
+    }
+
+    fprintf(stderr, "runbox: autotune memory.high %llu -> %llu (memory.pressure avg10=%.2f, memory.current=%llu)\n",
+            tuner->memory_high, high, pressure, current);
+    tuner->memory_high = high;
+}
+
+void autotune_step(struct Autotuner *tuner) {
+    if (tuner->config->cpu_enabled) {
+        tune_cpu(tuner);
+    }
+
+    if (tuner->config->memory_enabled) {
+        tune_memory(tuner);
+    }
+}
@@ -0,0 +1,1010 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/mman.h>
+#include <sys/syscall.h>
+#include <sys/utsname.h>
+#include <sys/stat.h>
+#include <dirent.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <sched.h>
+#include <signal.h>
+#include <time.h>
+#include <unistd.h>
+#include "runbox.h"
+#include "bench.h"
+#include "netpool.h"
+
+#define DEFAULT_SYSCALL_ITERATIONS 1000000
+#define DEFAULT_FORK_ITERATIONS 200
+
+#define IO_TOTAL_BYTES (64 << 20)
+#define IO_CHUNK_BYTES (1 << 20)
+
+// Files used for the I/O comparison: /tmp is a tmpfs inside the sandbox, /bin is a read-only bind mount
+#define IO_SCRATCH_DIR "/tmp"
+#define IO_BIND_FILE "/bin/sh"
+
+#define MEMORY_PROBE_LIMIT "64M"
+#define MEMORY_PROBE_CHUNK (1 << 20)
+#define PIDS_PROBE_LIMIT 32
+
+#define DEFAULT_SCALE_STEPS "100,1000,5000"
+#define MAX_SCALE_STEPS 16
+#define SCALE_LAUNCH_TIMEOUT_MS 30000
+
+#define DEFAULT_STARTUP_ITERATIONS 100
+
+struct OverheadResults {
+    double getpid_ns;
+    double read_ns;
+    double fork_exec_per_sec;
+    double tmpfs_write_mbps;
+    double tmpfs_read_mbps;
+    double bind_read_mbps;
+};
+
+// Lives in a MAP_SHARED mapping so sandboxed payloads can hand results back to the launcher
+struct BenchShared {
+    int iterations;
+    int fork_iterations;
+
+    struct OverheadResults sandbox;
+
+    volatile unsigned long long memory_touched;
+    volatile int forks_ok;
+    volatile int fork_errno;
+};
+
+static double now_ns(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec * 1e9 + (double)ts.tv_nsec;
+}
+
+static double bench_getpid(int iterations) {
+    double start = now_ns();
+
+    for (int i = 0; i < iterations; i++) {
+        syscall(SYS_getpid);
+    }
+
+    return (now_ns() - start) / iterations;
+}
+
+// Zero-length reads still go through the full syscall entry (and seccomp) path
+static double bench_read(int iterations) {
+    int fds[2];
+    char c;
+
+    if (pipe(fds) == -1) {
+        return -1;
+    }
+
+    double start = now_ns();
+
+    for (int i = 0; i < iterations; i++) {
+        if (read(fds[0], &c, 0) != 0) break;
+    }
+
+    double elapsed = now_ns() - start;
+
+    close(fds[0]);
+    close(fds[1]);
+
+    return elapsed / iterations;
+}
+
+static double bench_fork_exec(int iterations) {
+    double start = now_ns();
+
+    for (int i = 0; i < iterations; i++) {
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            execl("/bin/true", "true", (char *)NULL);
+            _exit(127);
+        } else if (pid < 0) {
+            return -1;
+        }
+
+        int status;
+        waitpid(pid, &status, 0);
+    }
+
+    return iterations / ((now_ns() - start) / 1e9);
+}
+
+static double mbps(double bytes, double ns) {
+    return (bytes / (1 << 20)) / (ns / 1e9);
+}
+
+static int bench_file_io(const char *dir, double *write_mbps, double *read_mbps) {
+    char path[256];
+    snprintf(path, sizeof(path), "%s/runbox-bench.%d", dir, getpid());
+
+    char *chunk = malloc(IO_CHUNK_BYTES);
+    if (!chunk) {
+        return -1;
+    }
+    memset(chunk, 0xa5, IO_CHUNK_BYTES);
+
+    int fd = open(path, O_RDWR | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        free(chunk);
+        return -1;
+    }
+
+    double start = now_ns();
+    for (off_t off = 0; off < IO_TOTAL_BYTES; off += IO_CHUNK_BYTES) {
+        if (pwrite(fd, chunk, IO_CHUNK_BYTES, off) != IO_CHUNK_BYTES) break;
+    }
+    *write_mbps = mbps(IO_TOTAL_BYTES, now_ns() - start);
+
+    start = now_ns();
+    for (off_t off = 0; off < IO_TOTAL_BYTES; off += IO_CHUNK_BYTES) {
+        if (pread(fd, chunk, IO_CHUNK_BYTES, off) <= 0) break;
+    }
+    *read_mbps = mbps(IO_TOTAL_BYTES, now_ns() - start);
+
+    close(fd);
+    unlink(path);
+    free(chunk);
+
+    return 0;
+}
+
+// Re-reads one (page cached) file until IO_TOTAL_BYTES have been transferred
+static double bench_bind_read(const char *path) {
+    char *chunk = malloc(IO_CHUNK_BYTES);
+    if (!chunk) {
+        return -1;
+    }
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        free(chunk);
+        return -1;
+    }
+
+    double total = 0;
+    double start = now_ns();
+
+    while (total < IO_TOTAL_BYTES) {
+        off_t off = 0;
+        ssize_t n;
+
+        while ((n = pread(fd, chunk, IO_CHUNK_BYTES, off)) > 0) {
+            off += n;
+            total += n;
+        }
+
+        if (off == 0) break;
+    }
+
+    double elapsed = now_ns() - start;
+
+    close(fd);
+    free(chunk);
+
+    return total > 0 ? mbps(total, elapsed) : -1;
+}
+
+static void run_overhead_suite(struct OverheadResults *results, int iterations, int fork_iterations) {
+    results->getpid_ns = bench_getpid(iterations);
+    results->read_ns = bench_read(iterations);
+    results->fork_exec_per_sec = bench_fork_exec(fork_iterations);
+
+    if (bench_file_io(IO_SCRATCH_DIR, &results->tmpfs_write_mbps, &results->tmpfs_read_mbps) != 0) {
+        results->tmpfs_write_mbps = results->tmpfs_read_mbps = -1;
+    }
+
+    results->bind_read_mbps = bench_bind_read(IO_BIND_FILE);
+}
+
+static int overhead_payload(void *arg) {
+    struct BenchShared *shared = arg;
+    run_overhead_suite(&shared->sandbox, shared->iterations, shared->fork_iterations);
+    return 0;
+}
+
+// Touches memory until the cgroup OOM killer stops us (or well past the limit if nothing does)
+static int memory_probe_payload(void *arg) {
+    struct BenchShared *shared = arg;
+    unsigned long long limit;
+
+    parse_memory_bytes(MEMORY_PROBE_LIMIT, &limit);
+
+    while (shared->memory_touched < limit * 4) {
+        char *p = mmap(NULL, MEMORY_PROBE_CHUNK, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+        if (p == MAP_FAILED) {
+            return 1;
+        }
+
+        memset(p, 1, MEMORY_PROBE_CHUNK);
+        shared->memory_touched += MEMORY_PROBE_CHUNK;
+    }
+
+    return 0;
+}
+
+// Forks idle children until pids.max refuses more
+static int pids_probe_payload(void *arg) {
+    struct BenchShared *shared = arg;
+
+    for (int i = 0; i < PIDS_PROBE_LIMIT * 4; i++) {
+        pid_t pid = fork();
+
+        if (pid == 0) {
+            pause();
+            _exit(0);
+        } else if (pid < 0) {
+            shared->fork_errno = errno;
+            break;
+        }
+
+        shared->forks_ok++;
+    }
+
+    // Once we exit, the sandbox init exits too and the idle children go down with the namespace
+    return 0;
+}
+
+static int run_payload(int (*payload)(void *), void *arg, int disable_cgroups,
+                       const char *memory_max, int pids_max, int netns_pool) {
+    struct Config config;
+    struct CgroupLimits limits;
+    default_config(&config, &limits);
+
+    config.disable_cgroups = disable_cgroups;
+    config.netns_pool = netns_pool;
+    config.payload = payload;
+    config.payload_arg = arg;
+
+    if (memory_max) {
+        limits.memory_max = (char *)memory_max;
+    }
+
+    if (pids_max > 0) {
+        limits.pids_max = pids_max;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t self = getpid();
+    int status = setup_sandbox(&config, &limits);
+
+    // setup_sandbox() also returns in the forked namespace child; never let it run the rest of the benchmark
+    if (getpid() != self) {
+        _exit(status & 0xff);
+    }
+
+    return status;
+}
+
+static void print_metric(FILE *out, const char *name, double host, double sandbox,
+                         int higher_is_better, const char *indent, int last) {
+    double overhead = 0;
+
+    if (host > 0 && sandbox > 0) {
+        overhead = higher_is_better ? (host / sandbox - 1) * 100 : (sandbox / host - 1) * 100;
+    }
+
+    fprintf(out, "%s\"%s\": { \"host\": %.3f, \"sandbox\": %.3f, \"overhead_pct\": %.2f }%s\n",
+            indent, name, host, sandbox, overhead, last ? "" : ",");
+}
+
+static int overhead_main(int argc, char **argv) {
+    int iterations = DEFAULT_SYSCALL_ITERATIONS;
+    int disable_cgroups = 0;
+    const char *output = NULL;
+
+    static struct option long_opts[] = {
+        {"iterations",      required_argument, 0, 1},
+        {"disable-cgroups", no_argument,       0, 2},
+        {"output",          required_argument, 0, 3},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 1:
+                iterations = atoi(optarg);
+                if (iterations <= 0) {
+                    fprintf(stderr, "Invalid value for --iterations: '%s'. Must be a positive number.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 2:
+                disable_cgroups = 1;
+                break;
+
+            case 3:
+                output = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: runbox bench overhead [--iterations=N] [--disable-cgroups] [--output=<file>]\n");
+                return -1;
+        }
+    }
+
+    struct BenchShared *shared = mmap(NULL, sizeof(*shared), PROT_READ | PROT_WRITE,
+                                      MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (shared == MAP_FAILED) {
+        perror("mmap");
+        return -1;
+    }
+
+    memset(shared, 0, sizeof(*shared));
+    shared->iterations = iterations;
+    shared->fork_iterations = DEFAULT_FORK_ITERATIONS;
+
+    struct OverheadResults host;
+    run_overhead_suite(&host, iterations, DEFAULT_FORK_ITERATIONS);
+
+    int status = run_payload(overhead_payload, shared, disable_cgroups, NULL, 0, 0);
+    if (status != 0) {
+        fprintf(stderr, "sandboxed benchmark run failed with status %d\n", status);
+        munmap(shared, sizeof(*shared));
+        return -1;
+    }
+
+    unsigned long long memory_limit;
+    parse_memory_bytes(MEMORY_PROBE_LIMIT, &memory_limit);
+
+    int memory_status = -1;
+    int pids_status = -1;
+
+    if (!disable_cgroups) {
+        memory_status = run_payload(memory_probe_payload, shared, 0, MEMORY_PROBE_LIMIT, 0, 0);
+        pids_status = run_payload(pids_probe_payload, shared, 0, NULL, PIDS_PROBE_LIMIT, 0);
+    }
+
+    FILE *out = stdout;
+    if (output) {
+        out = fopen(output, "w");
+        if (!out) {
+            printf("Error opening %s: %s\n", output, strerror(errno));
+            munmap(shared, sizeof(*shared));
+            return -1;
+        }
+    }
+
+    struct utsname uts;
+    uname(&uts);
+
+    struct OverheadResults *sb = &shared->sandbox;
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"kernel\": \"%s\",\n", uts.release);
+    fprintf(out, "  \"machine\": \"%s\",\n", uts.machine);
+    fprintf(out, "  \"iterations\": %d,\n", iterations);
+    fprintf(out, "  \"syscall\": {\n");
+    print_metric(out, "getpid_ns", host.getpid_ns, sb->getpid_ns, 0, "    ", 0);
+    print_metric(out, "read_ns", host.read_ns, sb->read_ns, 0, "    ", 1);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"process\": {\n");
+    print_metric(out, "fork_exec_per_sec", host.fork_exec_per_sec, sb->fork_exec_per_sec, 1, "    ", 1);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"file_io\": {\n");
+    print_metric(out, "tmpfs_write_mbps", host.tmpfs_write_mbps, sb->tmpfs_write_mbps, 1, "    ", 0);
+    print_metric(out, "tmpfs_read_mbps", host.tmpfs_read_mbps, sb->tmpfs_read_mbps, 1, "    ", 0);
+    print_metric(out, "bind_read_mbps", host.bind_read_mbps, sb->bind_read_mbps, 1, "    ", 1);
+    fprintf(out, "  },\n");
+    fprintf(out, "  \"enforcement\": {\n");
+
+    if (disable_cgroups) {
+        fprintf(out, "    \"skipped\": \"cgroups disabled\"\n");
+    } else {
+        fprintf(out, "    \"memory_max\": { \"limit_bytes\": %llu, \"touched_bytes\": %llu, "
+                     "\"accuracy_pct\": %.2f, \"oom_killed\": %s },\n",
+                memory_limit, shared->memory_touched,
+                (double)shared->memory_touched / memory_limit * 100,
+                memory_status == 128 + SIGKILL ? "true" : "false");
+
+        // The sandbox init and the probe itself are counted against pids.max too
+        fprintf(out, "    \"pids_max\": { \"limit\": %d, \"forks_ok\": %d, \"expected\": %d, "
+                     "\"fork_error\": \"%s\", \"exact\": %s }\n",
+                PIDS_PROBE_LIMIT, shared->forks_ok, PIDS_PROBE_LIMIT - 2,
+                shared->fork_errno ? strerror(shared->fork_errno) : "none",
+                pids_status == 0 && shared->forks_ok == PIDS_PROBE_LIMIT - 2 ? "true" : "false");
+    }
+
+    fprintf(out, "  }\n");
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    munmap(shared, sizeof(*shared));
+    return 0;
+}
+
+// Pipes shared by every idle sandbox of a scale step
+struct ScalePipes {
+    int ready[2]; // Each sandbox writes one byte once its workload runs
+    int hold[2];  // Closing the write end releases all sandboxes at once
+};
+
+// Host-wide kernel counters sampled at every step, in KiB where they are sizes
+struct ScaleSample {
+    long long slab_kib;
+    long long percpu_kib;
+    long long kernel_stack_kib;
+    long long page_tables_kib;
+    long long mount_namespaces;
+    long long cgroups;
+    long long dying_cgroups;
+};
+
+static int idle_payload(void *arg) {
+    struct ScalePipes *pipes = arg;
+    char c;
+
+    if (write(pipes->ready[1], "1", 1) != 1) {
+        return 1;
+    }
+
+    while (read(pipes->hold[0], &c, 1) == -1 && errno == EINTR) {
+    }
+
+    return 0;
+}
+
+static long long read_meminfo_kib(const char *buffer, const char *key) {
+    const char *p = strstr(buffer, key);
+    return p ? strtoll(p + strlen(key), NULL, 10) : -1;
+}
+
+static long long read_kib_field(const char *path, const char *key) {
+    char buffer[8192];
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, f);
+    buffer[n] = '\0';
+    fclose(f);
+
+    return read_meminfo_kib(buffer, key);
+}
+
+static int compare_double(const void *a, const void *b) {
+    double x = *(const double *)a, y = *(const double *)b;
+    return x < y ? -1 : x > y;
+}
+
+static int compare_ull(const void *a, const void *b) {
+    unsigned long long x = *(const unsigned long long *)a, y = *(const unsigned long long *)b;
+    return x < y ? -1 : x > y;
+}
+
+// Distinct mount namespaces on the host, counted through the /proc/<pid>/ns/mnt inodes
+static long long count_mount_namespaces(void) {
+    DIR *dir = opendir("/proc");
+    if (!dir) {
+        return -1;
+    }
+
+    size_t count = 0, capacity = 1024;
+    unsigned long long *inodes = malloc(capacity * sizeof(*inodes));
+    struct dirent *entry;
+    char path[64];
+    struct stat st;
+
+    while (inodes && (entry = readdir(dir)) != NULL) {
+        if (entry->d_name[0] < '0' || entry->d_name[0] > '9') continue;
+
+        snprintf(path, sizeof(path), "/proc/%.20s/ns/mnt", entry->d_name);
+        if (stat(path, &st) == -1) continue;
+
+        if (count == capacity) {
+            capacity *= 2;
+            unsigned long long *grown = realloc(inodes, capacity * sizeof(*inodes));
+            if (!grown) break;
+            inodes = grown;
+        }
+
+        inodes[count++] = st.st_ino;
+    }
+
+    closedir(dir);
+
+    if (!inodes) {
+        return -1;
+    }
+
+    qsort(inodes, count, sizeof(*inodes), compare_ull);
+
+    long long unique = 0;
+    for (size_t i = 0; i < count; i++) {
+        if (i == 0 || inodes[i] != inodes[i - 1]) unique++;
+    }
+
+    free(inodes);
+    return unique;
+}
+
+static long long read_cgroup_stat(const char *key) {
+    char buffer[256];
+
+    FILE *f = fopen("/sys/fs/cgroup/cgroup.stat", "r");
+    if (!f) {
+        return -1;
+    }
+
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, f);
+    buffer[n] = '\0';
+    fclose(f);
+
+    return read_stat_field(buffer, key);
+}
+
+static void sample_kernel(struct ScaleSample *sample) {
+    sample->slab_kib = read_kib_field("/proc/meminfo", "Slab:");
+    sample->percpu_kib = read_kib_field("/proc/meminfo", "Percpu:");
+    sample->kernel_stack_kib = read_kib_field("/proc/meminfo", "KernelStack:");
+    sample->page_tables_kib = read_kib_field("/proc/meminfo", "PageTables:");
+    sample->mount_namespaces = count_mount_namespaces();
+    sample->cgroups = read_cgroup_stat("nr_descendants");
+    sample->dying_cgroups = read_cgroup_stat("nr_dying_descendants");
+}
+
+static long long delta(long long after, long long before) {
+    return after >= 0 && before >= 0 ? after - before : -1;
+}
+
+// Forks a launcher for one idle sandbox and waits until its workload is running
+static pid_t launch_idle_sandbox(struct ScalePipes *pipes, int disable_cgroups, int netns_pool, double *latency_ms) {
+    double started = now_ns();
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        // Only the benchmark may keep the hold pipe open, or the sandboxes would never see EOF
+        close(pipes->hold[1]);
+        close(pipes->ready[0]);
+
+        // Thousands of launchers would otherwise interleave their setup messages with the CSV
+        int devnull = open("/dev/null", O_WRONLY);
+        if (devnull != -1) {
+            dup2(devnull, STDOUT_FILENO);
+            close(devnull);
+        }
+
+        _exit(run_payload(idle_payload, pipes, disable_cgroups, NULL, 0, netns_pool) & 0xff);
+    } else if (pid < 0) {
+        perror("fork failed");
+        return -1;
+    }
+
+    struct pollfd pfd = { .fd = pipes->ready[0], .events = POLLIN };
+    char c;
+
+    for (int waited = 0; waited < SCALE_LAUNCH_TIMEOUT_MS; waited += 100) {
+        if (poll(&pfd, 1, 100) == 1 && read(pipes->ready[0], &c, 1) == 1) {
+            *latency_ms = (now_ns() - started) / 1e6;
+            return pid;
+        }
+
+        // Launch failed before the workload came up
+        if (waitpid(pid, NULL, WNOHANG) == pid) {
+            return -1;
+        }
+    }
+
+    kill(pid, SIGKILL);
+    waitpid(pid, NULL, 0);
+    return -1;
+}
+
+static long long sum_rss_kib(const pid_t *pids, int count) {
+    char path[64];
+    long long total = 0;
+
+    for (int i = 0; i < count; i++) {
+        snprintf(path, sizeof(path), "/proc/%d/status", (int)pids[i]);
+
+        long long rss = read_kib_field(path, "VmRSS:");
+        if (rss > 0) total += rss;
+    }
+
+    return total;
+}
+
+// Releases every sandbox of the step and reaps their launchers
+static double tear_down(struct ScalePipes *pipes, const pid_t *pids, int count) {
+    double started = now_ns();
+
+    close(pipes->hold[1]);
+
+    for (int i = 0; i < count; i++) {
+        waitpid(pids[i], NULL, 0);
+    }
+
+    close(pipes->hold[0]);
+    close(pipes->ready[0]);
+    close(pipes->ready[1]);
+
+    return (now_ns() - started) / 1e6;
+}
+
+static int parse_steps(const char *arg, int *steps, int *count) {
+    char copy[256];
+    char *saveptr;
+
+    snprintf(copy, sizeof(copy), "%s", arg);
+    *count = 0;
+
+    for (char *tok = strtok_r(copy, ",", &saveptr); tok; tok = strtok_r(NULL, ",", &saveptr)) {
+        char *end;
+        long val = strtol(tok, &end, 10);
+
+        if (*end != '\0' || val <= 0 || val > 1000000 || *count == MAX_SCALE_STEPS) {
+            return -1;
+        }
+
+        steps[(*count)++] = (int)val;
+    }
+
+    return *count > 0 ? 0 : -1;
+}
+
+/*
+ * Brings up N idle sandboxes for every step, one after another, samples what they cost
+ * the host while they all run, then releases them together. Each step starts from an
+ * empty host, so every CSV row is independent of the steps before it.
+ */
+static int scale_main(int argc, char **argv) {
+    int steps[MAX_SCALE_STEPS];
+    int step_count;
+    int disable_cgroups = 0;
+    const char *output = NULL;
+
+    parse_steps(DEFAULT_SCALE_STEPS, steps, &step_count);
+
+    static struct option long_opts[] = {
+        {"steps",           required_argument, 0, 1},
+        {"disable-cgroups", no_argument,       0, 2},
+        {"output",          required_argument, 0, 3},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 1:
+                if (parse_steps(optarg, steps, &step_count) != 0) {
+                    fprintf(stderr, "Invalid value for --steps: '%s'. Expected counts like 100,1000,5000.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 2:
+                disable_cgroups = 1;
+                break;
+
+            case 3:
+                output = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: runbox bench scale [--steps=N,N,...] [--disable-cgroups] [--output=<file>]\n");
+                return -1;
+        }
+    }
+
+    FILE *out = stdout;
+    if (output) {
+        out = fopen(output, "w");
+        if (!out) {
+            printf("Error opening %s: %s\n", output, strerror(errno));
+            return -1;
+        }
+    }
+
+    fprintf(out, "sandboxes,launch_p50_ms,launch_p99_ms,launch_max_ms,supervisor_rss_kib,"
+                 "slab_kib,percpu_kib,kernel_stack_kib,page_tables_kib,"
+                 "mount_namespaces,cgroups,dying_cgroups,teardown_ms\n");
+    fflush(out);
+
+    int ret = 0;
+
+    for (int s = 0; s < step_count && ret == 0; s++) {
+        int target = steps[s];
+        pid_t *pids = malloc(target * sizeof(*pids));
+        double *latencies = malloc(target * sizeof(*latencies));
+        struct ScalePipes pipes;
+        struct ScaleSample before, after;
+        int launched = 0;
+
+        if (!pids || !latencies || pipe2(pipes.ready, O_CLOEXEC) == -1) {
+            printf("failed setting up step %d: %s\n", target, strerror(errno));
+            free(pids);
+            free(latencies);
+            ret = -1;
+            break;
+        }
+
+        if (pipe2(pipes.hold, O_CLOEXEC) == -1) {
+            printf("failed setting up step %d: %s\n", target, strerror(errno));
+            close(pipes.ready[0]);
+            close(pipes.ready[1]);
+            free(pids);
+            free(latencies);
+            ret = -1;
+            break;
+        }
+
+        sample_kernel(&before);
+
+        while (launched < target) {
+            pids[launched] = launch_idle_sandbox(&pipes, disable_cgroups, 0, &latencies[launched]);
+            if (pids[launched] == -1) {
+                fprintf(stderr, "runbox: sandbox %d of step %d failed to come up, stopping\n", launched + 1, target);
+                ret = -1;
+                break;
+            }
+            launched++;
+
+            if (launched % 100 == 0) {
+                fprintf(stderr, "runbox: %d/%d sandboxes up\n", launched, target);
+            }
+        }
+
+        sample_kernel(&after);
+        long long rss = sum_rss_kib(pids, launched);
+        double teardown_ms = tear_down(&pipes, pids, launched);
+
+        if (launched > 0) {
+            qsort(latencies, launched, sizeof(*latencies), compare_double);
+
+            fprintf(out, "%d,%.3f,%.3f,%.3f,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%lld,%.3f\n",
+                    launched, latencies[launched / 2], latencies[(launched * 99) / 100],
+                    latencies[launched - 1], rss / launched,
+                    delta(after.slab_kib, before.slab_kib), delta(after.percpu_kib, before.percpu_kib),
+                    delta(after.kernel_stack_kib, before.kernel_stack_kib),
+                    delta(after.page_tables_kib, before.page_tables_kib),
+                    after.mount_namespaces, after.cgroups, after.dying_cgroups, teardown_ms);
+            fflush(out);
+        }
+
+        free(pids);
+        free(latencies);
+    }
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    return ret;
+}
+
+// Times the network namespace step of a sandbox init, fresh or taken from the pool, in a child
+static double time_netns_step(int pooled) {
+    int fds[2];
+    double elapsed = -1;
+
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        return -1;
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        close(fds[0]);
+
+        double started = now_ns();
+        int ret;
+
+        if (pooled) {
+            int fd = netns_pool_take();
+            ret = fd == -1 ? -1 : setns(fd, CLONE_NEWNET);
+        } else {
+            ret = unshare(CLONE_NEWNET);
+        }
+
+        elapsed = ret == 0 ? (now_ns() - started) / 1e3 : -1;
+        _exit(write(fds[1], &elapsed, sizeof(elapsed)) == sizeof(elapsed) ? 0 : 1);
+    } else if (pid < 0) {
+        perror("fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        return -1;
+    }
+
+    close(fds[1]);
+    if (read(fds[0], &elapsed, sizeof(elapsed)) != sizeof(elapsed)) {
+        elapsed = -1;
+    }
+    close(fds[0]);
+    waitpid(pid, NULL, 0);
+
+    return elapsed;
+}
+
+// Brings up one idle sandbox, releases it and waits for its launcher, which refills the pool
+static double time_launch(int disable_cgroups, int pooled) {
+    struct ScalePipes pipes;
+    double latency_ms;
+
+    if (pipe2(pipes.ready, O_CLOEXEC) == -1) {
+        return -1;
+    }
+
+    if (pipe2(pipes.hold, O_CLOEXEC) == -1) {
+        close(pipes.ready[0]);
+        close(pipes.ready[1]);
+        return -1;
+    }
+
+    pid_t pid = launch_idle_sandbox(&pipes, disable_cgroups, pooled, &latency_ms);
+    tear_down(&pipes, &pid, pid == -1 ? 0 : 1);
+
+    return pid == -1 ? -1 : latency_ms;
+}
+
+static void print_startup_metric(FILE *out, const char *name, double *unshared, double *pooled,
+                                 int count, int percentile, int last) {
+    double fresh = unshared[(count * percentile) / 100];
+    double taken = pooled[(count * percentile) / 100];
+
+    fprintf(out, "  \"%s\": { \"unshare\": %.3f, \"pool\": %.3f, \"saved_pct\": %.2f }%s\n",
+            name, fresh, taken, fresh > 0 ? (1 - taken / fresh) * 100 : 0, last ? "" : ",");
+}
+
+/*
+ * Compares sandboxes that create their network namespace with ones that join a pooled
+ * one. The bare namespace step and the launch up to the workload running are timed
+ * alternately, so both modes see the same host and the same backlog of namespace teardown.
+ */
+static int startup_main(int argc, char **argv) {
+    int iterations = DEFAULT_STARTUP_ITERATIONS;
+    int disable_cgroups = 0;
+    const char *output = NULL;
+
+    static struct option long_opts[] = {
+        {"iterations",      required_argument, 0, 1},
+        {"disable-cgroups", no_argument,       0, 2},
+        {"output",          required_argument, 0, 3},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 1:
+                iterations = atoi(optarg);
+                if (iterations <= 0 || iterations > NETNS_POOL_MAX) {
+                    fprintf(stderr, "Invalid value for --iterations: '%s'. Must be between 1 and %d.\n",
+                            optarg, NETNS_POOL_MAX);
+                    return -1;
+                }
+                break;
+
+            case 2:
+                disable_cgroups = 1;
+                break;
+
+            case 3:
+                output = optarg;
+                break;
+
+            default:
+                fprintf(stderr, "Usage: runbox bench startup [--iterations=N] [--disable-cgroups] [--output=<file>]\n");
+                return -1;
+        }
+    }
+
+    double *samples = malloc(4 * iterations * sizeof(*samples));
+    if (!samples) {
+        perror("malloc");
+        return -1;
+    }
+
+    double *netns_unshared = samples, *netns_pooled = samples + iterations;
+    double *launch_unshared = samples + 2 * iterations, *launch_pooled = samples + 3 * iterations;
+    int ret = 0;
+
+    // The bare step consumes a namespace per sample without replacing it
+    if (netns_pool_add(iterations) != 0) {
+        fprintf(stderr, "runbox: failed filling the netns pool\n");
+        free(samples);
+        return -1;
+    }
+
+    for (int i = 0; i < iterations && ret == 0; i++) {
+        netns_unshared[i] = time_netns_step(0);
+        netns_pooled[i] = time_netns_step(1);
+
+        if (netns_unshared[i] < 0 || netns_pooled[i] < 0) {
+            fprintf(stderr, "runbox: namespace step %d failed\n", i + 1);
+            ret = -1;
+        }
+    }
+
+    // Every pooled launcher replaces the namespace it took, so one spare lasts the whole run
+    if (ret == 0 && netns_pool_add(1) != 0) {
+        fprintf(stderr, "runbox: failed filling the netns pool\n");
+        ret = -1;
+    }
+
+    for (int i = 0; i < iterations && ret == 0; i++) {
+        launch_unshared[i] = time_launch(disable_cgroups, 0);
+        launch_pooled[i] = time_launch(disable_cgroups, 1);
+
+        if (launch_unshared[i] < 0 || launch_pooled[i] < 0) {
+            fprintf(stderr, "runbox: sandbox %d failed to come up\n", i + 1);
+            ret = -1;
+        }
+    }
+
+    // Leave the pool as we found it
+    int spare = netns_pool_take();
+    if (spare != -1) {
+        close(spare);
+    }
+
+    if (ret != 0) {
+        free(samples);
+        return -1;
+    }
+
+    for (int i = 0; i < 4; i++) {
+        qsort(samples + i * iterations, iterations, sizeof(*samples), compare_double);
+    }
+
+    FILE *out = stdout;
+    if (output) {
+        out = fopen(output, "w");
+        if (!out) {
+            printf("Error opening %s: %s\n", output, strerror(errno));
+            free(samples);
+            return -1;
+        }
+    }
+
+    fprintf(out, "{\n");
+    fprintf(out, "  \"iterations\": %d,\n", iterations);
+    print_startup_metric(out, "netns_p50_us", netns_unshared, netns_pooled, iterations, 50, 0);
+    print_startup_metric(out, "netns_p99_us", netns_unshared, netns_pooled, iterations, 99, 0);
+    print_startup_metric(out, "launch_p50_ms", launch_unshared, launch_pooled, iterations, 50, 0);
+    print_startup_metric(out, "launch_p99_ms", launch_unshared, launch_pooled, iterations, 99, 1);
+    fprintf(out, "}\n");
+
+    if (out != stdout) {
+        fclose(out);
+    }
+
+    free(samples);
+    return 0;
+}
+
+int bench_main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "overhead") == 0) {
+        return overhead_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "scale") == 0) {
+        return scale_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "startup") == 0) {
+        return startup_main(argc - 1, argv + 1);
+    }
+
+    fprintf(stderr, "Usage: runbox bench overhead|scale|startup [options]\n");
+    return -1;
+}
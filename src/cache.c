@@ -0,0 +1,760 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <ftw.h>
+#include <limits.h>
+#include <poll.h>
+#include <pthread.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "image.h"
+#include "minroot.h"
+#include "runbox.h"
+#include "cache.h"
+
+extern char **environ;
+
+static void hash_bytes(struct Sha256 *h, const char *tag, const void *data, uint64_t len) {
+    sha256_update(h, tag, strlen(tag) + 1);
+    sha256_update(h, &len, sizeof(len));
+    sha256_update(h, data, len);
+}
+
+static void hash_str(struct Sha256 *h, const char *tag, const char *s) {
+    hash_bytes(h, tag, s ? s : "", s ? strlen(s) : 0);
+}
+
+static void hash_u64(struct Sha256 *h, const char *tag, uint64_t value) {
+    hash_bytes(h, tag, &value, sizeof(value));
+}
+
+static void hash_double(struct Sha256 *h, const char *tag, double value) {
+    char buf[64];
+    snprintf(buf, sizeof(buf), "%.9g", value);
+    hash_str(h, tag, buf);
+}
+
+// Cheap identity of a host file or directory: replaced or modified files change it
+static void hash_identity(struct Sha256 *h, const char *tag, const char *path) {
+    struct stat st;
+
+    hash_str(h, tag, path);
+
+    if (stat(path, &st) == -1) {
+        hash_u64(h, "missing", 1);
+        return;
+    }
+
+    hash_u64(h, "dev", st.st_dev);
+    hash_u64(h, "ino", st.st_ino);
+    hash_u64(h, "size", st.st_size);
+    hash_u64(h, "mtime", st.st_mtim.tv_sec);
+    hash_u64(h, "mtime_ns", st.st_mtim.tv_nsec);
+}
+
+static int hash_file_content(struct Sha256 *h, int dir_fd, const char *name) {
+    char buf[65536];
+    ssize_t n;
+
+    int fd = openat(dir_fd, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        printf("failed opening cache input %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    while ((n = read(fd, buf, sizeof(buf))) != 0) {
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            printf("failed reading cache input %s: %s\n", name, strerror(errno));
+            close(fd);
+            return -1;
+        }
+        sha256_update(h, buf, n);
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Hashes a declared input by content: files byte for byte, directories recursively in name order
+static int hash_input(struct Sha256 *h, int dir_fd, const char *name) {
+    struct stat st;
+
+    if (fstatat(dir_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        printf("failed accessing cache input %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    hash_str(h, "name", name);
+    hash_u64(h, "mode", st.st_mode);
+
+    if (S_ISREG(st.st_mode)) {
+        return hash_file_content(h, dir_fd, name);
+    }
+
+    if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t n = readlinkat(dir_fd, name, target, sizeof(target) - 1);
+        if (n == -1) {
+            printf("failed reading cache input %s: %s\n", name, strerror(errno));
+            return -1;
+        }
+        hash_bytes(h, "target", target, n);
+        return 0;
+    }
+
+    if (!S_ISDIR(st.st_mode)) {
+        return 0;
+    }
+
+    int fd = openat(dir_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+    if (!dir) {
+        printf("failed reading cache input %s: %s\n", name, strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    char **names = NULL;
+    size_t count = 0, capacity = 0;
+    struct dirent *de;
+    int ret = 0;
+
+    while ((de = readdir(dir))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            char **grown = realloc(names, capacity * sizeof(*names));
+            if (!grown) {
+                ret = -1;
+                break;
+            }
+            names = grown;
+        }
+
+        if (!(names[count] = strdup(de->d_name))) {
+            ret = -1;
+            break;
+        }
+        count++;
+    }
+
+    if (ret == 0) {
+        qsort(names, count, sizeof(*names), compare_names);
+        hash_u64(h, "entries", count);
+
+        for (size_t i = 0; i < count && ret == 0; i++) {
+            ret = hash_input(h, dirfd(dir), names[i]);
+        }
+    } else {
+        printf("failed reading cache input %s: out of memory\n", name);
+    }
+
+    for (size_t i = 0; i < count; i++) {
+        free(names[i]);
+    }
+    free(names);
+    closedir(dir);
+    return ret;
+}
+
+static void hash_environment(struct Sha256 *h) {
+    size_t count = 0;
+
+    while (environ[count]) count++;
+
+    char **sorted = malloc((count ? count : 1) * sizeof(*sorted));
+    if (!sorted) {
+        // Unsortable; still deterministic for an identical environment
+        for (size_t i = 0; i < count; i++) hash_str(h, "env", environ[i]);
+        return;
+    }
+
+    memcpy(sorted, environ, count * sizeof(*sorted));
+    qsort(sorted, count, sizeof(*sorted), compare_names);
+
+    for (size_t i = 0; i < count; i++) {
+        hash_str(h, "env", sorted[i]);
+    }
+
+    free(sorted);
+}
+
+static void hash_manifest(struct Sha256 *h, const struct Manifest *manifest) {
+    for (int i = 0; i < manifest->count; i++) {
+        if (manifest->entries[i].type == MANIFEST_SYMLINK) {
+            hash_str(h, "link", manifest->entries[i].path);
+            hash_str(h, "target", manifest->entries[i].target);
+        } else {
+            hash_identity(h, "file", manifest->entries[i].path);
+        }
+    }
+}
+
+static int hash_rootfs(struct Sha256 *h, const struct Config *config, const struct Manifest *manifest) {
+    char lowerdir[IMAGE_LOWERDIR_MAX];
+
+    // Image layers are named by the hash of their content
+    if (config->image) {
+        if (image_lowerdir(config->image, lowerdir, sizeof(lowerdir)) != 0) {
+            return -1;
+        }
+        hash_str(h, "image", lowerdir);
+        return 0;
+    }
+
+    if (manifest) {
+        hash_manifest(h, manifest);
+        return 0;
+    }
+
+    // A base sits under the host directories: its layers and the host closure below both count
+    if (config->base) {
+        if (image_lowerdir(config->base, lowerdir, sizeof(lowerdir)) != 0) {
+            return -1;
+        }
+        hash_str(h, "base", lowerdir);
+    }
+
+    // The host root has no content hash. The command's ELF closure (binary, interpreter and
+    // libraries) stands in for it; upgrading any of them replaces the file and changes its
+    // identity. Files the job opens at run time are not covered
+    struct Manifest closure;
+    if (load_manifest(config->command, &closure) != 0) {
+        return -1;
+    }
+
+    hash_manifest(h, &closure);
+    free_manifest(&closure);
+    return 0;
+}
+
+/*
+ * The key covers everything that can change what the workload does: command, environment,
+ * limits and sandbox options, the content of the declared inputs and the rootfs identity.
+ * Volume contents are not hashed; declare anything the job reads from them with --input.
+ */
+static int compute_key(const struct Config *config, const struct CgroupLimits *limits,
+                       const struct Manifest *manifest, char key[SHA256_HEX_SIZE]) {
+    struct Sha256 h;
+
+    sha256_init(&h);
+    hash_str(&h, "version", "runbox-result-cache-1");
+
+    for (char **arg = config->command; *arg; arg++) {
+        hash_str(&h, "arg", *arg);
+    }
+
+    hash_environment(&h);
+
+    hash_u64(&h, "memory_enabled", limits->memory_enabled);
+    hash_str(&h, "memory_max", limits->memory_max);
+    hash_u64(&h, "cpu_enabled", limits->cpu_enabled);
+    hash_double(&h, "cpus", limits->cpus);
+    hash_u64(&h, "pids_enabled", limits->pids_enabled);
+    hash_u64(&h, "pids_max", (uint64_t)limits->pids_max);
+
+    hash_u64(&h, "network", config->enable_network);
+    hash_u64(&h, "cgroups", !config->disable_cgroups);
+    hash_double(&h, "timeout", config->timeout);
+    hash_double(&h, "cpu_time", config->cpu_time);
+    hash_u64(&h, "no_init", config->no_init);
+
+    for (int i = 0; i < config->volume_count; i++) {
+        hash_str(&h, "volume_host", config->volumes[i].host_path);
+        hash_str(&h, "volume_sandbox", config->volumes[i].sandbox_path);
+        hash_u64(&h, "volume_ro", config->volumes[i].read_only);
+    }
+
+    for (int i = 0; i < config->shared_count; i++) {
+        hash_str(&h, "shared", config->shared[i].name);
+        hash_identity(&h, "shared_source", config->shared[i].source);
+    }
+
+    // Only what is exported matters, not where the host wants it
+    for (int i = 0; i < config->export_count; i++) {
+        hash_str(&h, "export", config->exports[i].sandbox_path);
+    }
+
+    for (int i = 0; i < config->input_count; i++) {
+        hash_str(&h, "input", config->inputs[i]);
+        if (hash_input(&h, AT_FDCWD, config->inputs[i]) != 0) {
+            return -1;
+        }
+    }
+
+    if (hash_rootfs(&h, config, manifest) != 0) {
+        return -1;
+    }
+
+    sha256_final_hex(&h, key);
+    return 0;
+}
+
+static int write_all(int fd, const void *buf, size_t len) {
+    const char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = write(fd, p, len);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int read_all(int fd, void *buf, size_t len) {
+    char *p = buf;
+
+    while (len > 0) {
+        ssize_t n = read(fd, p, len);
+        if (n == -1 && errno == EINTR) continue;
+        if (n <= 0) return -1;
+        p += n;
+        len -= n;
+    }
+
+    return 0;
+}
+
+static int lock_cache(int operation) {
+    if ((mkdir("/var/cache/runbox", 0755) == -1 && errno != EEXIST) ||
+        (mkdir(RESULT_CACHE_DIR, 0755) == -1 && errno != EEXIST)) {
+        printf("failed creating %s: %s\n", RESULT_CACHE_DIR, strerror(errno));
+        return -1;
+    }
+
+    int fd = open(RESULT_CACHE_DIR "/.lock", O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        printf("Error opening %s: %s\n", RESULT_CACHE_DIR "/.lock", strerror(errno));
+        return -1;
+    }
+
+    while (flock(fd, operation) == -1) {
+        if (errno != EINTR) {
+            printf("failed locking the result cache: %s\n", strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+// The last path component of an export, which is what lands in its host directory
+static void export_basename(const char *sandbox_path, char *name, size_t size) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s", sandbox_path);
+
+    size_t len = strlen(path);
+    while (len > 1 && path[len - 1] == '/') path[--len] = '\0';
+
+    snprintf(name, size, "%s", strrchr(path, '/') + 1);
+}
+
+static int replay_output(const char *entry) {
+    char path[PATH_MAX];
+    char buf[65536];
+
+    snprintf(path, sizeof(path), "%s/output", entry);
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    uint8_t stream;
+    uint32_t len;
+    int ret = 0;
+
+    while (read(fd, &stream, 1) == 1) {
+        if (read_all(fd, &len, sizeof(len)) != 0 || len > sizeof(buf) || read_all(fd, buf, len) != 0) {
+            ret = -1;
+            break;
+        }
+        write_all(stream == 2 ? STDERR_FILENO : STDOUT_FILENO, buf, len);
+    }
+
+    close(fd);
+    return ret;
+}
+
+static int replay_artifacts(const struct Config *config, const char *entry) {
+    char root[PATH_MAX];
+    char name[PATH_MAX];
+    char sandbox_path[PATH_MAX + 1];
+    struct stat st;
+    int ret = 0;
+
+    for (int i = 0; i < config->export_count; i++) {
+        export_basename(config->exports[i].sandbox_path, name, sizeof(name));
+        snprintf(root, sizeof(root), "%s/artifacts/%d", entry, i);
+        snprintf(sandbox_path, sizeof(sandbox_path), "/%s", name);
+
+        // Nothing was there to export on the original run either
+        if (fstatat(AT_FDCWD, root, &st, 0) == -1) {
+            continue;
+        }
+
+        struct ExportSpec spec = { .sandbox_path = sandbox_path, .host_dir = config->exports[i].host_dir };
+        if (copy_tree(root, &spec, 1) != 0) {
+            ret = -1;
+        }
+    }
+
+    return ret;
+}
+
+/*
+ * Returns 1 and the stored exit status if the result is cached, after replaying its output
+ * and artifacts; 0 on a miss, with the key left in `cache` for cache_begin().
+ */
+int cache_lookup(struct Config *config, struct CgroupLimits *limits, const struct Manifest *manifest,
+                 struct ResultCache *cache, int *status) {
+    char entry[PATH_MAX];
+    char meta[PATH_MAX + 8];
+
+    *cache = (struct ResultCache) { .output_fd = -1, .pipes = { { -1, -1 }, { -1, -1 } } };
+
+    if (compute_key(config, limits, manifest, cache->key) != 0) {
+        return -1;
+    }
+
+    snprintf(entry, sizeof(entry), RESULT_CACHE_DIR "/%s", cache->key);
+    snprintf(meta, sizeof(meta), "%s/meta", entry);
+
+    // Shared lock: eviction cannot remove the entry while we replay it
+    int lock_fd = lock_cache(LOCK_SH);
+    if (lock_fd == -1) {
+        return -1;
+    }
+
+    FILE *f = fopen(meta, "r");
+    if (!f) {
+        close(lock_fd);
+        return 0;
+    }
+
+    int found = fscanf(f, "status=%d", status) == 1;
+    fclose(f);
+
+    if (found && replay_output(entry) == 0) {
+        fflush(stdout);
+        replay_artifacts(config, entry);
+
+        // Recently used entries are evicted last
+        utimensat(AT_FDCWD, meta, NULL, 0);
+
+        if (config->report) {
+            fprintf(stderr, "runbox: replayed cached result %.12s (exit_status=%d)\n", cache->key, *status);
+        }
+    } else {
+        found = 0;
+    }
+
+    close(lock_fd);
+    return found;
+}
+
+// Tees the sandbox output to our own stdout/stderr and into the entry, keeping the order
+static void *relay_output(void *arg) {
+    struct ResultCache *cache = arg;
+    struct pollfd fds[2] = {
+        { .fd = cache->pipes[0][0], .events = POLLIN },
+        { .fd = cache->pipes[1][0], .events = POLLIN },
+    };
+    char buf[65536];
+    int open_count = 2;
+
+    while (open_count > 0) {
+        if (poll(fds, 2, -1) == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < 2; i++) {
+            if (fds[i].fd == -1 || !(fds[i].revents & (POLLIN | POLLHUP | POLLERR))) continue;
+
+            ssize_t n = read(fds[i].fd, buf, sizeof(buf));
+            if (n == -1 && errno == EINTR) continue;
+
+            if (n <= 0) {
+                fds[i].fd = -1;
+                open_count--;
+                continue;
+            }
+
+            uint8_t stream = i + 1;
+            uint32_t len = n;
+
+            write_all(i == 0 ? STDOUT_FILENO : STDERR_FILENO, buf, n);
+
+            if (write_all(cache->output_fd, &stream, 1) != 0 || write_all(cache->output_fd, &len, sizeof(len)) != 0 ||
+                write_all(cache->output_fd, buf, n) != 0) {
+                // Keep relaying; the entry is discarded when it is not complete
+                close(cache->output_fd);
+                cache->output_fd = -1;
+            }
+        }
+    }
+
+    return NULL;
+}
+
+static void close_pipes(struct ResultCache *cache) {
+    for (int i = 0; i < 2; i++) {
+        for (int j = 0; j < 2; j++) {
+            if (cache->pipes[i][j] != -1) {
+                close(cache->pipes[i][j]);
+                cache->pipes[i][j] = -1;
+            }
+        }
+    }
+}
+
+static int remove_entry(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)st;
+    (void)ftw;
+    return flag == FTW_DP ? rmdir(path) : unlink(path);
+}
+
+static void remove_tree(const char *path) {
+    nftw(path, remove_entry, 16, FTW_DEPTH | FTW_PHYS);
+}
+
+// Called on a miss: routes the sandbox output through the relay into a fresh staging entry
+int cache_begin(struct Config *config, struct ResultCache *cache) {
+    char path[PATH_MAX + 8];
+
+    cache->stdin_fd = -1;
+    snprintf(cache->staging, sizeof(cache->staging), RESULT_CACHE_DIR "/.staging-%d", getpid());
+    remove_tree(cache->staging);
+
+    if (mkdir(cache->staging, 0700) == -1) {
+        printf("failed creating %s: %s\n", cache->staging, strerror(errno));
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/output", cache->staging);
+    cache->output_fd = open(path, O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0600);
+
+    if (cache->output_fd == -1 || pipe2(cache->pipes[0], O_CLOEXEC) == -1 || pipe2(cache->pipes[1], O_CLOEXEC) == -1) {
+        printf("failed setting up output capture: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    // stdin is not part of the key, so a recorded result must not depend on it
+    cache->stdin_fd = open("/dev/null", O_RDONLY | O_CLOEXEC);
+    if (cache->stdin_fd == -1) {
+        printf("Error opening /dev/null: %s\n", strerror(errno));
+        goto fail;
+    }
+
+    if (pthread_create(&cache->relay, NULL, relay_output, cache) != 0) {
+        printf("failed starting the output relay\n");
+        goto fail;
+    }
+
+    cache->relaying = 1;
+    config->stdio_fds[STDIN_FILENO] = cache->stdin_fd;
+    config->stdio_fds[STDOUT_FILENO] = cache->pipes[0][1];
+    config->stdio_fds[STDERR_FILENO] = cache->pipes[1][1];
+    return 0;
+
+fail:
+    close_pipes(cache);
+    if (cache->output_fd != -1) close(cache->output_fd);
+    if (cache->stdin_fd != -1) close(cache->stdin_fd);
+    cache->output_fd = cache->stdin_fd = -1;
+    remove_tree(cache->staging);
+    return -1;
+}
+
+static unsigned long long tree_bytes;
+
+static int add_size(const char *path, const struct stat *st, int flag, struct FTW *ftw) {
+    (void)path;
+    (void)flag;
+    (void)ftw;
+    tree_bytes += st->st_blocks * 512ULL;
+    return 0;
+}
+
+static int store_artifacts(const struct Config *config, const char *staging) {
+    char dir[PATH_MAX];
+    char host_dir[PATH_MAX];
+    char name[PATH_MAX];
+    char source[2 * PATH_MAX + 2];
+    struct stat st;
+
+    for (int i = 0; i < config->export_count; i++) {
+        export_basename(config->exports[i].sandbox_path, name, sizeof(name));
+
+        if (!realpath(config->exports[i].host_dir, host_dir)) {
+            continue;
+        }
+
+        snprintf(source, sizeof(source), "%s/%s", host_dir, name);
+        if (lstat(source, &st) == -1) {
+            continue;
+        }
+
+        snprintf(dir, sizeof(dir), "%s/artifacts", staging);
+        if (mkdir(dir, 0700) == -1 && errno != EEXIST) {
+            return -1;
+        }
+
+        snprintf(dir, sizeof(dir), "%s/artifacts/%d", staging, i);
+        struct ExportSpec spec = { .sandbox_path = source, .host_dir = dir };
+
+        if (copy_tree("/", &spec, 1) != 0) {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+struct CacheEntry {
+    char name[SHA256_HEX_SIZE];
+    time_t used;
+    unsigned long long bytes;
+};
+
+static int compare_entries(const void *a, const void *b) {
+    const struct CacheEntry *x = a, *y = b;
+    return (x->used > y->used) - (x->used < y->used);
+}
+
+// Drops least recently used entries until the store fits in `limit` bytes
+static void evict(unsigned long long limit) {
+    char path[PATH_MAX];
+
+    DIR *dir = opendir(RESULT_CACHE_DIR);
+    if (!dir) {
+        return;
+    }
+
+    struct CacheEntry *entries = NULL;
+    size_t count = 0, capacity = 0;
+    unsigned long long total = 0;
+    struct dirent *de;
+
+    while ((de = readdir(dir))) {
+        if (de->d_name[0] == '.' || strlen(de->d_name) != SHA256_HEX_SIZE - 1) continue;
+
+        if (count == capacity) {
+            capacity = capacity ? capacity * 2 : 64;
+            struct CacheEntry *grown = realloc(entries, capacity * sizeof(*entries));
+            if (!grown) break;
+            entries = grown;
+        }
+
+        struct CacheEntry *entry = &entries[count];
+        struct stat st;
+        FILE *f;
+
+        snprintf(path, sizeof(path), RESULT_CACHE_DIR "/%s/meta", de->d_name);
+        if (stat(path, &st) == -1 || !(f = fopen(path, "r"))) continue;
+
+        int status;
+        int ok = fscanf(f, "status=%d bytes=%llu", &status, &entry->bytes) == 2;
+        fclose(f);
+        if (!ok) continue;
+
+        memcpy(entry->name, de->d_name, SHA256_HEX_SIZE);
+        entry->used = st.st_mtime;
+        total += entry->bytes;
+        count++;
+    }
+
+    closedir(dir);
+
+    if (entries) {
+        qsort(entries, count, sizeof(*entries), compare_entries);
+    }
+
+    for (size_t i = 0; i < count && total > limit; i++) {
+        snprintf(path, sizeof(path), RESULT_CACHE_DIR "/%s", entries[i].name);
+        remove_tree(path);
+        total -= entries[i].bytes;
+    }
+
+    free(entries);
+}
+
+/*
+ * Called after the sandbox exited on a miss: waits for the relay to drain the output and,
+ * if `store` is set, publishes the entry with the exit status and exported artifacts.
+ */
+void cache_finish(struct Config *config, struct ResultCache *cache, int status, int store) {
+    char path[PATH_MAX + 8];
+
+    // Every process that could write to the pipes is gone, so closing ours gives the relay EOF
+    for (int i = 0; i < 2; i++) {
+        close(cache->pipes[i][1]);
+        cache->pipes[i][1] = -1;
+    }
+    config->stdio_fds[STDOUT_FILENO] = config->stdio_fds[STDERR_FILENO] = -1;
+
+    if (cache->stdin_fd != -1) {
+        close(cache->stdin_fd);
+        cache->stdin_fd = -1;
+    }
+    config->stdio_fds[STDIN_FILENO] = -1;
+
+    if (cache->relaying) {
+        pthread_join(cache->relay, NULL);
+    }
+    close_pipes(cache);
+
+    if (cache->output_fd == -1) {
+        store = 0;
+    } else {
+        close(cache->output_fd);
+    }
+
+    if (store && store_artifacts(config, cache->staging) == 0) {
+        tree_bytes = 0;
+        nftw(cache->staging, add_size, 16, FTW_PHYS);
+
+        snprintf(path, sizeof(path), "%s/meta", cache->staging);
+        FILE *f = fopen(path, "w");
+
+        if (f) {
+            fprintf(f, "status=%d bytes=%llu\n", status, tree_bytes);
+
+            if (fclose(f) == 0) {
+                int lock_fd = lock_cache(LOCK_EX);
+
+                snprintf(path, sizeof(path), RESULT_CACHE_DIR "/%s", cache->key);
+                if (lock_fd != -1 && rename(cache->staging, path) == 0) {
+                    evict(config->cache_size);
+                }
+
+                if (lock_fd != -1) close(lock_fd);
+            }
+        }
+    }
+
+    // Still there if anything failed or an identical run published first
+    remove_tree(cache->staging);
+}
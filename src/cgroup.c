@@ -9,6 +9,7 @@
 #include <stddef.h>
 #include <fcntl.h>
 #include <ctype.h>
+#include <limits.h>
 
 int create_and_apply_limits(struct CgroupLimits *limits, pid_t child_pid);
 int validate_and_enable_host_controllers(struct CgroupLimits *limits);
@@ -17,9 +18,8 @@ int validate_cgroup_limits(struct CgroupLimits *limits);
 int validate_cpu_max(double cpu);
 int validate_memory_max(const char *mem);
 int validate_pids_max(int pids);
-int write_file(const char *path, const char *text);
-int read_file(const char *path, char *buffer, size_t size);
 int contains_controller(const char *enabled_controllers, const char *controller);
+static int create_group_cgroup(struct CgroupLimits *limits, const char *enable_buf);
 
 int setup_cgroup(struct CgroupLimits *limits, pid_t child_pid) {
     // Validate if the controllers needed by the sandbox are provided & enabled in the host cgroup
@@ -45,11 +45,35 @@ int setup_cgroup(struct CgroupLimits *limits, pid_t child_pid) {
     return 0;
 }
 
+static void format_cpu_max(double cpus, char *buffer, size_t size) {
+    if (cpus == 0) {
+        // Unlimited CPU
+        snprintf(buffer, size, "max");
+    } else {
+        int period = 100000;
+        double quota = (double)(cpus * period);
+
+        if (quota <= 0)
+            quota = 1;  // safety
+
+        snprintf(buffer, size, "%d %d", (int)quota, period);
+    }
+}
+
+static void format_pids_max(int pids, char *buffer, size_t size) {
+    if (pids == PIDS_MAX_ALIAS) {
+        snprintf(buffer, size, "max");
+    } else {
+        snprintf(buffer, size, "%d", pids);
+    }
+}
+
 int create_and_apply_limits(struct CgroupLimits *limits, pid_t child_pid) {
-    char path[256];
-    snprintf(path, sizeof(path), "/sys/fs/cgroup/runbox/%d", child_pid);
+    char cgroup[256];
+    char path[512];
+    sandbox_cgroup_path(limits, child_pid, cgroup, sizeof(cgroup));
 
-    if (mkdir(path, 0755) == -1) {
+    if (mkdir(cgroup, 0755) == -1) {
         if (errno != EEXIST) {
             printf("failed creating runbox cgroup limit for %d: %s\n", child_pid, strerror(errno));
             return -1;
@@ -58,22 +82,9 @@ int create_and_apply_limits(struct CgroupLimits *limits, pid_t child_pid) {
 
     if (limits->cpu_enabled) {
         char cpu_max[64];
+        format_cpu_max(limits->cpus, cpu_max, sizeof(cpu_max));
 
-        if (limits->cpus == 0) {
-            // Unlimited CPU
-            snprintf(cpu_max, sizeof(cpu_max), "max");
-        } else {
-            int period = 100000;
-            double quota = (double)(limits->cpus * period);
-
-            if (quota <= 0)
-                quota = 1;  // safety
-
-            snprintf(cpu_max, sizeof(cpu_max), "%d %d", (int)quota, period);
-        }
-
-        snprintf(path, sizeof(path),
-                "/sys/fs/cgroup/runbox/%d/cpu.max", child_pid);
+        snprintf(path, sizeof(path), "%s/cpu.max", cgroup);
 
         if (write_file(path, cpu_max) != 0) {
             printf("Failed to write cpu.max\n");
@@ -82,8 +93,7 @@ int create_and_apply_limits(struct CgroupLimits *limits, pid_t child_pid) {
     }
 
     if (limits->memory_enabled) {
-        snprintf(path, sizeof(path),
-                "/sys/fs/cgroup/runbox/%d/memory.max", child_pid);
+        snprintf(path, sizeof(path), "%s/memory.max", cgroup);
 
         if (write_file(path, limits->memory_max) != 0) {
             printf("Failed to write memory.max\n");
@@ -93,15 +103,9 @@ int create_and_apply_limits(struct CgroupLimits *limits, pid_t child_pid) {
 
     if (limits->pids_enabled) {
         char pids_val[32];
+        format_pids_max(limits->pids_max, pids_val, sizeof(pids_val));
 
-        if (limits->pids_max == PIDS_MAX_ALIAS) {
-            snprintf(pids_val, sizeof(pids_val), "max");
-        } else {
-            snprintf(pids_val, sizeof(pids_val), "%d", limits->pids_max);
-        }
-
-        snprintf(path, sizeof(path),
-                "/sys/fs/cgroup/runbox/%d/pids.max", child_pid);
+        snprintf(path, sizeof(path), "%s/pids.max", cgroup);
 
         if (write_file(path, pids_val) != 0) {
             printf("Failed to write pids.max\n");
@@ -109,9 +113,22 @@ int create_and_apply_limits(struct CgroupLimits *limits, pid_t child_pid) {
         }
     }
 
+    return attach_to_cgroup(cgroup, child_pid);
+}
+
+void sandbox_cgroup_path(const struct CgroupLimits *limits, pid_t child_pid, char *buffer, size_t size) {
+    if (limits->group) {
+        snprintf(buffer, size, "/sys/fs/cgroup/runbox/%s/%d", limits->group, (int)child_pid);
+    } else {
+        snprintf(buffer, size, "/sys/fs/cgroup/runbox/%d", (int)child_pid);
+    }
+}
+
+int attach_to_cgroup(const char *cgroup_dir, pid_t pid) {
+    char path[256];
     char pidbuf[32];
-    snprintf(path, sizeof(path), "/sys/fs/cgroup/runbox/%d/cgroup.procs", (int)child_pid);
-    snprintf(pidbuf, sizeof(pidbuf), "%d", (int)child_pid);
+    snprintf(path, sizeof(path), "%s/cgroup.procs", cgroup_dir);
+    snprintf(pidbuf, sizeof(pidbuf), "%d", (int)pid);
 
     int fd = open(path, O_WRONLY);
     if (fd == -1) {
@@ -210,13 +227,44 @@ int create_sandbox_cgroup_and_enable_controllers(struct CgroupLimits *limits) {
 
     // If nothing to enable, all good
     if (enable_buf[0] == '\0')
-        return 0;
+        return create_group_cgroup(limits, NULL);
 
     if (write_file("/sys/fs/cgroup/runbox/cgroup.subtree_control", enable_buf) != 0) {
         printf("Failed to enable controllers in runbox cgroup subtree_control\n");
         return -1;
     }
 
+    return create_group_cgroup(limits, enable_buf);
+}
+
+// The group (a tenant, a pod or a pod of a tenant) sits in between runbox/ and the sandbox,
+// and every level of it has to pass the controllers on too
+static int create_group_cgroup(struct CgroupLimits *limits, const char *enable_buf) {
+    if (!limits->group) {
+        return 0;
+    }
+
+    char path[256];
+    char control[300];
+    size_t len = strlen(limits->group);
+
+    for (size_t end = 0; end <= len; end++) {
+        if (limits->group[end] != '/' && limits->group[end] != '\0') continue;
+
+        snprintf(path, sizeof(path), "/sys/fs/cgroup/runbox/%.*s", (int)end, limits->group);
+
+        if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+            printf("failed creating cgroup %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        snprintf(control, sizeof(control), "%s/cgroup.subtree_control", path);
+        if (enable_buf && write_file(control, enable_buf) != 0) {
+            printf("Failed to enable controllers in %.*s subtree_control\n", (int)end, limits->group);
+            return -1;
+        }
+    }
+
     return 0;
 }
 
@@ -226,6 +274,11 @@ int validate_cgroup_limits(struct CgroupLimits *limits) {
         return -1;
     }
 
+    if (limits->cpu_weight && (limits->cpu_weight < CPU_WEIGHT_MIN || limits->cpu_weight > CPU_WEIGHT_MAX)) {
+        printf("Invalid cpu.weight\n");
+        return -1;
+    }
+
     if (limits->memory_enabled && validate_memory_max(limits->memory_max)) {
         printf("Invalid memory.max\n");
         return -1;
@@ -268,6 +321,24 @@ int validate_memory_max(const char *mem) {
     return -1;
 }
 
+int parse_memory_bytes(const char *mem, unsigned long long *bytes) {
+    if (validate_memory_max(mem) != 0 || strcmp(mem, "max") == 0) {
+        return -1;
+    }
+
+    char *end;
+    unsigned long long val = strtoull(mem, &end, 10);
+
+    switch (*end) {
+        case 'K': case 'k': val <<= 10; break;
+        case 'M': case 'm': val <<= 20; break;
+        case 'G': case 'g': val <<= 30; break;
+    }
+
+    *bytes = val;
+    return 0;
+}
+
 int validate_pids_max(int pids) {
     if (pids == PIDS_MAX_ALIAS || pids > 0) {
         return 0;
@@ -276,6 +347,218 @@ int validate_pids_max(int pids) {
     return -1;
 }
 
+/*
+ * One cgroup file rewritten by update_cgroup_limits. The value goes in with a single
+ * write(2), so the kernel applies it whole or rejects it, and `old` allows rolling back.
+ */
+struct LimitWrite {
+    const char *file;
+    char old[64];
+    char new[64];
+};
+
+static int read_limit(const char *cgroup, const char *file, char *buffer, size_t size) {
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+    if (read_file(path, buffer, size) != 0) {
+        return -1;
+    }
+
+    buffer[strcspn(buffer, "\n")] = '\0';
+    return 0;
+}
+
+static int write_limit(const char *cgroup, const char *file, const char *value) {
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        printf("Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (write(fd, value, strlen(value)) != (ssize_t)strlen(value)) {
+        printf("Error writing %s to %s: %s\n", value, path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+// Bytes of a memory.max / memory.high value, ULLONG_MAX for "max"
+static unsigned long long memory_limit_bytes(const char *value) {
+    unsigned long long bytes;
+
+    if (strcmp(value, "max") == 0) {
+        return ULLONG_MAX;
+    }
+
+    if (parse_memory_bytes(value, &bytes) != 0) {
+        return strtoull(value, NULL, 10);
+    }
+
+    return bytes;
+}
+
+static int add_write(struct LimitWrite *writes, int count, const char *cgroup, const char *file, const char *value) {
+    writes[count].file = file;
+    snprintf(writes[count].new, sizeof(writes[count].new), "%s", value);
+
+    return read_limit(cgroup, file, writes[count].old, sizeof(writes[count].old));
+}
+
+/*
+ * Changes the limits of a live sandbox cgroup. Only the enabled limits are touched, and
+ * they are validated like at launch. Shrinking memory lowers memory.high first, so the
+ * kernel throttles and reclaims down to the new size instead of the OOM killer firing on
+ * the memory.max write, and restores memory.high afterwards; growing memory raises
+ * memory.max before anything else. If a write fails, the ones done so far are undone.
+ */
+int update_cgroup_limits(const char *cgroup, struct CgroupLimits *limits) {
+    struct LimitWrite writes[6];
+    char value[64];
+    int count = 0;
+
+    if (validate_cgroup_limits(limits) != 0) {
+        return -1;
+    }
+
+    if (limits->memory_enabled) {
+        char old_max[64], old_high[64];
+
+        if (read_limit(cgroup, "memory.max", old_max, sizeof(old_max)) != 0 ||
+            read_limit(cgroup, "memory.high", old_high, sizeof(old_high)) != 0) {
+            return -1;
+        }
+
+        unsigned long long new_bytes = memory_limit_bytes(limits->memory_max);
+
+        if (new_bytes < memory_limit_bytes(old_high)) {
+            if (add_write(writes, count++, cgroup, "memory.high", limits->memory_max) != 0) {
+                return -1;
+            }
+        }
+
+        if (add_write(writes, count++, cgroup, "memory.max", limits->memory_max) != 0) {
+            return -1;
+        }
+
+        if (new_bytes < memory_limit_bytes(old_high)) {
+            if (add_write(writes, count++, cgroup, "memory.high", old_high) != 0) {
+                return -1;
+            }
+        }
+    }
+
+    if (limits->cpu_enabled) {
+        format_cpu_max(limits->cpus, value, sizeof(value));
+        if (add_write(writes, count++, cgroup, "cpu.max", value) != 0) {
+            return -1;
+        }
+    }
+
+    if (limits->cpu_weight) {
+        snprintf(value, sizeof(value), "%d", limits->cpu_weight);
+        if (add_write(writes, count++, cgroup, "cpu.weight", value) != 0) {
+            return -1;
+        }
+    }
+
+    if (limits->pids_enabled) {
+        format_pids_max(limits->pids_max, value, sizeof(value));
+        if (add_write(writes, count++, cgroup, "pids.max", value) != 0) {
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (write_limit(cgroup, writes[i].file, writes[i].new) == 0) {
+            continue;
+        }
+
+        while (--i >= 0) {
+            write_limit(cgroup, writes[i].file, writes[i].old);
+        }
+
+        printf("Limits of %s left unchanged\n", cgroup);
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        // The temporary memory.high step is an implementation detail, report the net change
+        if (strcmp(writes[i].file, "memory.high") == 0) {
+            continue;
+        }
+
+        read_limit(cgroup, writes[i].file, value, sizeof(value));
+        fprintf(stderr, "runbox: %s %s -> %s\n", writes[i].file, writes[i].old, value);
+    }
+
+    return 0;
+}
+
+// Tenant cgroups sit next to the numeric sandbox cgroups and the pod-* ones in runbox/
+int validate_tenant_name(const char *name) {
+    size_t len = strlen(name);
+
+    if (len == 0 || len > TENANT_NAME_MAX || !isalpha((unsigned char)name[0]) || strncmp(name, "pod-", 4) == 0) {
+        return -1;
+    }
+
+    for (const char *p = name; *p; p++) {
+        if (!isalnum((unsigned char)*p) && *p != '-' && *p != '_') {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+/*
+ * Sets the aggregate limits of a tenant, creating its cgroup if needed. The controllers
+ * are enabled down to the tenant whether or not its sandboxes set limits of their own,
+ * so cpu.weight shares the CPU between the tenants even when no job is capped.
+ */
+int set_tenant_limits(const char *tenant, struct CgroupLimits *limits) {
+    char cgroup[256];
+    struct CgroupLimits controllers = {
+        .cpu_enabled = limits->cpu_enabled || limits->cpu_weight,
+        .memory_enabled = limits->memory_enabled,
+        .pids_enabled = limits->pids_enabled,
+        .group = tenant,
+    };
+
+    if (validate_cgroup_limits(limits) != 0) {
+        return -1;
+    }
+
+    if (validate_and_enable_host_controllers(&controllers) != 0 ||
+        create_sandbox_cgroup_and_enable_controllers(&controllers) != 0) {
+        return -1;
+    }
+
+    snprintf(cgroup, sizeof(cgroup), "/sys/fs/cgroup/runbox/%s", tenant);
+    return update_cgroup_limits(cgroup, limits);
+}
+
+int remove_tenant(const char *tenant) {
+    char cgroup[256];
+    snprintf(cgroup, sizeof(cgroup), "/sys/fs/cgroup/runbox/%s", tenant);
+
+    if (rmdir(cgroup) == -1) {
+        printf("failed removing tenant %s: %s\n", tenant,
+               errno == EBUSY ? "it still has running sandboxes" : strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
 int write_file(const char *path, const char *text) {
     FILE *f = fopen(path, "w");
     if (!f) {
@@ -323,3 +606,37 @@ int contains_controller(const char *enabled_controllers, const char *controller)
 
     return 0;
 }
+
+// Reads the "some avg10" value of a PSI file such as cpu.pressure
+int read_pressure(const char *cgroup, const char *file, double *avg10) {
+    char path[256];
+    char buffer[256];
+
+    snprintf(path, sizeof(path), "%s/%s", cgroup, file);
+    if (read_file(path, buffer, sizeof(buffer)) != 0) {
+        return -1;
+    }
+
+    char *p = strstr(buffer, "some avg10=");
+    if (!p) {
+        return -1;
+    }
+
+    *avg10 = atof(p + strlen("some avg10="));
+    return 0;
+}
+
+// Value of a "key value" line in a flat-keyed file such as cpu.stat or memory.stat
+unsigned long long read_stat_field(const char *buffer, const char *key) {
+    size_t len = strlen(key);
+    const char *p = buffer;
+
+    while ((p = strstr(p, key)) != NULL) {
+        if ((p == buffer || p[-1] == '\n') && p[len] == ' ') {
+            return strtoull(p + len + 1, NULL, 10);
+        }
+        p += len;
+    }
+
+    return 0;
+}
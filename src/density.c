@@ -0,0 +1,141 @@
+#include "density.h"
+#include "cgroup.h"
+#include <sys/prctl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+
+/*
+ * Opts the calling process into KSM for all its anonymous memory. The flag is kept
+ * across fork and exec, so setting it in the sandbox init covers the whole workload.
+ */
+int enable_memory_merge(void) {
+    if (prctl(PR_SET_MEMORY_MERGE, 1, 0, 0, 0) == -1) {
+        printf("Warning: PR_SET_MEMORY_MERGE failed (needs Linux 6.4+): %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Checked from the launcher: the sandbox init no longer sees the host /sys
+void check_ksm_running(void) {
+    char run[16];
+
+    if (read_file("/sys/kernel/mm/ksm/run", run, sizeof(run)) == 0 && atoi(run) != 1) {
+        fprintf(stderr, "Warning: KSM is not running, pages will not be merged (echo 1 > /sys/kernel/mm/ksm/run)\n");
+    }
+}
+
+void density_init(struct DensityMonitor *monitor, const char *cgroup, int merge, double idle_ratio) {
+    *monitor = (struct DensityMonitor) {
+        .cgroup = cgroup,
+        .idle_ratio = idle_ratio,
+        .merge = merge,
+    };
+}
+
+// KSM counts merged pages per process, so the sandbox figure is the sum over its cgroup
+static void sample_merged_pages(struct DensityMonitor *monitor) {
+    char path[256];
+
+    snprintf(path, sizeof(path), "%s/cgroup.procs", monitor->cgroup);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return;
+    }
+
+    unsigned long long total = 0;
+    int pid;
+
+    while (fscanf(f, "%d", &pid) == 1) {
+        // Quietly skip processes that exit while we walk the list
+        snprintf(path, sizeof(path), "/proc/%d/ksm_merging_pages", pid);
+        FILE *pages = fopen(path, "r");
+        unsigned long long count;
+
+        if (pages) {
+            if (fscanf(pages, "%llu", &count) == 1) {
+                total += count;
+            }
+            fclose(pages);
+        }
+    }
+
+    fclose(f);
+
+    if (total > monitor->merged_pages_peak) {
+        monitor->merged_pages_peak = total;
+    }
+}
+
+static int read_memory_current(const char *cgroup, unsigned long long *bytes) {
+    char path[256];
+    char value[32];
+
+    snprintf(path, sizeof(path), "%s/memory.current", cgroup);
+    if (read_file(path, value, sizeof(value)) != 0) {
+        return -1;
+    }
+
+    *bytes = strtoull(value, NULL, 10);
+    return 0;
+}
+
+/*
+ * Proactive reclaim: treat the inactive LRU lists as idle memory and, while they make up
+ * more than the target share of the cgroup's usage, ask memory.reclaim for the excess.
+ * Steps are capped so a burst never turns into a reclaim storm, and skipped entirely
+ * while the sandbox is already under memory pressure.
+ */
+static void reclaim_idle(struct DensityMonitor *monitor) {
+    char path[256];
+    char stat[4096];
+    unsigned long long current, after;
+    double pressure;
+
+    if (read_pressure(monitor->cgroup, "memory.pressure", &pressure) == 0 && pressure > RECLAIM_PRESSURE_LIMIT) {
+        return;
+    }
+
+    snprintf(path, sizeof(path), "%s/memory.stat", monitor->cgroup);
+    if (read_memory_current(monitor->cgroup, &current) != 0 || current == 0 ||
+        read_file(path, stat, sizeof(stat)) != 0) {
+        return;
+    }
+
+    unsigned long long idle = read_stat_field(stat, "inactive_anon") + read_stat_field(stat, "inactive_file");
+    unsigned long long target = (unsigned long long)(monitor->idle_ratio * current);
+
+    if (idle <= target) {
+        return;
+    }
+
+    unsigned long long amount = idle - target;
+    unsigned long long cap = (unsigned long long)(RECLAIM_MAX_STEP_RATIO * current);
+    if (amount > cap) amount = cap;
+    if (amount < 4096) return;
+
+    char value[32];
+    snprintf(path, sizeof(path), "%s/memory.reclaim", monitor->cgroup);
+    snprintf(value, sizeof(value), "%llu", amount);
+
+    // EAGAIN only means less than asked for could be reclaimed; measure what actually went
+    write_file(path, value);
+
+    if (read_memory_current(monitor->cgroup, &after) == 0 && after < current) {
+        monitor->reclaimed_bytes += current - after;
+    }
+}
+
+void density_step(struct DensityMonitor *monitor) {
+    if (monitor->merge) {
+        sample_merged_pages(monitor);
+    }
+
+    if (monitor->idle_ratio > 0) {
+        reclaim_idle(monitor);
+    }
+}
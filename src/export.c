@@ -0,0 +1,327 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sendfile.h>
+#include <sys/syscall.h>
+#include <linux/openat2.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "workqueue.h"
+#include "export.h"
+
+struct ExportContext {
+    struct WorkQueue wq;
+
+    // Updated by the workers with atomics
+    unsigned long files;
+    unsigned long long bytes;
+    int failed;
+};
+
+struct CopyJob {
+    struct ExportContext *ctx;
+    int src_fd;
+    int dst_fd;
+    struct stat st;
+};
+
+int parse_export(char *arg, struct ExportSpec *spec) {
+    char *sep = strchr(arg, ':');
+
+    if (!sep || arg[0] != '/' || sep == arg + 1 || sep[1] == '\0') {
+        return -1;
+    }
+
+    *sep = '\0';
+    spec->sandbox_path = arg;
+    spec->host_dir = sep + 1;
+    return 0;
+}
+
+/*
+ * Copies without moving data through userspace: copy_file_range() where the kernel
+ * supports it between the two filesystems, sendfile() otherwise (tmpfs to a disk
+ * filesystem is EXDEV for copy_file_range on recent kernels).
+ */
+static int copy_contents(int src, int dst, off_t size) {
+    off_t done = 0;
+    int use_sendfile = 0;
+
+    while (done < size) {
+        size_t chunk = size - done > (1 << 30) ? (1 << 30) : (size_t)(size - done);
+        ssize_t n;
+
+        if (!use_sendfile) {
+            n = copy_file_range(src, NULL, dst, NULL, chunk, 0);
+            if (n == -1 && (errno == EXDEV || errno == EINVAL || errno == ENOSYS || errno == EOPNOTSUPP)) {
+                use_sendfile = 1;
+                continue;
+            }
+        } else {
+            n = sendfile(dst, src, NULL, chunk);
+        }
+
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+
+        // The file shrank underneath us; keep what is there
+        if (n == 0) break;
+
+        done += n;
+    }
+
+    return 0;
+}
+
+static void copy_job(void *arg) {
+    struct CopyJob *job = arg;
+    struct ExportContext *ctx = job->ctx;
+    struct timespec times[2] = { job->st.st_atim, job->st.st_mtim };
+
+    if (copy_contents(job->src_fd, job->dst_fd, job->st.st_size) != 0 ||
+        fchmod(job->dst_fd, job->st.st_mode & 07777) == -1 || futimens(job->dst_fd, times) == -1) {
+        printf("failed exporting file: %s\n", strerror(errno));
+        __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+    } else {
+        __atomic_fetch_add(&ctx->files, 1, __ATOMIC_RELAXED);
+        __atomic_fetch_add(&ctx->bytes, job->st.st_size, __ATOMIC_RELAXED);
+    }
+
+    close(job->src_fd);
+    close(job->dst_fd);
+    free(job);
+}
+
+static int export_entry(struct ExportContext *ctx, int src_parent, int dst_parent, const char *name);
+
+static int export_dir(struct ExportContext *ctx, int src_fd, int dst_fd) {
+    DIR *dir = fdopendir(src_fd);
+    if (!dir) {
+        printf("failed reading exported directory: %s\n", strerror(errno));
+        close(src_fd);
+        return -1;
+    }
+
+    int ret = 0;
+    struct dirent *de;
+
+    while ((de = readdir(dir))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        if (export_entry(ctx, dirfd(dir), dst_fd, de->d_name) != 0) {
+            ret = -1;
+        }
+    }
+
+    closedir(dir);
+    return ret;
+}
+
+// Symlinks are copied as symlinks and never followed, so the walk cannot leave the sandbox
+static int export_entry(struct ExportContext *ctx, int src_parent, int dst_parent, const char *name) {
+    struct stat st;
+
+    if (fstatat(src_parent, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        printf("failed inspecting %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    if (S_ISDIR(st.st_mode)) {
+        if (mkdirat(dst_parent, name, (st.st_mode & 07777) | 0700) == -1 && errno != EEXIST) {
+            printf("failed creating %s: %s\n", name, strerror(errno));
+            return -1;
+        }
+
+        int src_fd = openat(src_parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        int dst_fd = openat(dst_parent, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+
+        if (src_fd == -1 || dst_fd == -1) {
+            printf("failed opening directory %s: %s\n", name, strerror(errno));
+            if (src_fd != -1) close(src_fd);
+            if (dst_fd != -1) close(dst_fd);
+            return -1;
+        }
+
+        int ret = export_dir(ctx, src_fd, dst_fd);
+        close(dst_fd);
+        return ret;
+    }
+
+    if (S_ISLNK(st.st_mode)) {
+        char target[PATH_MAX];
+        ssize_t n = readlinkat(src_parent, name, target, sizeof(target) - 1);
+        if (n == -1) {
+            printf("failed reading symlink %s: %s\n", name, strerror(errno));
+            return -1;
+        }
+        target[n] = '\0';
+
+        unlinkat(dst_parent, name, 0);
+        if (symlinkat(target, dst_parent, name) == -1) {
+            printf("failed creating symlink %s: %s\n", name, strerror(errno));
+            return -1;
+        }
+        return 0;
+    }
+
+    // Devices, sockets and FIFOs are not artifacts
+    if (!S_ISREG(st.st_mode)) {
+        return 0;
+    }
+
+    struct CopyJob *job = malloc(sizeof(*job));
+    if (!job) {
+        printf("failed allocating export job\n");
+        return -1;
+    }
+
+    job->ctx = ctx;
+    job->st = st;
+    job->src_fd = openat(src_parent, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    job->dst_fd = openat(dst_parent, name, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0600);
+
+    if (job->src_fd == -1 || job->dst_fd == -1) {
+        printf("failed opening %s for export: %s\n", name, strerror(errno));
+        if (job->src_fd != -1) close(job->src_fd);
+        if (job->dst_fd != -1) close(job->dst_fd);
+        free(job);
+        return -1;
+    }
+
+    if (workqueue_submit(&ctx->wq, copy_job, job, 0) != 0) {
+        close(job->src_fd);
+        close(job->dst_fd);
+        free(job);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int export_one(struct ExportContext *ctx, int root_fd, const struct ExportSpec *spec) {
+    char dir[PATH_MAX];
+    const char *name;
+
+    snprintf(dir, sizeof(dir), "%s", spec->sandbox_path);
+
+    // Split into parent and base name, ignoring trailing slashes
+    size_t len = strlen(dir);
+    while (len > 1 && dir[len - 1] == '/') dir[--len] = '\0';
+
+    char *slash = strrchr(dir, '/');
+    name = slash + 1;
+    if (name[0] == '\0') {
+        printf("refusing to export the sandbox root\n");
+        return -1;
+    }
+    *slash = '\0';
+
+    // Resolve the parent as if the sandbox root were "/": absolute symlinks and ".." stay inside
+    struct open_how how = {
+        .flags = O_PATH | O_DIRECTORY | O_CLOEXEC,
+        .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+    };
+    int src_parent = (int)syscall(SYS_openat2, root_fd, dir[0] ? dir : "/", &how, sizeof(how));
+    if (src_parent == -1) {
+        printf("nothing to export at %s: %s\n", spec->sandbox_path, strerror(errno));
+        return -1;
+    }
+
+    if (mkdir(spec->host_dir, 0755) == -1 && errno != EEXIST) {
+        printf("failed creating %s: %s\n", spec->host_dir, strerror(errno));
+        close(src_parent);
+        return -1;
+    }
+
+    int dst_fd = open(spec->host_dir, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (dst_fd == -1) {
+        printf("Error opening %s: %s\n", spec->host_dir, strerror(errno));
+        close(src_parent);
+        return -1;
+    }
+
+    int ret = export_entry(ctx, src_parent, dst_fd, name);
+
+    close(dst_fd);
+    close(src_parent);
+    return ret;
+}
+
+/*
+ * Copies the requested paths out of the directory tree at `root`. Directories are walked
+ * by the caller while file contents are copied by a pool of workers, one file per job.
+ */
+static int copy_exports(const char *root, const struct ExportSpec *exports, int count,
+                        unsigned long *files, unsigned long long *bytes) {
+    struct ExportContext ctx = { 0 };
+
+    int root_fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        printf("failed opening sandbox root %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+
+    long cpus = sysconf(_SC_NPROCESSORS_ONLN);
+    if (workqueue_init(&ctx.wq, cpus > 0 ? (int)cpus : 1, EXPORT_MAX_PENDING_FILES, 0) != 0) {
+        close(root_fd);
+        return -1;
+    }
+
+    int ret = 0;
+    for (int i = 0; i < count; i++) {
+        if (export_one(&ctx, root_fd, &exports[i]) != 0) {
+            ret = -1;
+        }
+    }
+
+    workqueue_wait(&ctx.wq);
+    workqueue_destroy(&ctx.wq);
+    close(root_fd);
+
+    if (ctx.failed) {
+        ret = -1;
+    }
+
+    *files = ctx.files;
+    *bytes = ctx.bytes;
+    return ret;
+}
+
+// Copies the exports out of a sandbox whose mount namespace is still held open by `pid`
+int export_artifacts(pid_t pid, const struct ExportSpec *exports, int count) {
+    char root[64];
+    struct timespec start, end;
+    unsigned long files = 0;
+    unsigned long long bytes = 0;
+
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    snprintf(root, sizeof(root), "/proc/%d/root", pid);
+    int ret = copy_exports(root, exports, count, &files, &bytes);
+
+    clock_gettime(CLOCK_MONOTONIC, &end);
+    double seconds = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) / 1e9;
+
+    fprintf(stderr, "runbox: exported %lu files, %.1f MiB in %.3fs%s\n", files,
+            bytes / (1024.0 * 1024.0), seconds, ret != 0 ? " (with errors)" : "");
+
+    return ret;
+}
+
+// Same copy between two host directory trees, used to store and replay cached artifacts
+int copy_tree(const char *root, const struct ExportSpec *exports, int count) {
+    unsigned long files;
+    unsigned long long bytes;
+
+    return copy_exports(root, exports, count, &files, &bytes);
+}
@@ -0,0 +1,1736 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/sysmacros.h>
+#include <sys/xattr.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <getopt.h>
+#include <limits.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "sha256.h"
+#include "workqueue.h"
+#include "image.h"
+
+#define TAR_BLOCK_SIZE 512
+#define READ_CHUNK_SIZE (1 << 20)
+
+/*
+ * Layer store layout under /var/lib/runbox:
+ *
+ *   blobs/<sha256>-<mode>-<uid>-<gid>  file contents, one inode per distinct content and owner
+ *   layers/<sha256>/                   extracted layer, id = hash of the tar stream; every
+ *                                      regular file is a hard link into blobs/
+ *   images/<name>                      layer ids, bottom layer first
+ *
+ * Mode and owner are part of the blob name because hard links share the inode, so two
+ * files can only share a blob when they would also share those attributes.
+ */
+
+struct TarReader {
+    int fd;
+    char *buf;
+    size_t len;
+    size_t pos;
+    struct Sha256 hash;      // Covers every byte of the stream, including padding
+    unsigned long long total;
+};
+
+struct TarEntry {
+    char type;
+    char *path;
+    char *linkpath;
+    unsigned long long size;
+    unsigned long long mode;
+    unsigned long long uid;
+    unsigned long long gid;
+    unsigned long long mtime;
+    unsigned long long devmajor;
+    unsigned long long devminor;
+};
+
+struct FileMeta {
+    mode_t mode;
+    uid_t uid;
+    gid_t gid;
+    time_t mtime;
+};
+
+struct DirMeta {
+    char *path;
+    struct FileMeta meta;
+};
+
+/**
+ * PendingPaths - Set of layer paths a worker may still be writing.
+ *
+ * Holds every queued small file and all of its parent directories, until the next
+ * workqueue_wait(). An entry touching one of them waits for the workers first, so a
+ * later archive entry for the same path always wins.
+ *
+ * Fields:
+ *   slots - Open-addressing hash table of paths, NULL for free slots.
+ *   size  - Number of slots, a power of two.
+ *   count - Number of paths in the table.
+ */
+struct PendingPaths {
+    char **slots;
+    size_t size;
+    size_t count;
+};
+
+struct ImportContext {
+    int root_fd;             // Staging directory of the layer being imported
+    int blobs_fd;
+    struct WorkQueue wq;
+
+    struct DirMeta *dirs;
+    size_t ndirs;
+    struct PendingPaths pending;
+    size_t nlinks;
+
+    // Updated by the workers with atomics
+    unsigned long files;
+    unsigned long long bytes;
+    unsigned long blobs_new;
+    unsigned long blobs_reused;
+    unsigned long tmp_seq;
+    int failed;
+
+    unsigned long whiteouts;
+};
+
+struct FileJob {
+    struct ImportContext *ctx;
+    int dir_fd;
+    char *base;
+    char *data;
+    size_t size;
+    struct FileMeta meta;
+};
+
+static int ensure_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        printf("failed creating %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int valid_image_name(const char *name) {
+    if (!name[0] || name[0] == '.' || strlen(name) > IMAGE_NAME_MAX) {
+        return 0;
+    }
+
+    for (const char *p = name; *p; p++) {
+        if (!(*p >= 'a' && *p <= 'z') && !(*p >= 'A' && *p <= 'Z') && !(*p >= '0' && *p <= '9') &&
+            *p != '.' && *p != '_' && *p != '-') {
+            return 0;
+        }
+    }
+
+    return 1;
+}
+
+// Reads the layer ids of an image, bottom layer first. Returns the number of layers
+static int read_image_layers(const char *name, char layers[][SHA256_HEX_SIZE], int max) {
+    char path[256];
+    char line[128];
+
+    if (!valid_image_name(name)) {
+        printf("Invalid image name: '%s'\n", name);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), IMAGE_NAME_DIR "/%s", name);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("No such image '%s': %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    int count = 0;
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+        if (line[0] == '\0') continue;
+
+        if (strlen(line) != SHA256_HEX_SIZE - 1 || count == max) {
+            printf("Corrupt or oversized image record %s\n", path);
+            fclose(f);
+            return -1;
+        }
+
+        memcpy(layers[count++], line, SHA256_HEX_SIZE);
+    }
+
+    fclose(f);
+
+    if (count == 0) {
+        printf("Image '%s' has no layers\n", name);
+        return -1;
+    }
+
+    return count;
+}
+
+static int write_image_layers(const char *name, char layers[][SHA256_HEX_SIZE], int count) {
+    char path[256];
+    char tmp_path[256];
+
+    snprintf(path, sizeof(path), IMAGE_NAME_DIR "/%s", name);
+    snprintf(tmp_path, sizeof(tmp_path), IMAGE_NAME_DIR "/.%s.%d.tmp", name, getpid());
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        printf("Error opening %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < count; i++) {
+        fprintf(f, "%s\n", layers[i]);
+    }
+
+    if (fclose(f) != 0) {
+        printf("Error writing to %s: %s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    if (rename(tmp_path, path) == -1) {
+        printf("failed publishing image %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+// Builds the overlayfs lowerdir= value for an image: top layer first, as overlayfs expects
+int image_lowerdir(const char *name, char *buf, size_t size) {
+    char layers[IMAGE_MAX_LAYERS][SHA256_HEX_SIZE];
+
+    int count = read_image_layers(name, layers, IMAGE_MAX_LAYERS);
+    if (count < 0) {
+        return -1;
+    }
+
+    size_t len = 0;
+    buf[0] = '\0';
+
+    for (int i = count - 1; i >= 0; i--) {
+        char layer[256];
+        snprintf(layer, sizeof(layer), IMAGE_LAYER_DIR "/%s", layers[i]);
+
+        if (access(layer, F_OK) == -1) {
+            printf("Layer %s of image '%s' is missing: %s\n", layers[i], name, strerror(errno));
+            return -1;
+        }
+
+        int n = snprintf(buf + len, size - len, "%s%s", len ? ":" : "", layer);
+        if (n < 0 || (size_t)n >= size - len) {
+            printf("Image '%s' has too many layers to mount\n", name);
+            return -1;
+        }
+        len += n;
+    }
+
+    return 0;
+}
+
+static int reader_fill(struct TarReader *r) {
+    ssize_t n;
+
+    do {
+        n = read(r->fd, r->buf, READ_CHUNK_SIZE);
+    } while (n == -1 && errno == EINTR);
+
+    if (n == -1) {
+        printf("failed reading image archive: %s\n", strerror(errno));
+        return -1;
+    }
+
+    sha256_update(&r->hash, r->buf, n);
+    r->total += n;
+    r->len = n;
+    r->pos = 0;
+
+    return (int)n;
+}
+
+// Copies exactly n bytes of the stream into dst, or discards them when dst is NULL
+static int reader_read(struct TarReader *r, void *dst, size_t n) {
+    char *out = dst;
+
+    while (n > 0) {
+        if (r->pos == r->len) {
+            int ret = reader_fill(r);
+            if (ret < 0) return -1;
+            if (ret == 0) {
+                printf("unexpected end of image archive\n");
+                return -1;
+            }
+        }
+
+        size_t take = r->len - r->pos;
+        if (take > n) take = n;
+
+        if (out) {
+            memcpy(out, r->buf + r->pos, take);
+            out += take;
+        }
+
+        r->pos += take;
+        n -= take;
+    }
+
+    return 0;
+}
+
+static int reader_skip_padding(struct TarReader *r, unsigned long long size) {
+    return reader_read(r, NULL, (TAR_BLOCK_SIZE - size % TAR_BLOCK_SIZE) % TAR_BLOCK_SIZE);
+}
+
+// Octal, or GNU base-256 for values that do not fit (files over 8G, large uids)
+static int parse_tar_number(const char *field, size_t len, unsigned long long *out) {
+    const unsigned char *p = (const unsigned char *)field;
+    unsigned long long val = 0;
+
+    if (p[0] & 0x80) {
+        if (p[0] & 0x40) return -1;
+
+        val = p[0] & 0x3f;
+        for (size_t i = 1; i < len; i++) {
+            if (val >> 56) return -1;
+            val = (val << 8) | p[i];
+        }
+
+        *out = val;
+        return 0;
+    }
+
+    size_t i = 0;
+    while (i < len && p[i] == ' ') i++;
+
+    for (; i < len && p[i] >= '0' && p[i] <= '7'; i++) {
+        val = val * 8 + (p[i] - '0');
+    }
+
+    if (i < len && p[i] != ' ' && p[i] != '\0') return -1;
+
+    *out = val;
+    return 0;
+}
+
+static char *read_tar_string(struct TarReader *r, unsigned long long size) {
+    if (size > 1 << 20) {
+        printf("oversized path record in image archive\n");
+        return NULL;
+    }
+
+    char *s = malloc(size + 1);
+    if (!s) {
+        printf("failed allocating path record\n");
+        return NULL;
+    }
+
+    if (reader_read(r, s, size) != 0 || reader_skip_padding(r, size) != 0) {
+        free(s);
+        return NULL;
+    }
+
+    s[size] = '\0';
+    return s;
+}
+
+static char *dup_field(const char *field, size_t len) {
+    return strndup(field, strnlen(field, len));
+}
+
+// Applies the records of a PAX extended header ("<len> key=value\n") to the next entry
+static int parse_pax(const char *data, size_t size, struct TarEntry *entry, int *has_size) {
+    size_t off = 0;
+
+    while (off < size) {
+        char *end;
+        unsigned long len = strtoul(data + off, &end, 10);
+
+        if (end == data + off || *end != ' ' || len == 0 || len > size - off) {
+            printf("malformed PAX header in image archive\n");
+            return -1;
+        }
+
+        const char *key = end + 1;
+        const char *record_end = data + off + len - 1;   // The trailing newline
+        const char *eq = memchr(key, '=', record_end - key);
+
+        if (eq) {
+            size_t key_len = eq - key;
+            char *value = strndup(eq + 1, record_end - eq - 1);
+
+            if (key_len == 4 && memcmp(key, "path", 4) == 0) {
+                free(entry->path);
+                entry->path = value;
+                value = NULL;
+            } else if (key_len == 8 && memcmp(key, "linkpath", 8) == 0) {
+                free(entry->linkpath);
+                entry->linkpath = value;
+                value = NULL;
+            } else if (key_len == 4 && memcmp(key, "size", 4) == 0) {
+                entry->size = strtoull(value, NULL, 10);
+                *has_size = 1;
+            } else if (key_len == 3 && memcmp(key, "uid", 3) == 0) {
+                entry->uid = strtoull(value, NULL, 10);
+            } else if (key_len == 3 && memcmp(key, "gid", 3) == 0) {
+                entry->gid = strtoull(value, NULL, 10);
+            } else if (key_len == 5 && memcmp(key, "mtime", 5) == 0) {
+                entry->mtime = strtoull(value, NULL, 10);
+            }
+
+            free(value);
+        }
+
+        off += len;
+    }
+
+    return 0;
+}
+
+// Normalises an archive path in place to "a/b/c"; anything climbing out with ".." is rejected
+static int clean_path(char *path) {
+    char *out = path;
+    char *p = path;
+
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+
+        char *start = p;
+        while (*p && *p != '/') p++;
+        size_t len = p - start;
+
+        if (len == 1 && start[0] == '.') continue;
+        if (len == 2 && start[0] == '.' && start[1] == '.') return -1;
+
+        if (out != path) *out++ = '/';
+        memmove(out, start, len);
+        out += len;
+    }
+
+    *out = '\0';
+    return 0;
+}
+
+/*
+ * Opens the directory that will hold `path` (already cleaned) one component at a time with
+ * O_NOFOLLOW, so an entry can never escape the layer through a symlink planted by an earlier
+ * entry. Missing directories are created. *base is pointed at the last component.
+ */
+static int open_parent(int root_fd, char *path, char **base) {
+    int fd = openat(root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        printf("failed opening layer root: %s\n", strerror(errno));
+        return -1;
+    }
+
+    char *p = path;
+    char *slash;
+
+    while ((slash = strchr(p, '/'))) {
+        *slash = '\0';
+
+        int next = openat(fd, p, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (next == -1 && errno == ENOENT) {
+            if (mkdirat(fd, p, 0755) == -1 && errno != EEXIST) {
+                *slash = '/';
+                printf("failed creating directory for %s: %s\n", path, strerror(errno));
+                close(fd);
+                return -1;
+            }
+            next = openat(fd, p, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        }
+
+        *slash = '/';
+        close(fd);
+
+        if (next == -1) {
+            printf("unsafe or invalid path in image: %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        fd = next;
+        p = slash + 1;
+    }
+
+    *base = p;
+    return fd;
+}
+
+// Later archive entries replace earlier ones with the same name
+static void remove_existing(int dir_fd, const char *base) {
+    if (unlinkat(dir_fd, base, 0) == -1 && errno == EISDIR) {
+        unlinkat(dir_fd, base, AT_REMOVEDIR);
+    }
+}
+
+static int remove_tree(int parent_fd, const char *name) {
+    int fd = openat(parent_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        return unlinkat(parent_fd, name, 0);
+    }
+
+    DIR *dir = fdopendir(fd);
+    if (!dir) {
+        close(fd);
+        return -1;
+    }
+
+    struct dirent *de;
+    while ((de = readdir(dir))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        if (de->d_type == DT_DIR || de->d_type == DT_UNKNOWN) {
+            remove_tree(fd, de->d_name);
+        } else {
+            unlinkat(fd, de->d_name, 0);
+        }
+    }
+
+    closedir(dir);
+    return unlinkat(parent_fd, name, AT_REMOVEDIR);
+}
+
+static int write_all(int fd, const char *data, size_t size) {
+    while (size > 0) {
+        ssize_t n = write(fd, data, size);
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            return -1;
+        }
+        data += n;
+        size -= n;
+    }
+
+    return 0;
+}
+
+static void blob_name(char *buf, size_t size, const char *hex, const struct FileMeta *meta) {
+    snprintf(buf, size, "%s-%o-%u-%u", hex, meta->mode & 07777, meta->uid, meta->gid);
+}
+
+static int open_temp_blob(struct ImportContext *ctx, char *tmp, size_t size) {
+    unsigned long seq = __atomic_fetch_add(&ctx->tmp_seq, 1, __ATOMIC_RELAXED);
+    snprintf(tmp, size, ".tmp-%d-%lu", getpid(), seq);
+
+    int fd = openat(ctx->blobs_fd, tmp, O_WRONLY | O_CREAT | O_EXCL | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        printf("failed creating blob %s: %s\n", tmp, strerror(errno));
+    }
+
+    return fd;
+}
+
+/*
+ * Gives a fully written temporary blob its metadata and its content name. Losing a race
+ * against another writer of the same content is fine, the blob already there is identical.
+ * Sets *created to whether this call added the blob.
+ */
+static int publish_blob(struct ImportContext *ctx, int fd, const char *tmp, const char *blob,
+                        const struct FileMeta *meta, int *created) {
+    struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, { .tv_sec = meta->mtime } };
+
+    // chown clears set-id bits, so the mode goes on afterwards
+    if (fchown(fd, meta->uid, meta->gid) == -1 || fchmod(fd, meta->mode & 07777) == -1 ||
+        futimens(fd, times) == -1) {
+        printf("failed setting attributes of blob %s: %s\n", blob, strerror(errno));
+        unlinkat(ctx->blobs_fd, tmp, 0);
+        return -1;
+    }
+
+    *created = 1;
+    if (linkat(ctx->blobs_fd, tmp, ctx->blobs_fd, blob, 0) == -1) {
+        if (errno != EEXIST) {
+            printf("failed storing blob %s: %s\n", blob, strerror(errno));
+            unlinkat(ctx->blobs_fd, tmp, 0);
+            return -1;
+        }
+        *created = 0;
+    }
+
+    unlinkat(ctx->blobs_fd, tmp, 0);
+    return 0;
+}
+
+static int link_blob(struct ImportContext *ctx, const char *blob, int dir_fd, const char *base) {
+    if (linkat(ctx->blobs_fd, blob, dir_fd, base, 0) == 0) {
+        return 0;
+    }
+
+    if (errno == EEXIST) {
+        remove_existing(dir_fd, base);
+        if (linkat(ctx->blobs_fd, blob, dir_fd, base, 0) == 0) {
+            return 0;
+        }
+    }
+
+    printf("failed linking %s into layer: %s\n", base, strerror(errno));
+    return -1;
+}
+
+static void count_blob(struct ImportContext *ctx, int created, size_t size) {
+    __atomic_fetch_add(created ? &ctx->blobs_new : &ctx->blobs_reused, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->files, 1, __ATOMIC_RELAXED);
+    __atomic_fetch_add(&ctx->bytes, size, __ATOMIC_RELAXED);
+}
+
+// Worker: hash a buffered file, write its blob unless the store already has it, link it in
+static void file_job(void *arg) {
+    struct FileJob *job = arg;
+    struct ImportContext *ctx = job->ctx;
+    char hex[SHA256_HEX_SIZE];
+    char blob[SHA256_HEX_SIZE + 64];
+    int created = 0;
+    int ret = -1;
+
+    struct Sha256 hash;
+    sha256_init(&hash);
+    sha256_update(&hash, job->data, job->size);
+    sha256_final_hex(&hash, hex);
+    blob_name(blob, sizeof(blob), hex, &job->meta);
+
+    if (faccessat(ctx->blobs_fd, blob, F_OK, AT_SYMLINK_NOFOLLOW) == -1) {
+        char tmp[64];
+        int fd = open_temp_blob(ctx, tmp, sizeof(tmp));
+        if (fd == -1) goto out;
+
+        if (write_all(fd, job->data, job->size) != 0) {
+            printf("failed writing blob %s: %s\n", blob, strerror(errno));
+            close(fd);
+            unlinkat(ctx->blobs_fd, tmp, 0);
+            goto out;
+        }
+
+        ret = publish_blob(ctx, fd, tmp, blob, &job->meta, &created);
+        close(fd);
+        if (ret != 0) goto out;
+    }
+
+    ret = link_blob(ctx, blob, job->dir_fd, job->base);
+    if (ret == 0) {
+        count_blob(ctx, created, job->size);
+    }
+
+out:
+    if (ret != 0) {
+        __atomic_store_n(&ctx->failed, 1, __ATOMIC_RELAXED);
+    }
+
+    close(job->dir_fd);
+    free(job->base);
+    free(job->data);
+    free(job);
+}
+
+// Large files are hashed while being copied, so their blob name is only known afterwards
+static int import_large_file(struct ImportContext *ctx, struct TarReader *r, int dir_fd,
+                             const char *base, unsigned long long size, const struct FileMeta *meta) {
+    char tmp[64];
+    char hex[SHA256_HEX_SIZE];
+    char blob[SHA256_HEX_SIZE + 64];
+
+    int fd = open_temp_blob(ctx, tmp, sizeof(tmp));
+    if (fd == -1) {
+        return -1;
+    }
+
+    struct Sha256 hash;
+    sha256_init(&hash);
+
+    unsigned long long left = size;
+    while (left > 0) {
+        if (r->pos == r->len && reader_fill(r) <= 0) {
+            printf("unexpected end of image archive\n");
+            goto fail;
+        }
+
+        size_t take = r->len - r->pos;
+        if (take > left) take = left;
+
+        sha256_update(&hash, r->buf + r->pos, take);
+        if (write_all(fd, r->buf + r->pos, take) != 0) {
+            printf("failed writing blob for %s: %s\n", base, strerror(errno));
+            goto fail;
+        }
+
+        r->pos += take;
+        left -= take;
+    }
+
+    sha256_final_hex(&hash, hex);
+    blob_name(blob, sizeof(blob), hex, meta);
+
+    int created;
+    int ret = publish_blob(ctx, fd, tmp, blob, meta, &created);
+    close(fd);
+
+    if (ret != 0 || link_blob(ctx, blob, dir_fd, base) != 0) {
+        return -1;
+    }
+
+    count_blob(ctx, created, size);
+    return reader_skip_padding(r, size);
+
+fail:
+    close(fd);
+    unlinkat(ctx->blobs_fd, tmp, 0);
+    return -1;
+}
+
+static size_t path_hash(const char *path, size_t len) {
+    size_t h = 14695981039346656037ULL;
+
+    for (size_t i = 0; i < len; i++) {
+        h = (h ^ (unsigned char)path[i]) * 1099511628211ULL;
+    }
+
+    return h;
+}
+
+// Finds the slot of path (first len bytes), or the free slot it would go in
+static char **pending_slot(struct PendingPaths *pending, const char *path, size_t len) {
+    size_t i = path_hash(path, len) & (pending->size - 1);
+
+    while (pending->slots[i] && (strncmp(pending->slots[i], path, len) != 0 || pending->slots[i][len] != '\0')) {
+        i = (i + 1) & (pending->size - 1);
+    }
+
+    return &pending->slots[i];
+}
+
+static int pending_grow(struct PendingPaths *pending) {
+    struct PendingPaths grown = { .size = pending->size ? pending->size * 2 : 1024 };
+
+    grown.slots = calloc(grown.size, sizeof(*grown.slots));
+    if (!grown.slots) {
+        printf("failed allocating pending path table\n");
+        return -1;
+    }
+
+    for (size_t i = 0; i < pending->size; i++) {
+        if (pending->slots[i]) {
+            *pending_slot(&grown, pending->slots[i], strlen(pending->slots[i])) = pending->slots[i];
+        }
+    }
+
+    free(pending->slots);
+    grown.count = pending->count;
+    *pending = grown;
+    return 0;
+}
+
+// Adds a queued file and its parent directories, which a later entry could also replace
+static int pending_add(struct PendingPaths *pending, const char *path) {
+    for (size_t len = strlen(path); len > 0; ) {
+        if ((pending->count + 1) * 2 > pending->size && pending_grow(pending) != 0) {
+            return -1;
+        }
+
+        char **slot = pending_slot(pending, path, len);
+        if (*slot) {
+            // Its parents are in already
+            break;
+        }
+
+        *slot = strndup(path, len);
+        if (!*slot) {
+            printf("failed allocating pending path table\n");
+            return -1;
+        }
+        pending->count++;
+
+        while (len > 0 && path[len - 1] != '/') len--;
+        if (len > 0) len--;
+    }
+
+    return 0;
+}
+
+static void pending_clear(struct PendingPaths *pending) {
+    for (size_t i = 0; i < pending->size && pending->count > 0; i++) {
+        if (pending->slots[i]) {
+            free(pending->slots[i]);
+            pending->slots[i] = NULL;
+            pending->count--;
+        }
+    }
+}
+
+// Lets every queued file land before an entry replaces or links to one of them
+static void wait_if_pending(struct ImportContext *ctx, const char *path) {
+    if (ctx->pending.count == 0 || !*pending_slot(&ctx->pending, path, strlen(path))) {
+        return;
+    }
+
+    workqueue_wait(&ctx->wq);
+    pending_clear(&ctx->pending);
+}
+
+static int import_regular_file(struct ImportContext *ctx, struct TarReader *r, struct TarEntry *entry,
+                               int dir_fd, const char *base, const struct FileMeta *meta) {
+    if (entry->size > IMAGE_INLINE_FILE_SIZE) {
+        int ret = import_large_file(ctx, r, dir_fd, base, entry->size, meta);
+        close(dir_fd);
+        return ret;
+    }
+
+    if (pending_add(&ctx->pending, entry->path) != 0) {
+        close(dir_fd);
+        return -1;
+    }
+
+    struct FileJob *job = calloc(1, sizeof(*job));
+    char *data = malloc(entry->size ? entry->size : 1);
+    char *name = strdup(base);
+
+    if (!job || !data || !name) {
+        printf("failed allocating import job\n");
+        goto fail;
+    }
+
+    if (reader_read(r, data, entry->size) != 0 || reader_skip_padding(r, entry->size) != 0) {
+        goto fail;
+    }
+
+    *job = (struct FileJob) {
+        .ctx = ctx, .dir_fd = dir_fd, .base = name, .data = data, .size = entry->size, .meta = *meta
+    };
+
+    // Blocks while the workers are a full budget behind the reader
+    if (workqueue_submit(&ctx->wq, file_job, job, entry->size) != 0) {
+        goto fail;
+    }
+
+    return 0;
+
+fail:
+    close(dir_fd);
+    free(job);
+    free(data);
+    free(name);
+    return -1;
+}
+
+static int record_dir(struct ImportContext *ctx, const char *path, const struct FileMeta *meta) {
+    struct DirMeta *dirs = realloc(ctx->dirs, (ctx->ndirs + 1) * sizeof(*dirs));
+    if (!dirs) {
+        printf("failed allocating directory list\n");
+        return -1;
+    }
+
+    ctx->dirs = dirs;
+    ctx->dirs[ctx->ndirs].path = strdup(path);
+    ctx->dirs[ctx->ndirs].meta = *meta;
+    ctx->ndirs++;
+
+    return 0;
+}
+
+// overlayfs whiteouts: ".wh.<name>" hides <name> of lower layers, ".wh..wh..opq" hides all
+// of the directory's lower contents
+static int import_whiteout(struct ImportContext *ctx, int dir_fd, const char *base) {
+    if (strcmp(base, ".wh..wh..opq") == 0) {
+        if (fsetxattr(dir_fd, "trusted.overlay.opaque", "y", 1, 0) == -1) {
+            printf("failed marking directory opaque: %s\n", strerror(errno));
+            return -1;
+        }
+    } else {
+        remove_existing(dir_fd, base + 4);
+        if (mknodat(dir_fd, base + 4, S_IFCHR, makedev(0, 0)) == -1) {
+            printf("failed creating whiteout for %s: %s\n", base + 4, strerror(errno));
+            return -1;
+        }
+    }
+
+    ctx->whiteouts++;
+    return 0;
+}
+
+// Links in archive order, so a later entry for the same path replaces the link and not the other way round
+static int import_hardlink(struct ImportContext *ctx, int link_fd, const char *link_base, struct TarEntry *entry) {
+    char *target_base;
+
+    int target_fd = open_parent(ctx->root_fd, entry->linkpath, &target_base);
+    if (target_fd == -1) return -1;
+
+    remove_existing(link_fd, link_base);
+    int ret = linkat(target_fd, target_base, link_fd, link_base, 0);
+    if (ret == -1) {
+        printf("failed creating hard link %s -> %s: %s\n", entry->path, entry->linkpath, strerror(errno));
+    } else {
+        ctx->nlinks++;
+    }
+
+    close(target_fd);
+    return ret;
+}
+
+static int import_entry(struct ImportContext *ctx, struct TarReader *r, struct TarEntry *entry) {
+    int is_file = entry->type == '0' || entry->type == '\0' || entry->type == '7';
+    struct FileMeta meta = {
+        .mode = entry->mode & 07777, .uid = entry->uid, .gid = entry->gid, .mtime = entry->mtime
+    };
+
+    if (clean_path(entry->path) != 0) {
+        printf("refusing path outside the image: %s\n", entry->path);
+        return -1;
+    }
+
+    // The archive root itself only carries the layer root's attributes
+    if (entry->path[0] == '\0') {
+        if (entry->type == '5' && record_dir(ctx, "", &meta) != 0) return -1;
+        return reader_read(r, NULL, entry->size) == 0 ? reader_skip_padding(r, entry->size) : -1;
+    }
+
+    // Last entry wins: whatever a worker still writes at this path has to land first. A
+    // whiteout replaces the name it hides, a hard link needs its target in place
+    char *slash = strrchr(entry->path, '/');
+    char *name = slash ? slash + 1 : entry->path;
+
+    if (strncmp(name, ".wh.", 4) == 0) {
+        char hidden[PATH_MAX];
+        snprintf(hidden, sizeof(hidden), "%.*s%s", (int)(name - entry->path), entry->path, name + 4);
+        wait_if_pending(ctx, hidden);
+    } else {
+        wait_if_pending(ctx, entry->path);
+    }
+
+    if (entry->type == '1') {
+        if (!entry->linkpath || clean_path(entry->linkpath) != 0 || entry->linkpath[0] == '\0') {
+            printf("invalid hard link target for %s\n", entry->path);
+            return -1;
+        }
+        wait_if_pending(ctx, entry->linkpath);
+    }
+
+    char *base;
+    int dir_fd = open_parent(ctx->root_fd, entry->path, &base);
+    if (dir_fd == -1) {
+        return -1;
+    }
+
+    if (strncmp(base, ".wh.", 4) == 0) {
+        int ret = import_whiteout(ctx, dir_fd, base);
+        close(dir_fd);
+        if (ret != 0) return -1;
+        return reader_read(r, NULL, entry->size) == 0 ? reader_skip_padding(r, entry->size) : -1;
+    }
+
+    if (is_file) {
+        // The worker owns dir_fd from here on
+        return import_regular_file(ctx, r, entry, dir_fd, base, &meta);
+    }
+
+    int ret = 0;
+
+    switch (entry->type) {
+        case '5': {
+            struct stat st;
+            if (fstatat(dir_fd, base, &st, AT_SYMLINK_NOFOLLOW) == 0 && !S_ISDIR(st.st_mode)) {
+                remove_existing(dir_fd, base);
+            }
+            if (mkdirat(dir_fd, base, 0755) == -1 && errno != EEXIST) {
+                printf("failed creating directory %s: %s\n", entry->path, strerror(errno));
+                ret = -1;
+            } else {
+                ret = record_dir(ctx, entry->path, &meta);
+            }
+            break;
+        }
+
+        case '1':
+            ret = import_hardlink(ctx, dir_fd, base, entry);
+            break;
+
+        case '2':
+            remove_existing(dir_fd, base);
+            if (symlinkat(entry->linkpath ? entry->linkpath : "", dir_fd, base) == -1 ||
+                fchownat(dir_fd, base, meta.uid, meta.gid, AT_SYMLINK_NOFOLLOW) == -1) {
+                printf("failed creating symlink %s: %s\n", entry->path, strerror(errno));
+                ret = -1;
+            }
+            break;
+
+        case '3':
+        case '4':
+        case '6': {
+            mode_t type = entry->type == '3' ? S_IFCHR : entry->type == '4' ? S_IFBLK : S_IFIFO;
+            dev_t dev = type == S_IFIFO ? 0 : makedev(entry->devmajor, entry->devminor);
+
+            remove_existing(dir_fd, base);
+            if (mknodat(dir_fd, base, type | meta.mode, dev) == -1 ||
+                fchownat(dir_fd, base, meta.uid, meta.gid, AT_SYMLINK_NOFOLLOW) == -1 ||
+                fchmodat(dir_fd, base, meta.mode, 0) == -1) {
+                printf("failed creating special file %s: %s\n", entry->path, strerror(errno));
+                ret = -1;
+            }
+            break;
+        }
+
+        default:
+            // Vendor extensions and sparse files are not supported; skip their data
+            break;
+    }
+
+    close(dir_fd);
+
+    if (ret != 0) {
+        return -1;
+    }
+
+    return reader_read(r, NULL, entry->size) == 0 ? reader_skip_padding(r, entry->size) : -1;
+}
+
+// Directory attributes go on last, once nothing is created inside them any more
+static int apply_dir_metadata(struct ImportContext *ctx) {
+    for (size_t i = 0; i < ctx->ndirs; i++) {
+        struct DirMeta *dir = &ctx->dirs[i];
+        int fd;
+
+        if (dir->path[0] == '\0') {
+            fd = openat(ctx->root_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+        } else {
+            char *base;
+            int parent_fd = open_parent(ctx->root_fd, dir->path, &base);
+            if (parent_fd == -1) return -1;
+
+            fd = openat(parent_fd, base, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+            close(parent_fd);
+        }
+
+        struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, { .tv_sec = dir->meta.mtime } };
+
+        if (fd == -1 || fchown(fd, dir->meta.uid, dir->meta.gid) == -1 ||
+            fchmod(fd, dir->meta.mode) == -1 || futimens(fd, times) == -1) {
+            printf("failed setting attributes of %s: %s\n", dir->path[0] ? dir->path : "/", strerror(errno));
+            if (fd != -1) close(fd);
+            return -1;
+        }
+
+        close(fd);
+    }
+
+    return 0;
+}
+
+static int header_checksum_ok(const char *header) {
+    unsigned long long expected;
+    unsigned long sum = 0;
+
+    if (parse_tar_number(header + 148, 8, &expected) != 0) {
+        return 0;
+    }
+
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        sum += (i >= 148 && i < 156) ? ' ' : (unsigned char)header[i];
+    }
+
+    return sum == expected;
+}
+
+static int is_zero_block(const char *block) {
+    for (int i = 0; i < TAR_BLOCK_SIZE; i++) {
+        if (block[i]) return 0;
+    }
+
+    return 1;
+}
+
+static int extract_archive(struct ImportContext *ctx, struct TarReader *r) {
+    char header[TAR_BLOCK_SIZE];
+
+    // Overrides from GNU long name/link records and PAX headers apply to the next entry only
+    struct TarEntry pending = { 0 };
+    int pending_size = 0;
+
+    for (;;) {
+        if (reader_read(r, header, TAR_BLOCK_SIZE) != 0) goto fail;
+
+        if (is_zero_block(header)) {
+            break;
+        }
+
+        if (!header_checksum_ok(header)) {
+            printf("corrupt header in image archive at offset %llu\n", r->total - (r->len - r->pos) - TAR_BLOCK_SIZE);
+            goto fail;
+        }
+
+        struct TarEntry entry = { .type = header[156] };
+
+        if (parse_tar_number(header + 100, 8, &entry.mode) != 0 ||
+            parse_tar_number(header + 108, 8, &entry.uid) != 0 ||
+            parse_tar_number(header + 116, 8, &entry.gid) != 0 ||
+            parse_tar_number(header + 124, 12, &entry.size) != 0 ||
+            parse_tar_number(header + 136, 12, &entry.mtime) != 0 ||
+            parse_tar_number(header + 329, 8, &entry.devmajor) != 0 ||
+            parse_tar_number(header + 337, 8, &entry.devminor) != 0) {
+            printf("invalid numeric field in image archive\n");
+            goto fail;
+        }
+
+        if (entry.type == 'L' || entry.type == 'K') {
+            char *s = read_tar_string(r, entry.size);
+            if (!s) goto fail;
+
+            char **slot = entry.type == 'L' ? &pending.path : &pending.linkpath;
+            free(*slot);
+            *slot = s;
+            continue;
+        }
+
+        if (entry.type == 'x') {
+            char *data = read_tar_string(r, entry.size);
+            if (!data) goto fail;
+
+            int ret = parse_pax(data, entry.size, &pending, &pending_size);
+            free(data);
+            if (ret != 0) goto fail;
+            continue;
+        }
+
+        if (entry.type == 'g') {
+            if (reader_read(r, NULL, entry.size) != 0 || reader_skip_padding(r, entry.size) != 0) goto fail;
+            continue;
+        }
+
+        if (pending.path) {
+            entry.path = pending.path;
+        } else if (memcmp(header + 257, "ustar", 5) == 0 && header[345] != '\0') {
+            char *prefix = dup_field(header + 345, 155);
+            char *name = dup_field(header, 100);
+            if (prefix && name && asprintf(&entry.path, "%s/%s", prefix, name) == -1) {
+                entry.path = NULL;
+            }
+            free(prefix);
+            free(name);
+        } else {
+            entry.path = dup_field(header, 100);
+        }
+
+        entry.linkpath = pending.linkpath ? pending.linkpath : dup_field(header + 157, 100);
+
+        if (pending_size) entry.size = pending.size;
+        if (pending.uid) entry.uid = pending.uid;
+        if (pending.gid) entry.gid = pending.gid;
+        if (pending.mtime) entry.mtime = pending.mtime;
+
+        pending = (struct TarEntry) { 0 };
+        pending_size = 0;
+
+        int ret = entry.path ? import_entry(ctx, r, &entry) : -1;
+
+        free(entry.path);
+        free(entry.linkpath);
+
+        if (ret != 0 || __atomic_load_n(&ctx->failed, __ATOMIC_RELAXED)) goto fail;
+    }
+
+    free(pending.path);
+    free(pending.linkpath);
+
+    // The layer id covers the whole stream, trailing blocks included
+    int n;
+    while ((n = reader_fill(r)) > 0) { }
+    return n;
+
+fail:
+    free(pending.path);
+    free(pending.linkpath);
+    return -1;
+}
+
+static int default_jobs(void) {
+    long n = sysconf(_SC_NPROCESSORS_ONLN);
+    return n > 0 ? (int)n : 1;
+}
+
+static double elapsed_seconds(const struct timespec *start) {
+    struct timespec now;
+    clock_gettime(CLOCK_MONOTONIC, &now);
+    return (now.tv_sec - start->tv_sec) + (now.tv_nsec - start->tv_nsec) / 1e9;
+}
+
+static int import_image(const char *archive, const char *name, const char *parent, int jobs) {
+    char layers[IMAGE_MAX_LAYERS][SHA256_HEX_SIZE];
+    int nlayers = 0;
+
+    if (!valid_image_name(name)) {
+        printf("Invalid image name: '%s'. Use letters, digits, '.', '_' and '-'.\n", name);
+        return -1;
+    }
+
+    if (parent) {
+        nlayers = read_image_layers(parent, layers, IMAGE_MAX_LAYERS);
+        if (nlayers < 0) return -1;
+
+        if (nlayers == IMAGE_MAX_LAYERS) {
+            printf("Image '%s' already has the maximum of %d layers\n", parent, IMAGE_MAX_LAYERS);
+            return -1;
+        }
+    }
+
+    if (ensure_dir(RUNBOX_IMAGE_DIR) != 0 || ensure_dir(IMAGE_BLOB_DIR) != 0 ||
+        ensure_dir(IMAGE_LAYER_DIR) != 0 || ensure_dir(IMAGE_NAME_DIR) != 0) {
+        return -1;
+    }
+
+    struct TarReader reader = { .fd = STDIN_FILENO };
+    if (strcmp(archive, "-") != 0) {
+        reader.fd = open(archive, O_RDONLY | O_CLOEXEC);
+        if (reader.fd == -1) {
+            printf("Error opening %s: %s\n", archive, strerror(errno));
+            return -1;
+        }
+        posix_fadvise(reader.fd, 0, 0, POSIX_FADV_SEQUENTIAL);
+    }
+
+    reader.buf = malloc(READ_CHUNK_SIZE);
+    sha256_init(&reader.hash);
+
+    int layers_fd = open(IMAGE_LAYER_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int blobs_fd = open(IMAGE_BLOB_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    char staging[64];
+    snprintf(staging, sizeof(staging), ".import-%d", getpid());
+
+    struct ImportContext ctx = { .root_fd = -1, .blobs_fd = blobs_fd };
+    int ret = -1;
+    int wq_started = 0;
+
+    if (!reader.buf || layers_fd == -1 || blobs_fd == -1) {
+        printf("failed preparing layer store: %s\n", strerror(errno));
+        goto out;
+    }
+
+    if (mkdirat(layers_fd, staging, 0755) == -1) {
+        printf("failed creating staging layer: %s\n", strerror(errno));
+        goto out;
+    }
+
+    ctx.root_fd = openat(layers_fd, staging, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (ctx.root_fd == -1) {
+        printf("failed opening staging layer: %s\n", strerror(errno));
+        goto out;
+    }
+
+    if (workqueue_init(&ctx.wq, jobs, IMAGE_MAX_PENDING_FILES, IMAGE_IMPORT_BUDGET) != 0) {
+        goto out;
+    }
+    wq_started = 1;
+
+    // Archive modes are applied exactly as recorded
+    umask(0);
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    int extracted = extract_archive(&ctx, &reader);
+
+    workqueue_wait(&ctx.wq);
+
+    if (extracted != 0 || ctx.failed || apply_dir_metadata(&ctx) != 0) {
+        printf("Import of '%s' failed\n", archive);
+        goto out;
+    }
+
+    char id[SHA256_HEX_SIZE];
+    sha256_final_hex(&reader.hash, id);
+
+    // Identical archives produce identical layers; keep the one already stored
+    int reused_layer = 0;
+    if (renameat(layers_fd, staging, layers_fd, id) == -1) {
+        if (errno != EEXIST && errno != ENOTEMPTY) {
+            printf("failed publishing layer %s: %s\n", id, strerror(errno));
+            goto out;
+        }
+        reused_layer = 1;
+    }
+
+    memcpy(layers[nlayers++], id, SHA256_HEX_SIZE);
+    if (write_image_layers(name, layers, nlayers) != 0) {
+        goto out;
+    }
+
+    double seconds = elapsed_seconds(&start);
+    double mib = reader.total / (1024.0 * 1024.0);
+
+    printf("Imported '%s': layer %.12s%s, %d layer%s\n", name, id, reused_layer ? " (already stored)" : "",
+           nlayers, nlayers == 1 ? "" : "s");
+    printf("  %lu files, %.1f MiB: %lu new blobs, %lu shared, %zu hard links, %lu whiteouts\n",
+           ctx.files, ctx.bytes / (1024.0 * 1024.0), ctx.blobs_new, ctx.blobs_reused,
+           ctx.nlinks, ctx.whiteouts);
+    printf("  %.1f MiB read in %.2fs (%.1f MiB/s, %d jobs)\n", mib, seconds,
+           seconds > 0 ? mib / seconds : 0, jobs);
+
+    ret = 0;
+
+out:
+    if (wq_started) {
+        workqueue_destroy(&ctx.wq);
+    }
+
+    if (ctx.root_fd != -1) {
+        close(ctx.root_fd);
+    }
+
+    // Only reached on failure or when an identical layer already existed
+    if (layers_fd != -1) {
+        remove_tree(layers_fd, staging);
+        close(layers_fd);
+    }
+
+    if (blobs_fd != -1) close(blobs_fd);
+    if (reader.fd != STDIN_FILENO) close(reader.fd);
+
+    for (size_t i = 0; i < ctx.ndirs; i++) free(ctx.dirs[i].path);
+    pending_clear(&ctx.pending);
+    free(ctx.dirs);
+    free(ctx.pending.slots);
+    free(reader.buf);
+
+    return ret;
+}
+
+/*
+ * Commit turns the writable area of a running sandbox (the overlay upper directory, or the
+ * root tmpfs of a host-root sandbox) into a layer on top of the image it was started from.
+ * The tree is walked in name order so the same contents always give the same layer id, and
+ * regular files go through the blob store like imported ones: whatever the store already
+ * holds, including every file the sandbox did not change, becomes a hard link to that blob.
+ */
+struct CommitContext {
+    struct ImportContext *ctx;
+    struct Sha256 id;        // Covers one record per entry, in walk order
+    dev_t dev;               // Entries on another device are mounts, not part of the area
+    char *buf;
+    unsigned long skipped;
+};
+
+static int compare_names(const void *a, const void *b) {
+    return strcmp(*(char *const *)a, *(char *const *)b);
+}
+
+// Entry names of a directory in strcmp order. Returns NULL on failure
+static char **sorted_entries(int dir_fd, size_t *count) {
+    int fd = openat(dir_fd, ".", O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    DIR *dir = fd == -1 ? NULL : fdopendir(fd);
+    if (!dir) {
+        printf("failed listing directory: %s\n", strerror(errno));
+        if (fd != -1) close(fd);
+        return NULL;
+    }
+
+    char **names = NULL;
+    size_t n = 0;
+    struct dirent *de;
+
+    while ((de = readdir(dir))) {
+        if (strcmp(de->d_name, ".") == 0 || strcmp(de->d_name, "..") == 0) continue;
+
+        char **grown = realloc(names, (n + 1) * sizeof(*names));
+        if (!grown || !(grown[n] = strdup(de->d_name))) {
+            printf("failed allocating directory listing\n");
+            names = grown ? grown : names;
+            for (size_t i = 0; i < n; i++) free(names[i]);
+            free(names);
+            closedir(dir);
+            return NULL;
+        }
+        names = grown;
+        n++;
+    }
+
+    closedir(dir);
+    qsort(names, n, sizeof(*names), compare_names);
+
+    *count = n;
+    return names ? names : calloc(1, sizeof(*names));
+}
+
+static void free_entries(char **names, size_t count) {
+    for (size_t i = 0; i < count; i++) free(names[i]);
+    free(names);
+}
+
+// Hashes the file and reads it again to store it, unless the blob store already has it
+static int commit_file(struct CommitContext *cc, int src_dir, int dst_dir, const char *name,
+                       const struct stat *st, char *hex) {
+    struct ImportContext *ctx = cc->ctx;
+    struct FileMeta meta = {
+        .mode = st->st_mode & 07777, .uid = st->st_uid, .gid = st->st_gid, .mtime = st->st_mtim.tv_sec
+    };
+    char blob[SHA256_HEX_SIZE + 64];
+    unsigned long long size = 0;
+    int created = 0;
+    ssize_t n;
+
+    int fd = openat(src_dir, name, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd == -1) {
+        printf("Error opening %s: %s\n", name, strerror(errno));
+        return -1;
+    }
+
+    struct Sha256 hash;
+    sha256_init(&hash);
+
+    while ((n = read(fd, cc->buf, READ_CHUNK_SIZE)) > 0) {
+        sha256_update(&hash, cc->buf, n);
+        size += n;
+    }
+
+    if (n == -1) {
+        printf("failed reading %s: %s\n", name, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    sha256_final_hex(&hash, hex);
+    blob_name(blob, sizeof(blob), hex, &meta);
+
+    if (faccessat(ctx->blobs_fd, blob, F_OK, AT_SYMLINK_NOFOLLOW) == -1) {
+        char tmp[64];
+        char copied[SHA256_HEX_SIZE];
+        int out = open_temp_blob(ctx, tmp, sizeof(tmp));
+        if (out == -1) {
+            close(fd);
+            return -1;
+        }
+
+        // The blob is named by the first pass, so the copy has to match it
+        sha256_init(&hash);
+        lseek(fd, 0, SEEK_SET);
+
+        while ((n = read(fd, cc->buf, READ_CHUNK_SIZE)) > 0) {
+            sha256_update(&hash, cc->buf, n);
+            if (write_all(out, cc->buf, n) != 0) break;
+        }
+        sha256_final_hex(&hash, copied);
+
+        if (n != 0 || strcmp(copied, hex) != 0) {
+            printf("failed storing %s: %s\n", name, n == 0 ? "file changed while committing" : strerror(errno));
+            close(out);
+            close(fd);
+            unlinkat(ctx->blobs_fd, tmp, 0);
+            return -1;
+        }
+
+        int ret = publish_blob(ctx, out, tmp, blob, &meta, &created);
+        close(out);
+        if (ret != 0) {
+            close(fd);
+            return -1;
+        }
+    }
+
+    close(fd);
+
+    if (link_blob(ctx, blob, dst_dir, name) != 0) {
+        return -1;
+    }
+
+    count_blob(ctx, created, size);
+    return 0;
+}
+
+// Directory attributes go on once the children are in place, like apply_dir_metadata
+static int commit_dir_attributes(int dst_fd, const struct stat *st, int opaque) {
+    struct timespec times[2] = { { .tv_nsec = UTIME_OMIT }, st->st_mtim };
+
+    if ((opaque && fsetxattr(dst_fd, "trusted.overlay.opaque", "y", 1, 0) == -1) ||
+        fchown(dst_fd, st->st_uid, st->st_gid) == -1 || fchmod(dst_fd, st->st_mode & 07777) == -1 ||
+        futimens(dst_fd, times) == -1) {
+        printf("failed setting directory attributes: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int is_opaque(int dir_fd) {
+    char value[4];
+    ssize_t n = fgetxattr(dir_fd, "trusted.overlay.opaque", value, sizeof(value));
+    return n == 1 && value[0] == 'y';
+}
+
+static void hash_commit_record(struct CommitContext *cc, const char *path, const struct stat *st,
+                               const char *detail) {
+    char record[2 * PATH_MAX + 96];
+    int n = snprintf(record, sizeof(record), "%o %u %u %s %s\n", st->st_mode, st->st_uid, st->st_gid,
+                     path, detail);
+    sha256_update(&cc->id, record, n < (int)sizeof(record) ? (size_t)n : sizeof(record) - 1);
+}
+
+static int commit_dir(struct CommitContext *cc, int src_fd, int dst_fd, const char *path);
+
+static int commit_entry(struct CommitContext *cc, int src_fd, int dst_fd, const char *parent, const char *name) {
+    struct ImportContext *ctx = cc->ctx;
+    char path[PATH_MAX];
+    char detail[PATH_MAX] = "";
+    struct stat st;
+
+    snprintf(path, sizeof(path), "%s%s%s", parent, parent[0] ? "/" : "", name);
+
+    if (fstatat(src_fd, name, &st, AT_SYMLINK_NOFOLLOW) == -1) {
+        printf("failed inspecting %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Volumes, the scratch /tmp and the host directories are mounted over the area
+    if (st.st_dev != cc->dev) {
+        cc->skipped++;
+        return 0;
+    }
+
+    if (S_ISREG(st.st_mode)) {
+        if (commit_file(cc, src_fd, dst_fd, name, &st, detail) != 0) {
+            return -1;
+        }
+    } else if (S_ISDIR(st.st_mode)) {
+        int child_src = openat(src_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child_src == -1 || mkdirat(dst_fd, name, 0700) == -1) {
+            printf("failed copying directory %s: %s\n", path, strerror(errno));
+            if (child_src != -1) close(child_src);
+            return -1;
+        }
+
+        int child_dst = openat(dst_fd, name, O_RDONLY | O_DIRECTORY | O_NOFOLLOW | O_CLOEXEC);
+        if (child_dst == -1) {
+            printf("failed opening %s: %s\n", path, strerror(errno));
+            close(child_src);
+            return -1;
+        }
+
+        int opaque = is_opaque(child_src);
+        snprintf(detail, sizeof(detail), "%s", opaque ? "opaque" : "");
+        hash_commit_record(cc, path, &st, detail);
+
+        int ret = commit_dir(cc, child_src, child_dst, path);
+        if (ret == 0) {
+            ret = commit_dir_attributes(child_dst, &st, opaque);
+        }
+
+        close(child_src);
+        close(child_dst);
+        return ret;
+    } else if (S_ISLNK(st.st_mode)) {
+        ssize_t len = readlinkat(src_fd, name, detail, sizeof(detail) - 1);
+        if (len == -1) {
+            printf("failed reading link %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        detail[len] = '\0';
+
+        if (symlinkat(detail, dst_fd, name) == -1 ||
+            fchownat(dst_fd, name, st.st_uid, st.st_gid, AT_SYMLINK_NOFOLLOW) == -1) {
+            printf("failed copying link %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    } else if (S_ISCHR(st.st_mode) && st.st_rdev == makedev(0, 0)) {
+        // overlayfs whiteout: the file was deleted from a lower layer
+        if (mknodat(dst_fd, name, S_IFCHR, makedev(0, 0)) == -1) {
+            printf("failed creating whiteout for %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        ctx->whiteouts++;
+    } else {
+        // Sockets, fifos and device nodes only mean something to the processes that made them
+        cc->skipped++;
+        return 0;
+    }
+
+    hash_commit_record(cc, path, &st, detail);
+    return 0;
+}
+
+static int commit_dir(struct CommitContext *cc, int src_fd, int dst_fd, const char *path) {
+    size_t count;
+    char **names = sorted_entries(src_fd, &count);
+    if (!names) {
+        return -1;
+    }
+
+    int ret = 0;
+    for (size_t i = 0; i < count && ret == 0; i++) {
+        ret = commit_entry(cc, src_fd, dst_fd, path, names[i]);
+    }
+
+    free_entries(names, count);
+    return ret;
+}
+
+// Stores the tree under source_fd as a new layer and records image `name` as `parent` plus it
+int image_commit(int source_fd, const char *name, const char *parent) {
+    char layers[IMAGE_MAX_LAYERS][SHA256_HEX_SIZE];
+    int nlayers = 0;
+    struct stat root;
+
+    if (!valid_image_name(name)) {
+        printf("Invalid image name: '%s'. Use letters, digits, '.', '_' and '-'.\n", name);
+        return -1;
+    }
+
+    if (parent) {
+        nlayers = read_image_layers(parent, layers, IMAGE_MAX_LAYERS);
+        if (nlayers < 0) return -1;
+
+        if (nlayers == IMAGE_MAX_LAYERS) {
+            printf("Image '%s' already has the maximum of %d layers\n", parent, IMAGE_MAX_LAYERS);
+            return -1;
+        }
+    }
+
+    if (fstat(source_fd, &root) == -1) {
+        printf("failed inspecting sandbox writable area: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (ensure_dir(RUNBOX_IMAGE_DIR) != 0 || ensure_dir(IMAGE_BLOB_DIR) != 0 ||
+        ensure_dir(IMAGE_LAYER_DIR) != 0 || ensure_dir(IMAGE_NAME_DIR) != 0) {
+        return -1;
+    }
+
+    int layers_fd = open(IMAGE_LAYER_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    int blobs_fd = open(IMAGE_BLOB_DIR, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+
+    char staging[64];
+    snprintf(staging, sizeof(staging), ".commit-%d", getpid());
+
+    struct ImportContext ctx = { .root_fd = -1, .blobs_fd = blobs_fd };
+    struct CommitContext cc = { .ctx = &ctx, .dev = root.st_dev, .buf = malloc(READ_CHUNK_SIZE) };
+    int ret = -1;
+
+    if (!cc.buf || layers_fd == -1 || blobs_fd == -1) {
+        printf("failed preparing layer store: %s\n", strerror(errno));
+        goto out;
+    }
+
+    if (mkdirat(layers_fd, staging, 0755) == -1) {
+        printf("failed creating staging layer: %s\n", strerror(errno));
+        goto out;
+    }
+
+    ctx.root_fd = openat(layers_fd, staging, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (ctx.root_fd == -1) {
+        printf("failed opening staging layer: %s\n", strerror(errno));
+        goto out;
+    }
+
+    struct timespec start;
+    clock_gettime(CLOCK_MONOTONIC, &start);
+
+    sha256_init(&cc.id);
+    hash_commit_record(&cc, "", &root, "");
+
+    if (commit_dir(&cc, source_fd, ctx.root_fd, "") != 0 ||
+        commit_dir_attributes(ctx.root_fd, &root, 0) != 0) {
+        printf("Commit of '%s' failed\n", name);
+        goto out;
+    }
+
+    char id[SHA256_HEX_SIZE];
+    sha256_final_hex(&cc.id, id);
+
+    // Committing the same contents twice keeps the layer already stored
+    int reused_layer = 0;
+    if (renameat(layers_fd, staging, layers_fd, id) == -1) {
+        if (errno != EEXIST && errno != ENOTEMPTY) {
+            printf("failed publishing layer %s: %s\n", id, strerror(errno));
+            goto out;
+        }
+        reused_layer = 1;
+    }
+
+    memcpy(layers[nlayers++], id, SHA256_HEX_SIZE);
+    if (write_image_layers(name, layers, nlayers) != 0) {
+        goto out;
+    }
+
+    printf("Committed '%s': layer %.12s%s, %d layer%s\n", name, id, reused_layer ? " (already stored)" : "",
+           nlayers, nlayers == 1 ? "" : "s");
+    printf("  %lu files, %.1f MiB: %lu new blobs, %lu shared, %lu whiteouts, %lu mounts and special files skipped\n",
+           ctx.files, ctx.bytes / (1024.0 * 1024.0), ctx.blobs_new, ctx.blobs_reused, ctx.whiteouts, cc.skipped);
+    printf("  done in %.2fs\n", elapsed_seconds(&start));
+
+    ret = 0;
+
+out:
+    if (ctx.root_fd != -1) {
+        close(ctx.root_fd);
+    }
+
+    // Only reached on failure or when an identical layer already existed
+    if (layers_fd != -1) {
+        remove_tree(layers_fd, staging);
+        close(layers_fd);
+    }
+
+    if (blobs_fd != -1) close(blobs_fd);
+    free(cc.buf);
+
+    return ret;
+}
+
+static int import_main(int argc, char **argv) {
+    const char *parent = NULL;
+    int jobs = default_jobs();
+
+    static struct option long_opts[] = {
+        {"parent", required_argument, 0, 1},
+        {"jobs",   required_argument, 0, 2},
+        {0, 0, 0, 0}
+    };
+
+    int opt;
+    while ((opt = getopt_long(argc, argv, "", long_opts, NULL)) != -1) {
+        switch (opt) {
+            case 1:
+                parent = optarg;
+                break;
+
+            case 2:
+                jobs = atoi(optarg);
+                if (jobs <= 0 || jobs > WORKQUEUE_MAX_THREADS) {
+                    fprintf(stderr, "Invalid value for --jobs: '%s'. Must be between 1 and %d.\n",
+                            optarg, WORKQUEUE_MAX_THREADS);
+                    return -1;
+                }
+                break;
+
+            default:
+                fprintf(stderr, "Usage: runbox image import [--parent=<image>] [--jobs=N] <tar|-> <name>\n");
+                return -1;
+        }
+    }
+
+    if (argc - optind != 2) {
+        fprintf(stderr, "Usage: runbox image import [--parent=<image>] [--jobs=N] <tar|-> <name>\n");
+        return -1;
+    }
+
+    return import_image(argv[optind], argv[optind + 1], parent, jobs);
+}
+
+int image_main(int argc, char **argv) {
+    if (argc > 1 && strcmp(argv[1], "import") == 0) {
+        return import_main(argc - 1, argv + 1);
+    }
+
+    fprintf(stderr, "Usage: runbox image import [options] <tar|-> <name>\n");
+    return -1;
+}
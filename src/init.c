@@ -0,0 +1,113 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/signalfd.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "init.h"
+
+// Signals the init passes on to the workload instead of acting on them itself
+static const int forwarded_signals[] = { SIGTERM, SIGINT, SIGHUP, SIGQUIT, SIGUSR1, SIGUSR2 };
+
+static int exit_code(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+
+    return WEXITSTATUS(status);
+}
+
+// Fallback when no signalfd is available: reap until the workload itself exits
+static int wait_for_workload(pid_t workload_pid) {
+    int status;
+    pid_t pid;
+
+    while ((pid = wait(&status)) != workload_pid) {
+        if (pid == -1 && errno != EINTR) {
+            printf("init: wait failed: %s\n", strerror(errno));
+            return 1;
+        }
+    }
+
+    return exit_code(status);
+}
+
+/*
+ * Runs as PID 1 of the sandbox: starts the workload as a child, reaps every
+ * orphan that gets reparented to us, forwards termination signals to the
+ * workload and returns its exit status once it is gone. Returning lets the
+ * caller exit, which makes the kernel kill whatever is left in the namespace.
+ */
+int run_init(int (*workload)(void *arg), void *arg) {
+    sigset_t mask, old_mask;
+
+    sigemptyset(&mask);
+    sigaddset(&mask, SIGCHLD);
+    for (size_t i = 0; i < sizeof(forwarded_signals) / sizeof(forwarded_signals[0]); i++) {
+        sigaddset(&mask, forwarded_signals[i]);
+    }
+
+    // Block before forking so neither a signal nor a child exit can slip past the signalfd. For
+    // PID 1 a blocked signal also counts as handled, so the kernel queues it instead of dropping it
+    if (sigprocmask(SIG_BLOCK, &mask, &old_mask) == -1) {
+        perror("init: sigprocmask");
+        return 1;
+    }
+
+    pid_t workload_pid = fork();
+
+    if (workload_pid == 0) {
+        // The signal mask survives exec, so hand the workload the mask we started with
+        sigprocmask(SIG_SETMASK, &old_mask, NULL);
+        exit(workload(arg));
+    } else if (workload_pid < 0) {
+        perror("init: fork failed");
+        return 1;
+    }
+
+    int sfd = signalfd(-1, &mask, SFD_CLOEXEC);
+    if (sfd == -1) {
+        printf("init: signalfd failed, signals will not be forwarded: %s\n", strerror(errno));
+        return wait_for_workload(workload_pid);
+    }
+
+    int workload_status = 1;
+    int workload_exited = 0;
+
+    while (!workload_exited) {
+        struct signalfd_siginfo info;
+        ssize_t n = read(sfd, &info, sizeof(info));
+
+        if (n != sizeof(info)) {
+            if (n == -1 && errno == EINTR) continue;
+            printf("init: reading signalfd failed: %s\n", strerror(errno));
+            close(sfd);
+            return wait_for_workload(workload_pid);
+        }
+
+        if (info.ssi_signo != SIGCHLD) {
+            if (kill(workload_pid, (int)info.ssi_signo) == -1 && errno != ESRCH) {
+                printf("init: failed forwarding signal %u: %s\n", info.ssi_signo, strerror(errno));
+            }
+            continue;
+        }
+
+        // SIGCHLD is not queued per child, so one notification may cover several exits
+        int status;
+        pid_t pid;
+        while ((pid = waitpid(-1, &status, WNOHANG)) > 0) {
+            if (pid == workload_pid) {
+                workload_status = exit_code(status);
+                workload_exited = 1;
+            }
+        }
+    }
+
+    close(sfd);
+    return workload_status;
+}
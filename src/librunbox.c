@@ -0,0 +1,301 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "runbox.h"
+#include "supervisor.h"
+#include "librunbox.h"
+
+#define LAUNCHER_KEPT_FDS 4
+
+/**
+ * runbox_handle - One sandbox started by runbox_spawn().
+ *
+ * Fields:
+ *   pid       - The launcher, which sets up and supervises the sandbox.
+ *   pidfd     - pidfd of the launcher, readable once it has exited.
+ *   report_fd - The launcher writes one runbox_report here just before it exits.
+ *   reaped    - The launcher has been waited for and `report` is final.
+ */
+struct runbox_handle {
+    pid_t pid;
+    int pidfd;
+    int report_fd;
+    int reaped;
+    struct runbox_report report;
+};
+
+void runbox_spec_init(struct runbox_spec *spec) {
+    *spec = (struct runbox_spec) {
+        .argv = NULL,
+        .memory = NULL,
+        .cpus = 0,
+        .pids = 0,
+        .timeout = 0,
+        .cpu_time = 0,
+        .enable_network = 0,
+        .disable_cgroups = 0,
+        .netns_pool = 0,
+        .image = NULL,
+        .tenant = NULL,
+        .stdio_fds = { -1, -1, -1 },
+    };
+}
+
+static int validate_spec(const struct runbox_spec *spec) {
+    if (!spec->argv || !spec->argv[0]) {
+        printf("runbox_spawn: no command given\n");
+        return -1;
+    }
+
+    if (spec->cpus < 0 || spec->pids < 0 || spec->timeout < 0 || spec->cpu_time < 0) {
+        printf("runbox_spawn: limits cannot be negative\n");
+        return -1;
+    }
+
+    if (spec->tenant && validate_tenant_name(spec->tenant) != 0) {
+        printf("runbox_spawn: invalid tenant name '%s'\n", spec->tenant);
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * The launcher inherits whatever the embedding process had open: its sockets and the
+ * pipes and pidfds of every other handle. Closing all of it keeps those out of the
+ * sandbox and keeps thousands of launchers from each pinning everyone else's pipes.
+ */
+static void close_inherited_fds(int *keep, int count) {
+    unsigned int next = 3;
+
+    // Insertion sort, there are at most LAUNCHER_KEPT_FDS of them
+    for (int i = 1; i < count; i++) {
+        for (int j = i; j > 0 && keep[j] < keep[j - 1]; j--) {
+            int fd = keep[j];
+            keep[j] = keep[j - 1];
+            keep[j - 1] = fd;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (keep[i] < (int)next) {
+            continue;
+        }
+
+        if (keep[i] > (int)next) {
+            close_range(next, keep[i] - 1, 0);
+        }
+        next = keep[i] + 1;
+    }
+
+    close_range(next, ~0U, 0);
+}
+
+// The embedding process may block or handle signals the sandbox relies on (SIGCHLD above all)
+static void reset_signals(void) {
+    sigset_t none;
+
+    sigemptyset(&none);
+    sigprocmask(SIG_SETMASK, &none, NULL);
+
+    for (int sig = 1; sig < NSIG; sig++) {
+        signal(sig, SIG_DFL);
+    }
+}
+
+static enum runbox_limit report_limit(enum LimitKind limit) {
+    switch (limit) {
+        case LIMIT_TIMEOUT:
+            return RUNBOX_LIMIT_TIMEOUT;
+        case LIMIT_CPU_TIME:
+            return RUNBOX_LIMIT_CPU_TIME;
+        default:
+            return RUNBOX_LIMIT_NONE;
+    }
+}
+
+// Runs in the forked launcher: the same setup and supervision as the CLI, minus option parsing
+static void run_launcher(const struct runbox_spec *spec, int report_fd) {
+    struct Config config;
+    struct CgroupLimits limits;
+    struct ExitReport exit_report = { .limit = LIMIT_NONE, .cpu_seconds = -1 };
+
+    default_config(&config, &limits);
+
+    config.command = (char **)spec->argv;
+    config.timeout = spec->timeout;
+    config.cpu_time = spec->cpu_time;
+    config.enable_network = spec->enable_network;
+    config.disable_cgroups = spec->disable_cgroups;
+    config.netns_pool = spec->netns_pool;
+    config.image = spec->image;
+    config.tenant = spec->tenant;
+    config.exit_report = &exit_report;
+
+    for (int fd = 0; fd < 3; fd++) {
+        config.stdio_fds[fd] = spec->stdio_fds[fd];
+    }
+
+    if (spec->memory) {
+        limits.memory_max = (char *)spec->memory;
+    }
+
+    if (spec->cpus > 0) {
+        limits.cpus = spec->cpus;
+    }
+
+    if (spec->pids > 0) {
+        limits.pids_max = spec->pids;
+    }
+
+    pid_t self = getpid();
+    int status = setup_sandbox(&config, &limits);
+
+    // setup_sandbox() also returns in the forked namespace child, which has nothing to report
+    if (getpid() != self) {
+        _exit(status & 0xff);
+    }
+
+    struct runbox_report report = {
+        .status = status,
+        .limit = report_limit(exit_report.limit),
+        .wall_seconds = exit_report.wall_seconds,
+        .cpu_seconds = exit_report.cpu_seconds,
+    };
+
+    // Far below PIPE_BUF, so this never blocks and never arrives in pieces
+    if (write(report_fd, &report, sizeof(report)) != sizeof(report)) {
+        perror("write report");
+    }
+
+    _exit(status & 0xff);
+}
+
+/*
+ * Starts a sandbox and returns without waiting for it. On success *handle must be
+ * released with runbox_release() once the sandbox is done.
+ */
+int runbox_spawn(const struct runbox_spec *spec, struct runbox_handle **handle) {
+    int fds[2];
+
+    *handle = NULL;
+
+    if (validate_spec(spec) != 0) {
+        return -1;
+    }
+
+    struct runbox_handle *h = calloc(1, sizeof(*h));
+    if (!h) {
+        perror("calloc");
+        return -1;
+    }
+
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        perror("pipe");
+        free(h);
+        return -1;
+    }
+
+    // Anything still buffered would be printed again by the launcher
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        int keep[LAUNCHER_KEPT_FDS] = { fds[1], spec->stdio_fds[0], spec->stdio_fds[1], spec->stdio_fds[2] };
+
+        close_inherited_fds(keep, LAUNCHER_KEPT_FDS);
+        reset_signals();
+        run_launcher(spec, fds[1]);
+    } else if (pid < 0) {
+        perror("fork failed");
+        close(fds[0]);
+        close(fds[1]);
+        free(h);
+        return -1;
+    }
+
+    close(fds[1]);
+
+    h->pid = pid;
+    h->report_fd = fds[0];
+    h->pidfd = (int)syscall(SYS_pidfd_open, pid, 0);
+
+    // The pid cannot be reused before we reap it, but without a pidfd there is nothing to poll
+    if (h->pidfd == -1) {
+        printf("pidfd_open failed for launcher %d: %s\n", pid, strerror(errno));
+        kill(pid, SIGKILL);
+        waitpid(pid, NULL, 0);
+        close(fds[0]);
+        free(h);
+        return -1;
+    }
+
+    *handle = h;
+    return 0;
+}
+
+// Becomes readable (POLLIN) once the sandbox has exited and its report is ready
+int runbox_handle_fd(const struct runbox_handle *handle) {
+    return handle->pidfd;
+}
+
+pid_t runbox_handle_pid(const struct runbox_handle *handle) {
+    return handle->pid;
+}
+
+/*
+ * Fetches the result, waiting for the sandbox if it is still running. Call it once the
+ * handle's fd is readable to never block.
+ */
+int runbox_report(struct runbox_handle *handle, struct runbox_report *report) {
+    if (!handle->reaped) {
+        ssize_t n;
+        siginfo_t info;
+
+        while ((n = read(handle->report_fd, &handle->report, sizeof(handle->report))) == -1 && errno == EINTR) {
+        }
+
+        // ECHILD: the embedding process ignores SIGCHLD, so the kernel reaped it already
+        while (waitid(P_PIDFD, handle->pidfd, &info, WEXITED) == -1 && errno != ECHILD) {
+            if (errno != EINTR) {
+                printf("waitid failed for launcher %d: %s\n", handle->pid, strerror(errno));
+                return -1;
+            }
+        }
+
+        // The launcher died before it could report
+        if (n != sizeof(handle->report)) {
+            handle->report = (struct runbox_report) { .status = -1, .limit = RUNBOX_LIMIT_NONE, .cpu_seconds = -1 };
+        }
+
+        handle->reaped = 1;
+    }
+
+    *report = handle->report;
+    return 0;
+}
+
+// Waits for the sandbox if it is still running, then frees the handle
+void runbox_release(struct runbox_handle *handle) {
+    struct runbox_report report;
+
+    if (!handle) {
+        return;
+    }
+
+    runbox_report(handle, &report);
+
+    close(handle->report_fd);
+    close(handle->pidfd);
+    free(handle);
+}
@@ -0,0 +1,147 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/socket.h>
+#include <netdb.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "listen.h"
+
+int parse_listen(char *arg, struct ListenSpec *spec) {
+    char *sep = strchr(arg, ':');
+    char *port_sep = strrchr(arg, ':');
+
+    if (!sep || sep == port_sep || port_sep[1] == '\0') {
+        return -1;
+    }
+
+    *sep = '\0';
+    *port_sep = '\0';
+    spec->proto = arg;
+    spec->host = sep + 1;
+    spec->port = port_sep + 1;
+    spec->fd = -1;
+
+    if (strcmp(spec->proto, "tcp") != 0 && strcmp(spec->proto, "udp") != 0) {
+        return -1;
+    }
+
+    // [::1] -> ::1
+    size_t len = strlen(spec->host);
+    if (len >= 2 && spec->host[0] == '[' && spec->host[len - 1] == ']') {
+        sep[len] = '\0';
+        spec->host = sep + 2;
+    }
+
+    return 0;
+}
+
+static int open_listener(struct ListenSpec *spec) {
+    struct addrinfo hints = {
+        .ai_family = AF_UNSPEC,
+        .ai_socktype = strcmp(spec->proto, "udp") == 0 ? SOCK_DGRAM : SOCK_STREAM,
+        .ai_flags = AI_PASSIVE | AI_NUMERICHOST,
+    };
+    struct addrinfo *res;
+
+    int err = getaddrinfo(spec->host[0] ? spec->host : NULL, spec->port, &hints, &res);
+    if (err == EAI_NONAME) {
+        // Not a numeric address; resolving names is fine since we are still on the host
+        hints.ai_flags = AI_PASSIVE;
+        err = getaddrinfo(spec->host[0] ? spec->host : NULL, spec->port, &hints, &res);
+    }
+    if (err != 0) {
+        printf("failed resolving %s:%s: %s\n", spec->host, spec->port, gai_strerror(err));
+        return -1;
+    }
+
+    // With no host, AI_PASSIVE lists the IPv4 wildcard first, matching 0.0.0.0
+    int fd = socket(res->ai_family, res->ai_socktype | SOCK_CLOEXEC, res->ai_protocol);
+    if (fd == -1) {
+        printf("failed creating %s socket: %s\n", spec->proto, strerror(errno));
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    int one = 1;
+    setsockopt(fd, SOL_SOCKET, SO_REUSEADDR, &one, sizeof(one));
+
+    if (bind(fd, res->ai_addr, res->ai_addrlen) == -1) {
+        printf("failed binding %s:%s:%s: %s\n", spec->proto, spec->host, spec->port, strerror(errno));
+        close(fd);
+        freeaddrinfo(res);
+        return -1;
+    }
+
+    freeaddrinfo(res);
+
+    if (hints.ai_socktype == SOCK_STREAM && listen(fd, SOMAXCONN) == -1) {
+        printf("failed listening on %s:%s: %s\n", spec->host, spec->port, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    spec->fd = fd;
+    return 0;
+}
+
+/*
+ * Binds every --listen socket in the host network namespace. The launcher keeps them open
+ * for its whole lifetime, so clients queue in the backlog while the sandbox restarts.
+ */
+int open_listeners(struct ListenSpec *specs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (open_listener(&specs[i]) != 0) {
+            close_listeners(specs, i);
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+void close_listeners(struct ListenSpec *specs, int count) {
+    for (int i = 0; i < count; i++) {
+        if (specs[i].fd != -1) {
+            close(specs[i].fd);
+            specs[i].fd = -1;
+        }
+    }
+}
+
+/*
+ * Runs in the workload process right before exec: moves the sockets to fds 3.. and sets
+ * LISTEN_FDS/LISTEN_PID, the socket activation protocol of sd_listen_fds().
+ */
+int pass_listeners(const struct ListenSpec *specs, int count) {
+    int moved[MAX_LISTEN];
+    char value[32];
+
+    // Park them above the target range first so no dup2() overwrites a socket not yet moved
+    for (int i = 0; i < count; i++) {
+        moved[i] = fcntl(specs[i].fd, F_DUPFD_CLOEXEC, LISTEN_FDS_START + count);
+        if (moved[i] == -1) {
+            printf("failed passing listen socket: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        if (dup2(moved[i], LISTEN_FDS_START + i) == -1) {
+            printf("failed passing listen socket: %s\n", strerror(errno));
+            return -1;
+        }
+        close(moved[i]);
+    }
+
+    snprintf(value, sizeof(value), "%d", count);
+    setenv("LISTEN_FDS", value, 1);
+    snprintf(value, sizeof(value), "%d", getpid());
+    setenv("LISTEN_PID", value, 1);
+
+    return 0;
+}
@@ -5,73 +5,484 @@
 #include <string.h>
 #include "cgroup.h"
 #include "runbox.h"
+#include "bench.h"
+#include "image.h"
+#include "pipeline.h"
+#include "netpool.h"
 
-int main(int argc, char **argv) {
+static int parse_seconds(const char *name, const char *arg, double *out) {
+    char *end;
+    double val = strtod(arg, &end);
+
+    if (end == arg || *end != '\0' || val <= 0) {
+        fprintf(stderr, "Invalid value for --%s: '%s'. Must be a positive number of seconds.\n", name, arg);
+        return -1;
+    }
+
+    *out = val;
+    return 0;
+}
+
+static int parse_cpu(const char *arg, struct CgroupLimits *limits) {
+    double val = atof(arg);
+    if (val <= 0) {
+        fprintf(stderr, "Invalid value for --cpu: '%s'. Must be a positive number.\n", arg);
+        return -1;
+    }
+
+    limits->cpu_enabled = 1;
+    limits->cpus = val;
+    return 0;
+}
 
-    struct Config config = {
-        .enable_network = 0,
-        .disable_cgroups = 0
+static int parse_pids(const char *arg, struct CgroupLimits *limits) {
+    if (strcmp(arg, "max") == 0) {
+        limits->pids_max = PIDS_MAX_ALIAS;
+    } else {
+        int ret = atoi(arg);
+        if (ret <= 0) {
+            fprintf(stderr, "Invalid value for --pids: '%s'. Must be a positive number.\n", arg);
+            return -1;
+        }
+        limits->pids_max = ret;
+    }
+
+    limits->pids_enabled = 1;
+    return 0;
+}
+
+static int update_main(int argc, char **argv) {
+    // runbox update <id> [--memory=<size>] [--cpu=<n>] [--pids=<n>]
+    struct CgroupLimits limits = { 0 };
+
+    static struct option update_opts[] = {
+        {"memory", required_argument, 0, 'm'},
+        {"cpu",    required_argument, 0, 'c'},
+        {"pids",   required_argument, 0, 'p'},
+        {0, 0, 0, 0}
     };
 
-    struct CgroupLimits limits = {
-        .memory_enabled = 1,
-        .memory_max = "max",
-        .cpu_enabled = 1,
-        .cpus = 0,
-        .pids_enabled = 1,
-        .pids_max = MAX_CPU_LIMIT
+    if (argc < 3 || argv[1][0] == '-') {
+        fprintf(stderr, "Usage: runbox update <id> [--memory=<size>] [--cpu=<n>] [--pids=<n>]\n");
+        return -1;
+    }
+
+    int opt;
+    optind = 2;
+
+    while ((opt = getopt_long(argc, argv, "", update_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'm':
+                limits.memory_enabled = 1;
+                limits.memory_max = optarg;
+                break;
+
+            case 'c':
+                if (parse_cpu(optarg, &limits) != 0) {
+                    return -1;
+                }
+                break;
+
+            case 'p':
+                if (parse_pids(optarg, &limits) != 0) {
+                    return -1;
+                }
+                break;
+
+            default:
+                fprintf(stderr, "Unknown option.\n");
+                return -1;
+        }
+    }
+
+    return update_sandbox(argv[1], &limits);
+}
+
+static int tenant_main(int argc, char **argv) {
+    // runbox tenant set <name> [--cpu-weight=<n>] [--cpu=<n>] [--memory=<size>] [--pids=<n>]
+    // runbox tenant remove <name>
+    struct CgroupLimits limits = { 0 };
+
+    static struct option tenant_opts[] = {
+        {"cpu-weight", required_argument, 0, 'w'},
+        {"memory",     required_argument, 0, 'm'},
+        {"cpu",        required_argument, 0, 'c'},
+        {"pids",       required_argument, 0, 'p'},
+        {0, 0, 0, 0}
     };
 
+    if (argc == 3 && strcmp(argv[1], "remove") == 0) {
+        return validate_tenant_name(argv[2]) == 0 ? remove_tenant(argv[2]) : -1;
+    }
+
+    if (argc < 4 || strcmp(argv[1], "set") != 0 || validate_tenant_name(argv[2]) != 0) {
+        fprintf(stderr, "Usage: runbox tenant set <name> [--cpu-weight=<n>] [--cpu=<n>] [--memory=<size>] [--pids=<n>]\n"
+                        "       runbox tenant remove <name>\n");
+        return -1;
+    }
+
+    int opt;
+    optind = 3;
+
+    while ((opt = getopt_long(argc, argv, "", tenant_opts, NULL)) != -1) {
+        switch (opt) {
+            case 'w':
+                limits.cpu_weight = atoi(optarg);
+                if (limits.cpu_weight < CPU_WEIGHT_MIN || limits.cpu_weight > CPU_WEIGHT_MAX) {
+                    fprintf(stderr, "Invalid value for --cpu-weight: '%s'. Must be between %d and %d.\n", optarg,
+                            CPU_WEIGHT_MIN, CPU_WEIGHT_MAX);
+                    return -1;
+                }
+                break;
+
+            case 'm':
+                limits.memory_enabled = 1;
+                limits.memory_max = optarg;
+                break;
+
+            case 'c':
+                if (parse_cpu(optarg, &limits) != 0) {
+                    return -1;
+                }
+                break;
+
+            case 'p':
+                if (parse_pids(optarg, &limits) != 0) {
+                    return -1;
+                }
+                break;
+
+            default:
+                fprintf(stderr, "Unknown option.\n");
+                return -1;
+        }
+    }
+
+    return set_tenant_limits(argv[2], &limits);
+}
+
+static int netns_pool_main(int argc, char **argv) {
+    // runbox netns-pool fill <n>
+    // runbox netns-pool drain
+    // runbox netns-pool status
+    if (argc == 3 && strcmp(argv[1], "fill") == 0) {
+        char *end;
+        long size = strtol(argv[2], &end, 10);
+
+        if (*end != '\0' || size < 0 || size > NETNS_POOL_MAX) {
+            fprintf(stderr, "Invalid pool size: '%s'. Must be between 0 and %d.\n", argv[2], NETNS_POOL_MAX);
+            return -1;
+        }
+
+        return netns_pool_fill((int)size);
+    }
+
+    if (argc == 2 && strcmp(argv[1], "drain") == 0) {
+        return netns_pool_drain();
+    }
+
+    if (argc == 2 && strcmp(argv[1], "status") == 0) {
+        int count = netns_pool_count();
+        if (count < 0) {
+            return -1;
+        }
+
+        printf("%d\n", count);
+        return 0;
+    }
+
+    fprintf(stderr, "Usage: runbox netns-pool fill <n>|drain|status\n");
+    return -1;
+}
+
+static int commit_main(int argc, char **argv) {
+    // runbox commit <id> <name>
+    if (argc != 3) {
+        fprintf(stderr, "Usage: runbox commit <id> <name>\n");
+        return -1;
+    }
+
+    return commit_sandbox(argv[1], argv[2]);
+}
+
+static int exec_main(int argc, char **argv) {
+    // runbox exec <id> [--] [cmd args...]
+    if (argc < 2) {
+        fprintf(stderr, "Usage: runbox exec <id> [-- cmd args...]\n");
+        return -1;
+    }
+
+    char **command = &argv[2];
+    if (command[0] && strcmp(command[0], "--") == 0) {
+        command++;
+    }
+
+    return exec_in_sandbox(argv[1], command[0] ? command : NULL);
+}
+
+// Parses the options of a sandbox run; the first non-option starts the command
+static int parse_run_options(int argc, char **argv, struct Config *config, struct CgroupLimits *limits) {
     static struct option long_opts[] = {
         {"enable-network",  no_argument,       0, 1},
         {"memory",          required_argument, 0, 2},
         {"cpu",             required_argument, 0, 3},
         {"pids",            required_argument, 0, 4},
         {"disable-cgroups", no_argument,       0, 5},
+        {"timeout",         required_argument, 0, 6},
+        {"cpu-time",        required_argument, 0, 7},
+        {"kill-grace",      required_argument, 0, 8},
+        {"report",          no_argument,       0, 9},
+        {"autotune-cpu",    required_argument, 0, 10},
+        {"autotune-memory", required_argument, 0, 11},
+        {"trace",           required_argument, 0, 12},
+        {"no-init",         no_argument,       0, 13},
+        {"image",           required_argument, 0, 14},
+        {"admission",       required_argument, 0, 15},
+        {"export",          required_argument, 0, 16},
+        {"volume",          required_argument, 0, 17},
+        {"memory-merge",    no_argument,       0, 18},
+        {"memory-reclaim",  required_argument, 0, 19},
+        {"shared-data",     required_argument, 0, 20},
+        {"listen",          required_argument, 0, 21},
+        {"restart",         required_argument, 0, 22},
+        {"minimal-root",    no_argument,       0, 23},
+        {"cache",           no_argument,       0, 24},
+        {"input",           required_argument, 0, 25},
+        {"cache-size",      required_argument, 0, 26},
+        {"perf-counters",   no_argument,       0, 27},
+        {"pod",             required_argument, 0, 28},
+        {"base",            required_argument, 0, 29},
+        {"prefetch",        optional_argument, 0, 30},
+        {"tenant",          required_argument, 0, 31},
+        {"netns-pool",      no_argument,       0, 32},
         {0, 0, 0, 0}
     };
 
     int opt;
     int long_index = 0;
 
-    while ((opt = getopt_long(argc, argv, "", long_opts, &long_index)) != -1) {
+    // Stop at the first non-option so the sandboxed command keeps its own flags
+    while ((opt = getopt_long(argc, argv, "+", long_opts, &long_index)) != -1) {
         switch (opt) {
             case 1:
-                config.enable_network = 1;
+                config->enable_network = 1;
                 break;
 
             case 2:
-                limits.memory_enabled = 1;
-                limits.memory_max = optarg;
+                limits->memory_enabled = 1;
+                limits->memory_max = optarg;
                 break;
 
             case 3:
-                limits.cpu_enabled = 1;
-                double val = atof(optarg);
-                if (val <= 0) {
-                    fprintf(stderr, "Invalid value for --cpu: '%s'. Must be a positive number.\n", optarg);
+                if (parse_cpu(optarg, limits) != 0) {
                     return -1;
                 }
-                limits.cpus = val;
                 break;
 
             case 4:
-                limits.pids_enabled = 1;
+                if (parse_pids(optarg, limits) != 0) {
+                    return -1;
+                }
+                break;
+
+            case 5:
+                config->disable_cgroups = 1;
+                break;
+
+            case 6:
+                if (parse_seconds("timeout", optarg, &config->timeout) != 0) {
+                    return -1;
+                }
+                break;
+
+            case 7:
+                if (parse_seconds("cpu-time", optarg, &config->cpu_time) != 0) {
+                    return -1;
+                }
+                break;
+
+            case 8:
+                if (parse_seconds("kill-grace", optarg, &config->kill_grace) != 0) {
+                    return -1;
+                }
+                break;
+
+            case 9:
+                config->report = 1;
+                break;
+
+            case 10:
+                if (parse_autotune_cpu(optarg, &config->autotune) != 0) {
+                    fprintf(stderr, "Invalid value for --autotune-cpu: '%s'. Expected <min>:<max> CPUs.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 11:
+                if (parse_autotune_memory(optarg, &config->autotune) != 0) {
+                    fprintf(stderr, "Invalid value for --autotune-memory: '%s'. Expected <min>:<max>, e.g. 128M:1G.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 12:
+                config->trace_file = optarg;
+                break;
+
+            case 13:
+                config->no_init = 1;
+                break;
+
+            case 14:
+                config->image = optarg;
+                break;
 
-                if (strcmp(optarg, "max") == 0) {
-                    limits.pids_max = PIDS_MAX_ALIAS;
+            case 15:
+                if (strcmp(optarg, "wait") == 0) {
+                    config->admission = ADMISSION_WAIT;
+                } else if (strcmp(optarg, "fail") == 0) {
+                    config->admission = ADMISSION_FAIL;
                 } else {
-                    int ret = atoi(optarg);
-                    if (ret <= 0) {
-                        fprintf(stderr, "Invalid value for --pids: '%s'. Must be a positive number.\n", optarg);
+                    fprintf(stderr, "Invalid value for --admission: '%s'. Must be 'wait' or 'fail'.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 16:
+                if (config->export_count == MAX_EXPORTS) {
+                    fprintf(stderr, "Too many --export paths (at most %d).\n", MAX_EXPORTS);
+                    return -1;
+                }
+                if (parse_export(optarg, &config->exports[config->export_count]) != 0) {
+                    fprintf(stderr, "Invalid value for --export: '%s'. Expected <sandbox_path>:<host_dir>.\n", optarg);
+                    return -1;
+                }
+                config->export_count++;
+                break;
+
+            case 17:
+                if (config->volume_count == MAX_VOLUMES) {
+                    fprintf(stderr, "Too many --volume mounts (at most %d).\n", MAX_VOLUMES);
+                    return -1;
+                }
+                if (parse_volume(optarg, &config->volumes[config->volume_count]) != 0) {
+                    fprintf(stderr, "Invalid value for --volume: '%s'. Expected <host>:<sandbox>[:ro|rw].\n", optarg);
+                    return -1;
+                }
+                config->volume_count++;
+                break;
+
+            case 18:
+                config->memory_merge = 1;
+                break;
+
+            case 19: {
+                char *end;
+                config->memory_reclaim = strtod(optarg, &end);
+                if (*end != '\0' || end == optarg || config->memory_reclaim <= 0 || config->memory_reclaim >= 1) {
+                    fprintf(stderr, "Invalid value for --memory-reclaim: '%s'. Must be an idle ratio between 0 and 1.\n", optarg);
+                    return -1;
+                }
+                break;
+            }
+
+            case 20:
+                if (config->shared_count == MAX_SHARED_DATA) {
+                    fprintf(stderr, "Too many --shared-data files (at most %d).\n", MAX_SHARED_DATA);
+                    return -1;
+                }
+                if (parse_shared_data(optarg, &config->shared[config->shared_count]) != 0) {
+                    fprintf(stderr, "Invalid value for --shared-data: '%s'. Expected <name>=<file>[:huge].\n", optarg);
+                    return -1;
+                }
+                config->shared_count++;
+                break;
+
+            case 21:
+                if (config->listen_count == MAX_LISTEN) {
+                    fprintf(stderr, "Too many --listen sockets (at most %d).\n", MAX_LISTEN);
+                    return -1;
+                }
+                if (parse_listen(optarg, &config->listeners[config->listen_count]) != 0) {
+                    fprintf(stderr, "Invalid value for --listen: '%s'. Expected tcp|udp:<host>:<port>.\n", optarg);
+                    return -1;
+                }
+                config->listen_count++;
+                break;
+
+            case 22:
+                if (strcmp(optarg, "no") == 0) {
+                    config->restart = RESTART_NO;
+                } else if (strcmp(optarg, "on-failure") == 0) {
+                    config->restart = RESTART_ON_FAILURE;
+                } else if (strcmp(optarg, "always") == 0) {
+                    config->restart = RESTART_ALWAYS;
+                } else {
+                    fprintf(stderr, "Invalid value for --restart: '%s'. Must be 'no', 'on-failure' or 'always'.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 23:
+                config->minimal_root = 1;
+                break;
+
+            case 24:
+                config->cache = 1;
+                break;
+
+            case 25:
+                if (config->input_count == MAX_CACHE_INPUTS) {
+                    fprintf(stderr, "Too many --input paths (at most %d).\n", MAX_CACHE_INPUTS);
+                    return -1;
+                }
+                config->inputs[config->input_count++] = optarg;
+                break;
+
+            case 26:
+                if (parse_memory_bytes(optarg, &config->cache_size) != 0 || config->cache_size == 0) {
+                    fprintf(stderr, "Invalid value for --cache-size: '%s'. Expected a size like 512M or 10G.\n", optarg);
+                    return -1;
+                }
+                break;
+
+            case 27:
+                config->perf_counters = 1;
+                break;
+
+            case 28:
+                if (validate_pod_name(optarg) != 0) {
+                    fprintf(stderr, "Invalid value for --pod: '%s'. Expected a name of letters, digits, '-' and '_'.\n", optarg);
+                    return -1;
+                }
+                config->pod.name = optarg;
+                break;
+
+            case 29:
+                config->base = optarg;
+                break;
+
+            case 30:
+                config->prefetch = PREFETCH_DEFAULT_WINDOW_MS;
+                if (optarg) {
+                    config->prefetch = atoi(optarg);
+                    if (config->prefetch <= 0) {
+                        fprintf(stderr, "Invalid value for --prefetch: '%s'. Must be a positive number of milliseconds.\n", optarg);
                         return -1;
                     }
-                    limits.pids_max = ret;
                 }
                 break;
 
-            case 5:
-                config.disable_cgroups = 1;
+            case 31:
+                if (validate_tenant_name(optarg) != 0) {
+                    fprintf(stderr, "Invalid value for --tenant: '%s'. Expected a name starting with a letter, of letters, digits, '-' and '_'.\n", optarg);
+                    return -1;
+                }
+                config->tenant = optarg;
+                break;
+
+            case 32:
+                config->netns_pool = 1;
                 break;
 
             case '?':
@@ -81,6 +492,158 @@ int main(int argc, char **argv) {
         }
     }
 
+    if (optind < argc) {
+        config->command = &argv[optind];
+    }
+
+    return 0;
+}
+
+// A stage given as one quoted string ('grep -v foo') is split on whitespace, without shell quoting
+static char **split_stage_command(char **command) {
+    if (!command || !command[0] || command[1] || !strpbrk(command[0], " \t")) {
+        return command;
+    }
+
+    char *copy = strdup(command[0]);
+    char **words = calloc(strlen(copy) / 2 + 2, sizeof(char *));
+    char *saveptr;
+    int count = 0;
+
+    if (!copy || !words) {
+        return command;
+    }
+
+    for (char *tok = strtok_r(copy, " \t", &saveptr); tok; tok = strtok_r(NULL, " \t", &saveptr)) {
+        words[count++] = tok;
+    }
+
+    return count > 0 ? words : command;
+}
+
+static char *join_words(char **words) {
+    size_t len = 1;
+    for (int i = 0; words[i]; i++) len += strlen(words[i]) + 1;
+
+    char *label = malloc(len);
+    if (!label) {
+        return words[0];
+    }
+
+    label[0] = '\0';
+    for (int i = 0; words[i]; i++) {
+        if (i > 0) strcat(label, " ");
+        strcat(label, words[i]);
+    }
+
+    return label;
+}
+
+static int pipe_main(int argc, char **argv) {
+    // runbox pipe [--tap] [stage options] 'cmd args' ! [stage options] 'cmd args' ...
+    static struct PipelineStage stages[MAX_PIPELINE_STAGES];
+    int count = 0;
+    int tap = 0;
+    int first = 1;
+
+    if (argc > 1 && strcmp(argv[1], "--tap") == 0) {
+        tap = 1;
+        first = 2;
+    }
+
+    while (first < argc) {
+        int last = first;
+        while (last < argc && strcmp(argv[last], "!") != 0) last++;
+
+        if (count == MAX_PIPELINE_STAGES) {
+            fprintf(stderr, "Too many pipeline stages (at most %d).\n", MAX_PIPELINE_STAGES);
+            return -1;
+        }
+
+        // getopt wants its own argv[0] in front of the stage's arguments
+        char **stage_argv = calloc(last - first + 2, sizeof(char *));
+        if (!stage_argv) {
+            return -1;
+        }
+
+        stage_argv[0] = argv[0];
+        memcpy(&stage_argv[1], &argv[first], (last - first) * sizeof(char *));
+
+        struct PipelineStage *stage = &stages[count];
+        default_config(&stage->config, &stage->limits);
+
+        optind = 0;
+        if (parse_run_options(last - first + 1, stage_argv, &stage->config, &stage->limits) != 0) {
+            return -1;
+        }
+
+        stage->config.command = split_stage_command(stage->config.command);
+        if (!stage->config.command) {
+            fprintf(stderr, "Pipeline stage %d has no command.\n", count + 1);
+            return -1;
+        }
+
+        // The cache would replay a stage's output outside the pipeline
+        if (stage->config.cache) {
+            fprintf(stderr, "--cache cannot be used in a pipeline stage.\n");
+            return -1;
+        }
+
+        stage->label = join_words(stage->config.command);
+        count++;
+        first = last + 1;
+    }
+
+    if (count == 0) {
+        fprintf(stderr, "Usage: runbox pipe [--tap] [options] 'cmd args' ! [options] 'cmd args' ...\n");
+        return -1;
+    }
+
+    return run_pipeline(stages, count, tap);
+}
+
+int main(int argc, char **argv) {
+
+    if (argc > 1 && strcmp(argv[1], "exec") == 0) {
+        return exec_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "update") == 0) {
+        return update_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "tenant") == 0) {
+        return tenant_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "commit") == 0) {
+        return commit_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "netns-pool") == 0) {
+        return netns_pool_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "pipe") == 0) {
+        return pipe_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "bench") == 0) {
+        return bench_main(argc - 1, argv + 1);
+    }
+
+    if (argc > 1 && strcmp(argv[1], "image") == 0) {
+        return image_main(argc - 1, argv + 1);
+    }
+
+    struct Config config;
+    struct CgroupLimits limits;
+    default_config(&config, &limits);
+
+    if (parse_run_options(argc, argv, &config, &limits) != 0) {
+        return -1;
+    }
+
     return setup_sandbox(&config, &limits);
 }
 
@@ -0,0 +1,908 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <elf.h>
+#include <endian.h>
+#include <fcntl.h>
+#include <glob.h>
+#include <limits.h>
+#include <stddef.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "minroot.h"
+
+#define MAX_SEARCH_DIRS 64
+#define MAX_NEEDED 256
+#define MAX_PHDRS 256
+
+// Same PATH the workload is exec'd with (see exec_command())
+static const char *command_dirs[] = { "/bin", "/usr/bin" };
+
+// Trusted directories the dynamic linker falls back to
+static const char *default_dirs_64[] = { "/lib64", "/usr/lib64", "/lib", "/usr/lib" };
+static const char *default_dirs_32[] = { "/lib", "/usr/lib" };
+
+struct ElfInfo {
+    unsigned char class;
+    uint16_t machine;
+    char interp[PATH_MAX];
+
+    char *strtab;           // DT_STRTAB, the strings below are offsets into it
+    size_t strsz;
+    size_t needed[MAX_NEEDED];
+    int needed_count;
+    long rpath;             // -1 if absent
+    long runpath;
+};
+
+struct Segment {
+    uint32_t type;
+    uint64_t offset;
+    uint64_t vaddr;
+    uint64_t filesz;
+};
+
+struct Resolver {
+    struct Manifest *manifest;
+
+    // ELF objects whose dependencies still have to be scanned
+    char *queue[MINROOT_MAX_ENTRIES];
+    int queued;
+    int scanned;
+
+    // Every object has to match the executable, so e.g. /lib32 copies are skipped
+    unsigned char class;
+    uint16_t machine;
+
+    char *conf_dirs[MAX_SEARCH_DIRS];
+    int conf_count;
+};
+
+void free_manifest(struct Manifest *manifest) {
+    for (int i = 0; i < manifest->count; i++) {
+        free(manifest->entries[i].path);
+        free(manifest->entries[i].target);
+    }
+
+    free(manifest->entries);
+    *manifest = (struct Manifest) { 0 };
+}
+
+// Returns 1 if the entry was added, 0 if the path is already in the manifest
+static int manifest_add(struct Manifest *manifest, enum ManifestEntryType type, const char *path, const char *target) {
+    for (int i = 0; i < manifest->count; i++) {
+        if (strcmp(manifest->entries[i].path, path) == 0) {
+            return 0;
+        }
+    }
+
+    // The cache file is line and tab separated
+    if (strpbrk(path, "\t\n") || (target && strpbrk(target, "\t\n"))) {
+        printf("minimal root: unsupported file name %s\n", path);
+        return -1;
+    }
+
+    if (manifest->count == MINROOT_MAX_ENTRIES) {
+        printf("minimal root: more than %d files needed\n", MINROOT_MAX_ENTRIES);
+        return -1;
+    }
+
+    if (manifest->count == manifest->capacity) {
+        int capacity = manifest->capacity ? manifest->capacity * 2 : 32;
+        struct ManifestEntry *entries = realloc(manifest->entries, capacity * sizeof(*entries));
+        if (!entries) {
+            printf("minimal root: out of memory\n");
+            return -1;
+        }
+        manifest->entries = entries;
+        manifest->capacity = capacity;
+    }
+
+    struct ManifestEntry *entry = &manifest->entries[manifest->count];
+    entry->type = type;
+    entry->path = strdup(path);
+    entry->target = target ? strdup(target) : NULL;
+
+    if (!entry->path || (target && !entry->target)) {
+        free(entry->path);
+        free(entry->target);
+        printf("minimal root: out of memory\n");
+        return -1;
+    }
+
+    manifest->count++;
+    return 1;
+}
+
+/*
+ * Resolves `path` one component at a time the way the kernel would, recording every
+ * symlink on the way. Each symlink is recorded at its canonical location, so the minimal
+ * root can be rebuilt from real directories plus these links without ever following one
+ * on the host. The canonical path is returned in `resolved`.
+ */
+static int record_path(struct Manifest *manifest, const char *path, char *resolved) {
+    char pending[PATH_MAX];
+    char cur[PATH_MAX] = "";
+    int links = 0;
+
+    if (path[0] != '/' || snprintf(pending, sizeof(pending), "%s", path) >= (int)sizeof(pending)) {
+        errno = EINVAL;
+        return -1;
+    }
+
+    char *p = pending;
+
+    while (*p) {
+        while (*p == '/') p++;
+        if (!*p) break;
+
+        size_t len = strcspn(p, "/");
+        char comp[NAME_MAX + 1];
+
+        if (len > NAME_MAX) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+        memcpy(comp, p, len);
+        comp[len] = '\0';
+        p += len;
+
+        if (strcmp(comp, ".") == 0) continue;
+
+        if (strcmp(comp, "..") == 0) {
+            char *slash = strrchr(cur, '/');
+            if (slash) *slash = '\0';
+            continue;
+        }
+
+        char candidate[PATH_MAX];
+        struct stat st;
+
+        if (snprintf(candidate, sizeof(candidate), "%s/%s", cur, comp) >= (int)sizeof(candidate)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        if (lstat(candidate, &st) == -1) {
+            return -1;
+        }
+
+        if (!S_ISLNK(st.st_mode)) {
+            memcpy(cur, candidate, sizeof(cur));
+            continue;
+        }
+
+        if (++links > MINROOT_MAX_SYMLINKS) {
+            errno = ELOOP;
+            return -1;
+        }
+
+        char target[PATH_MAX];
+        ssize_t n = readlink(candidate, target, sizeof(target) - 1);
+        if (n == -1) {
+            return -1;
+        }
+        target[n] = '\0';
+
+        if (manifest_add(manifest, MANIFEST_SYMLINK, candidate, target) < 0) {
+            errno = EINVAL;
+            return -1;
+        }
+
+        // Carry on with the link target followed by whatever was left of the path
+        char next[PATH_MAX];
+        if (snprintf(next, sizeof(next), "%s%s", target, p) >= (int)sizeof(next)) {
+            errno = ENAMETOOLONG;
+            return -1;
+        }
+
+        if (target[0] == '/') {
+            cur[0] = '\0';
+        }
+
+        memcpy(pending, next, sizeof(pending));
+        p = pending;
+    }
+
+    snprintf(resolved, PATH_MAX, "%s", cur[0] ? cur : "/");
+    return 0;
+}
+
+// Records a file and, for ELF objects whose dependencies matter, queues it for scanning
+static int add_file(struct Resolver *r, const char *path, int scan) {
+    char canonical[PATH_MAX];
+    struct stat st;
+
+    if (record_path(r->manifest, path, canonical) != 0) {
+        printf("minimal root: cannot resolve %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (stat(canonical, &st) == -1 || !S_ISREG(st.st_mode)) {
+        printf("minimal root: %s is not a regular file\n", path);
+        return -1;
+    }
+
+    int added = manifest_add(r->manifest, MANIFEST_FILE, canonical, NULL);
+    if (added < 0) {
+        return -1;
+    }
+
+    if (added && scan) {
+        r->queue[r->queued] = r->manifest->entries[r->manifest->count - 1].path;
+        r->queued++;
+    }
+
+    return 0;
+}
+
+static int read_exact(int fd, void *buf, size_t size, uint64_t offset) {
+    return pread(fd, buf, size, (off_t)offset) == (ssize_t)size ? 0 : -1;
+}
+
+static int read_ident(int fd, unsigned char *ident) {
+    if (read_exact(fd, ident, EI_NIDENT, 0) != 0 || memcmp(ident, ELFMAG, SELFMAG) != 0) {
+        return -1;
+    }
+
+    // Only objects we could actually run: native byte order, 32 or 64 bit
+    int native = BYTE_ORDER == LITTLE_ENDIAN ? ELFDATA2LSB : ELFDATA2MSB;
+    if (ident[EI_DATA] != native || (ident[EI_CLASS] != ELFCLASS32 && ident[EI_CLASS] != ELFCLASS64)) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int read_segments(int fd, unsigned char class, struct Segment *segments, int *count, uint16_t *machine) {
+    uint64_t phoff;
+    uint16_t phnum, phentsize;
+
+    if (class == ELFCLASS64) {
+        Elf64_Ehdr ehdr;
+        if (read_exact(fd, &ehdr, sizeof(ehdr), 0) != 0) return -1;
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+        *machine = ehdr.e_machine;
+        if (phentsize != sizeof(Elf64_Phdr)) return -1;
+    } else {
+        Elf32_Ehdr ehdr;
+        if (read_exact(fd, &ehdr, sizeof(ehdr), 0) != 0) return -1;
+        phoff = ehdr.e_phoff;
+        phnum = ehdr.e_phnum;
+        phentsize = ehdr.e_phentsize;
+        *machine = ehdr.e_machine;
+        if (phentsize != sizeof(Elf32_Phdr)) return -1;
+    }
+
+    if (phnum > MAX_PHDRS) return -1;
+
+    for (int i = 0; i < phnum; i++) {
+        uint64_t at = phoff + (uint64_t)i * phentsize;
+
+        if (class == ELFCLASS64) {
+            Elf64_Phdr ph;
+            if (read_exact(fd, &ph, sizeof(ph), at) != 0) return -1;
+            segments[i] = (struct Segment) { ph.p_type, ph.p_offset, ph.p_vaddr, ph.p_filesz };
+        } else {
+            Elf32_Phdr ph;
+            if (read_exact(fd, &ph, sizeof(ph), at) != 0) return -1;
+            segments[i] = (struct Segment) { ph.p_type, ph.p_offset, ph.p_vaddr, ph.p_filesz };
+        }
+    }
+
+    *count = phnum;
+    return 0;
+}
+
+// DT_STRTAB holds a virtual address; find the file offset through the PT_LOAD segments
+static int vaddr_to_offset(const struct Segment *segments, int count, uint64_t vaddr, uint64_t *offset) {
+    for (int i = 0; i < count; i++) {
+        if (segments[i].type == PT_LOAD && vaddr >= segments[i].vaddr &&
+            vaddr < segments[i].vaddr + segments[i].filesz) {
+            *offset = segments[i].offset + (vaddr - segments[i].vaddr);
+            return 0;
+        }
+    }
+
+    return -1;
+}
+
+static int read_dynamic(int fd, struct ElfInfo *info, const struct Segment *segments, int count,
+                        const struct Segment *dynamic) {
+    size_t entsize = info->class == ELFCLASS64 ? sizeof(Elf64_Dyn) : sizeof(Elf32_Dyn);
+    uint64_t strtab = 0;
+    uint64_t strtab_offset;
+    int has_strtab = 0;
+
+    for (uint64_t at = 0; at + entsize <= dynamic->filesz; at += entsize) {
+        int64_t tag;
+        uint64_t val;
+
+        if (info->class == ELFCLASS64) {
+            Elf64_Dyn dyn;
+            if (read_exact(fd, &dyn, sizeof(dyn), dynamic->offset + at) != 0) return -1;
+            tag = dyn.d_tag;
+            val = dyn.d_un.d_val;
+        } else {
+            Elf32_Dyn dyn;
+            if (read_exact(fd, &dyn, sizeof(dyn), dynamic->offset + at) != 0) return -1;
+            tag = dyn.d_tag;
+            val = dyn.d_un.d_val;
+        }
+
+        if (tag == DT_NULL) break;
+
+        switch (tag) {
+            case DT_NEEDED:
+                if (info->needed_count == MAX_NEEDED) return -1;
+                info->needed[info->needed_count++] = val;
+                break;
+            case DT_STRTAB:
+                strtab = val;
+                has_strtab = 1;
+                break;
+            case DT_STRSZ:
+                info->strsz = val;
+                break;
+            case DT_RPATH:
+                info->rpath = (long)val;
+                break;
+            case DT_RUNPATH:
+                info->runpath = (long)val;
+                break;
+        }
+    }
+
+    if (!has_strtab || info->strsz == 0) {
+        return info->needed_count == 0 ? 0 : -1;
+    }
+
+    if (info->strsz > (16 << 20) || vaddr_to_offset(segments, count, strtab, &strtab_offset) != 0) {
+        return -1;
+    }
+
+    info->strtab = malloc(info->strsz + 1);
+    if (!info->strtab || read_exact(fd, info->strtab, info->strsz, strtab_offset) != 0) {
+        return -1;
+    }
+    info->strtab[info->strsz] = '\0';
+
+    for (int i = 0; i < info->needed_count; i++) {
+        if (info->needed[i] >= info->strsz) return -1;
+    }
+    if (info->rpath >= (long)info->strsz || info->runpath >= (long)info->strsz) return -1;
+
+    return 0;
+}
+
+// Parses just the headers the dynamic linker looks at: PT_INTERP and the PT_DYNAMIC entries
+static int read_elf(const char *path, struct ElfInfo *info) {
+    unsigned char ident[EI_NIDENT];
+    struct Segment segments[MAX_PHDRS];
+    int count;
+
+    *info = (struct ElfInfo) { .rpath = -1, .runpath = -1 };
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return -1;
+    }
+
+    int ret = -1;
+
+    if (read_ident(fd, ident) != 0) goto out;
+    info->class = ident[EI_CLASS];
+
+    if (read_segments(fd, info->class, segments, &count, &info->machine) != 0) goto out;
+
+    ret = 0;
+
+    for (int i = 0; i < count && ret == 0; i++) {
+        if (segments[i].type == PT_INTERP) {
+            if (segments[i].filesz == 0 || segments[i].filesz >= sizeof(info->interp) ||
+                read_exact(fd, info->interp, segments[i].filesz, segments[i].offset) != 0) {
+                ret = -1;
+            } else {
+                info->interp[segments[i].filesz] = '\0';
+            }
+        } else if (segments[i].type == PT_DYNAMIC) {
+            ret = read_dynamic(fd, info, segments, count, &segments[i]);
+        }
+    }
+
+out:
+    close(fd);
+    if (ret != 0) {
+        free(info->strtab);
+        info->strtab = NULL;
+    }
+    return ret;
+}
+
+static int elf_matches(const struct Resolver *r, const char *path) {
+    unsigned char ident[EI_NIDENT];
+    uint16_t machine;
+
+    int fd = open(path, O_RDONLY | O_CLOEXEC);
+    if (fd == -1) {
+        return 0;
+    }
+
+    int ok = read_ident(fd, ident) == 0 && ident[EI_CLASS] == r->class &&
+             read_exact(fd, &machine, sizeof(machine), offsetof(Elf64_Ehdr, e_machine)) == 0 &&
+             machine == r->machine;
+
+    close(fd);
+    return ok;
+}
+
+static void parse_ld_conf(struct Resolver *r, const char *path, int depth) {
+    char line[PATH_MAX];
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "#\n")] = '\0';
+
+        char *start = line + strspn(line, " \t");
+        char *end = start + strlen(start);
+        while (end > start && (end[-1] == ' ' || end[-1] == '\t')) *--end = '\0';
+
+        if (*start == '\0' || strncmp(start, "hwcap ", 6) == 0) continue;
+
+        if (strncmp(start, "include", 7) == 0 && (start[7] == ' ' || start[7] == '\t')) {
+            char *pattern = start + 8 + strspn(start + 8, " \t");
+            glob_t matches;
+
+            if (depth < 4 && glob(pattern, 0, NULL, &matches) == 0) {
+                for (size_t i = 0; i < matches.gl_pathc; i++) {
+                    parse_ld_conf(r, matches.gl_pathv[i], depth + 1);
+                }
+                globfree(&matches);
+            }
+            continue;
+        }
+
+        if (*start == '/' && r->conf_count < MAX_SEARCH_DIRS) {
+            char *dir = strdup(start);
+            if (dir) {
+                r->conf_dirs[r->conf_count++] = dir;
+            }
+        }
+    }
+
+    fclose(f);
+}
+
+// Returns 1 if the library was found (and recorded), 0 if not, -1 on errors
+static int try_library(struct Resolver *r, const char *dir, const char *name) {
+    char candidate[PATH_MAX];
+
+    if (snprintf(candidate, sizeof(candidate), "%s/%s", dir, name) >= (int)sizeof(candidate) ||
+        access(candidate, F_OK) == -1 || !elf_matches(r, candidate)) {
+        return 0;
+    }
+
+    return add_file(r, candidate, 1) == 0 ? 1 : -1;
+}
+
+// Searches a DT_RPATH / DT_RUNPATH list, expanding $ORIGIN to the directory of the object
+static int try_search_path(struct Resolver *r, const char *list, const char *origin, const char *name) {
+    char dir[PATH_MAX];
+
+    while (*list) {
+        size_t len = strcspn(list, ":");
+        size_t out = 0;
+
+        for (size_t i = 0; i < len && out < sizeof(dir) - 1; ) {
+            const char *rest = list + i;
+            size_t skip = 0;
+
+            if (strncmp(rest, "${ORIGIN}", 9) == 0) skip = 9;
+            else if (strncmp(rest, "$ORIGIN", 7) == 0) skip = 7;
+
+            if (skip) {
+                out += snprintf(dir + out, sizeof(dir) - out, "%s", origin);
+                if (out >= sizeof(dir)) out = sizeof(dir) - 1;
+                i += skip;
+            } else {
+                dir[out++] = list[i++];
+            }
+        }
+        dir[out] = '\0';
+
+        if (dir[0]) {
+            int found = try_library(r, dir, name);
+            if (found != 0) return found;
+        }
+
+        list += len;
+        if (*list == ':') list++;
+    }
+
+    return 0;
+}
+
+static int find_library(struct Resolver *r, const struct ElfInfo *info, const char *origin, const char *name) {
+    int found = 0;
+
+    // Same order as ld.so: DT_RPATH (only without DT_RUNPATH), DT_RUNPATH, ld.so.conf, defaults
+    if (info->runpath < 0 && info->rpath >= 0) {
+        found = try_search_path(r, info->strtab + info->rpath, origin, name);
+    }
+    if (found == 0 && info->runpath >= 0) {
+        found = try_search_path(r, info->strtab + info->runpath, origin, name);
+    }
+
+    for (int i = 0; found == 0 && i < r->conf_count; i++) {
+        found = try_library(r, r->conf_dirs[i], name);
+    }
+
+    const char **defaults = r->class == ELFCLASS64 ? default_dirs_64 : default_dirs_32;
+    int default_count = r->class == ELFCLASS64 ? 4 : 2;
+
+    for (int i = 0; found == 0 && i < default_count; i++) {
+        found = try_library(r, defaults[i], name);
+    }
+
+    return found;
+}
+
+static int scan_object(struct Resolver *r, const char *path) {
+    struct ElfInfo info;
+    char origin[PATH_MAX];
+
+    if (read_elf(path, &info) != 0) {
+        printf("minimal root: %s is not a valid ELF object\n", path);
+        return -1;
+    }
+
+    // The first object scanned is the executable; everything else has to match it
+    if (r->class == 0) {
+        r->class = info.class;
+        r->machine = info.machine;
+    }
+
+    snprintf(origin, sizeof(origin), "%s", path);
+    char *slash = strrchr(origin, '/');
+    if (slash == origin) slash[1] = '\0';
+    else if (slash) *slash = '\0';
+
+    int ret = 0;
+
+    // The interpreter is static, so it has no dependencies of its own to scan
+    if (info.interp[0] && add_file(r, info.interp, 0) != 0) {
+        ret = -1;
+    }
+
+    for (int i = 0; ret == 0 && i < info.needed_count; i++) {
+        const char *name = info.strtab + info.needed[i];
+
+        if (strchr(name, '/')) {
+            ret = add_file(r, name, 1);
+            continue;
+        }
+
+        int found = find_library(r, &info, origin, name);
+        if (found == 0) {
+            printf("minimal root: cannot find %s needed by %s\n", name, path);
+        }
+        ret = found == 1 ? 0 : -1;
+    }
+
+    free(info.strtab);
+    return ret;
+}
+
+// Scripts bring their interpreter; only an absolute "#!" path is followed
+static int read_shebang(const char *path, char *interp, size_t size) {
+    char line[PATH_MAX];
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    int found = 0;
+    if (fgets(line, sizeof(line), f) && strncmp(line, "#!", 2) == 0) {
+        char *start = line + 2 + strspn(line + 2, " \t");
+        start[strcspn(start, " \t\n")] = '\0';
+
+        if (start[0] == '/') {
+            snprintf(interp, size, "%s", start);
+            found = 1;
+        }
+    }
+
+    fclose(f);
+    return found;
+}
+
+static int resolve_manifest(const char *binary, struct Manifest *manifest) {
+    struct Resolver r = { .manifest = manifest };
+    char interp[PATH_MAX];
+    int ret = -1;
+
+    parse_ld_conf(&r, "/etc/ld.so.conf", 0);
+
+    if (read_shebang(binary, interp, sizeof(interp))) {
+        if (add_file(&r, binary, 0) != 0 || add_file(&r, interp, 1) != 0) {
+            goto out;
+        }
+    } else if (add_file(&r, binary, 1) != 0) {
+        goto out;
+    }
+
+    while (r.scanned < r.queued) {
+        if (scan_object(&r, r.queue[r.scanned++]) != 0) {
+            goto out;
+        }
+    }
+
+    // Lets the dynamic linker find libraries from ld.so.conf directories without searching
+    if (access("/etc/ld.so.cache", F_OK) == 0 && add_file(&r, "/etc/ld.so.cache", 0) != 0) {
+        goto out;
+    }
+
+    ret = 0;
+
+out:
+    for (int i = 0; i < r.conf_count; i++) {
+        free(r.conf_dirs[i]);
+    }
+    return ret;
+}
+
+static int find_command(const char *name, char *path, size_t size) {
+    // Relative paths would be resolved against a different working directory in the sandbox
+    if (strchr(name, '/')) {
+        if (name[0] != '/') {
+            printf("--minimal-root needs an absolute path or a command name, not %s\n", name);
+            return -1;
+        }
+        snprintf(path, size, "%s", name);
+        return 0;
+    }
+
+    for (size_t i = 0; i < sizeof(command_dirs) / sizeof(command_dirs[0]); i++) {
+        snprintf(path, size, "%s/%s", command_dirs[i], name);
+        if (access(path, X_OK) == 0) {
+            return 0;
+        }
+    }
+
+    printf("minimal root: command %s not found in /bin or /usr/bin\n", name);
+    return -1;
+}
+
+// Device, inode and mtime: changes whenever a file is replaced or rewritten
+static void file_identity(const struct stat *st, char *buf, size_t size) {
+    snprintf(buf, size, "%llx-%llx-%lld.%09ld", (unsigned long long)st->st_dev,
+             (unsigned long long)st->st_ino, (long long)st->st_mtim.tv_sec, st->st_mtim.tv_nsec);
+}
+
+/*
+ * A cached manifest is only used while every recorded link is unchanged and every recorded
+ * file still has the identity it had when the closure was resolved. An upgraded library may
+ * need new DT_NEEDED entries, so any change means resolving again.
+ */
+static int read_cached_manifest(const char *cache_path, struct Manifest *manifest) {
+    char line[2 * PATH_MAX + 8];
+
+    FILE *f = fopen(cache_path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    int ret = 0;
+
+    while (ret == 0 && fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        char *path = strchr(line, '\t');
+        if (!path) {
+            ret = -1;
+            break;
+        }
+        *path++ = '\0';
+
+        struct stat st;
+
+        if (strcmp(line, "F") == 0) {
+            char *ident = path;
+            char current[64];
+
+            path = strchr(ident, '\t');
+            if (!path) {
+                ret = -1;
+                break;
+            }
+            *path++ = '\0';
+
+            if (stat(path, &st) == -1 || !S_ISREG(st.st_mode)) {
+                ret = -1;
+                break;
+            }
+
+            file_identity(&st, current, sizeof(current));
+            if (strcmp(current, ident) != 0 || manifest_add(manifest, MANIFEST_FILE, path, NULL) < 0) {
+                ret = -1;
+            }
+        } else if (strcmp(line, "L") == 0) {
+            char *target = strchr(path, '\t');
+            char current[PATH_MAX];
+            ssize_t n;
+
+            if (!target) {
+                ret = -1;
+                break;
+            }
+            *target++ = '\0';
+
+            n = readlink(path, current, sizeof(current) - 1);
+            if (n == -1 || (size_t)n != strlen(target) || memcmp(current, target, n) != 0 ||
+                manifest_add(manifest, MANIFEST_SYMLINK, path, target) < 0) {
+                ret = -1;
+            }
+        } else {
+            ret = -1;
+        }
+    }
+
+    fclose(f);
+
+    if (ret != 0) {
+        free_manifest(manifest);
+    }
+    return ret;
+}
+
+static void write_cached_manifest(const char *cache_path, const struct Manifest *manifest) {
+    char tmp_path[PATH_MAX];
+
+    if ((mkdir("/var/cache/runbox", 0755) == -1 && errno != EEXIST) ||
+        (mkdir(MINROOT_CACHE_DIR, 0755) == -1 && errno != EEXIST)) {
+        printf("Warning: cannot create %s: %s\n", MINROOT_CACHE_DIR, strerror(errno));
+        return;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", cache_path, getpid());
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        printf("Warning: cannot write %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+
+    for (int i = 0; i < manifest->count; i++) {
+        const struct ManifestEntry *entry = &manifest->entries[i];
+
+        if (entry->type == MANIFEST_FILE) {
+            struct stat st;
+            char ident[64];
+
+            if (stat(entry->path, &st) == -1) {
+                printf("Warning: cannot write %s: %s: %s\n", cache_path, entry->path, strerror(errno));
+                fclose(f);
+                unlink(tmp_path);
+                return;
+            }
+
+            file_identity(&st, ident, sizeof(ident));
+            fprintf(f, "F\t%s\t%s\n", ident, entry->path);
+        } else {
+            fprintf(f, "L\t%s\t%s\n", entry->path, entry->target);
+        }
+    }
+
+    if (fclose(f) != 0 || rename(tmp_path, cache_path) == -1) {
+        printf("Warning: cannot write %s: %s\n", cache_path, strerror(errno));
+        unlink(tmp_path);
+    }
+}
+
+/*
+ * Builds the manifest of the minimal root for `command`: the binary, its PT_INTERP and
+ * the DT_NEEDED closure, plus every symlink on the way to them. Resolution only runs
+ * when the binary or a file of its closure changed since the cached manifest was written.
+ */
+int load_manifest(char **command, struct Manifest *manifest) {
+    char binary[PATH_MAX];
+    char cache_path[PATH_MAX];
+    char ident[64];
+    struct stat st;
+
+    *manifest = (struct Manifest) { 0 };
+
+    if (!command || !command[0]) {
+        printf("--minimal-root needs a command to run\n");
+        return -1;
+    }
+
+    if (find_command(command[0], binary, sizeof(binary)) != 0) {
+        return -1;
+    }
+
+    if (stat(binary, &st) == -1) {
+        printf("failed accessing %s: %s\n", binary, strerror(errno));
+        return -1;
+    }
+
+    file_identity(&st, ident, sizeof(ident));
+    snprintf(cache_path, sizeof(cache_path), MINROOT_CACHE_DIR "/%s", ident);
+
+    if (read_cached_manifest(cache_path, manifest) == 0) {
+        return 0;
+    }
+
+    if (resolve_manifest(binary, manifest) != 0) {
+        free_manifest(manifest);
+        return -1;
+    }
+
+    write_cached_manifest(cache_path, manifest);
+    return 0;
+}
+
+static int make_parents(char *path) {
+    for (char *p = strchr(path + 1, '/'); p; p = strchr(p + 1, '/')) {
+        *p = '\0';
+        int ret = mkdir(path, 0755);
+        *p = '/';
+
+        if (ret == -1 && errno != EEXIST) {
+            printf("failed creating %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Recreates the manifest below `root`: symlinks as symlinks, files as read-only binds
+int mount_minimal_root(const char *root, const struct Manifest *manifest) {
+    char target[PATH_MAX];
+
+    for (int i = 0; i < manifest->count; i++) {
+        const struct ManifestEntry *entry = &manifest->entries[i];
+
+        snprintf(target, sizeof(target), "%s%s", root, entry->path);
+        if (make_parents(target) != 0) {
+            return -1;
+        }
+
+        if (entry->type == MANIFEST_SYMLINK) {
+            if (symlink(entry->target, target) == -1 && errno != EEXIST) {
+                printf("failed creating symlink %s: %s\n", entry->path, strerror(errno));
+                return -1;
+            }
+            continue;
+        }
+
+        int fd = open(target, O_WRONLY | O_CREAT | O_NOFOLLOW | O_CLOEXEC, 0644);
+        if (fd == -1) {
+            printf("failed creating mount point %s: %s\n", entry->path, strerror(errno));
+            return -1;
+        }
+        close(fd);
+
+        if (mount(entry->path, target, NULL, MS_BIND, NULL) == -1) {
+            printf("failed mounting %s: %s\n", entry->path, strerror(errno));
+            return -1;
+        }
+        mount(NULL, target, NULL, MS_BIND | MS_REMOUNT | MS_RDONLY, NULL);
+    }
+
+    return 0;
+}
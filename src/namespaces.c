@@ -10,8 +10,12 @@
 #include <string.h>
 #include <sys/mount.h>
 #include <sys/stat.h>
+#include <sys/ioctl.h>
+#include <sys/socket.h>
+#include <net/if.h>
 #include <stdlib.h>
 #include <linux/capability.h>
+#include "image.h"
 #include "namespaces.h"
 
 int setup_user_namespace(void) {
@@ -80,27 +84,8 @@ int setup_user_namespace(void) {
     return 0;
 }
 
-int setup_mount_namespace(void) {
-    if (unshare(CLONE_NEWNS) == -1) {
-        printf("unshare failed while creating mount namespace: %s\n", strerror(errno));
-        return -1;
-    }
-
-    // Runbox root
-    if (mkdir("/tmp/runbox", 0755) == -1) {
-        if (errno != EEXIST) {
-            printf("failed creating sandbox root: %s\n", strerror(errno));
-            return -1;
-        }
-    }
-
-    // Mount new tmpfs - creates isolated filesystem for sandbox
-    if (mount("tmpfs", "/tmp/runbox", "tmpfs", 0, NULL) == -1) {
-        printf("failed mounting tmpfs: %s\n", strerror(errno));
-        return -1;
-    }
-
-    // Create necessary directories
+// Bind mount essential directories from the host, read-only
+static int bind_host_root(void) {
     if (mkdir("/tmp/runbox/bin", 0755) == -1) {
         if (errno != EEXIST) {
             printf("failed creating sandbox bin: %s\n", strerror(errno));
@@ -119,20 +104,7 @@ int setup_mount_namespace(void) {
             return -1;
         }
     }
-    if (mkdir("/tmp/runbox/tmp", 0755) == -1) {
-        if (errno != EEXIST) {
-            printf("failed creating sandbox tmp: %s\n", strerror(errno));
-            return -1;
-        }
-    }
-    if (mkdir("/tmp/runbox/proc", 0755) == -1) {
-        if (errno != EEXIST) {
-            printf("failed creating sandbox proc: %s\n", strerror(errno));
-            return -1;
-        }
-    }
 
-    // Bind mount essential directories from host, then make read-only
     if (mount("/bin", "/tmp/runbox/bin", NULL, MS_BIND, NULL) == -1) {
         printf("failed mounting /bin: %s\n", strerror(errno));
         return -1;
@@ -191,11 +163,115 @@ int setup_mount_namespace(void) {
         }
     }
 
+    return 0;
+}
+
+/*
+ * Keeps a descriptor of the directory that receives the sandbox's writes. It is inherited
+ * by the init and, being open, keeps the directory reachable through /proc/<init>/fd after
+ * the pivot, so `runbox commit` can read it from the host. Close-on-exec keeps it away
+ * from the workload.
+ */
+static int pin_writable_area(const char *path) {
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1 || dup3(fd, SANDBOX_WRITABLE_FD, O_CLOEXEC) == -1) {
+        printf("failed opening sandbox writable area: %s\n", strerror(errno));
+        if (fd != -1) close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+// Stacks the image layers read-only under a writable upper directory. The upper and work
+// directories live on the sandbox tmpfs, so writes stay private to this sandbox and vanish
+// with it; the overlay is mounted on top of that same tmpfs and hides them from the workload
+static int mount_image_root(const char *lowerdir) {
+    char options[IMAGE_LOWERDIR_MAX + 128];
+
+    if (mkdir("/tmp/runbox/.rw", 0700) == -1 ||
+        mkdir("/tmp/runbox/.rw/upper", 0755) == -1 ||
+        mkdir("/tmp/runbox/.rw/work", 0700) == -1) {
+        printf("failed creating overlay directories: %s\n", strerror(errno));
+        return -1;
+    }
+
+    if (pin_writable_area("/tmp/runbox/.rw/upper") != 0) {
+        return -1;
+    }
+
+    snprintf(options, sizeof(options), "lowerdir=%s,upperdir=/tmp/runbox/.rw/upper,workdir=/tmp/runbox/.rw/work",
+             lowerdir);
+
+    if (mount("overlay", "/tmp/runbox", "overlay", 0, options) == -1) {
+        printf("failed mounting image overlay: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int setup_mount_namespace(const struct MountSpec *mounts) {
+    if (unshare(CLONE_NEWNS) == -1) {
+        printf("unshare failed while creating mount namespace: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Runbox root
+    if (mkdir("/tmp/runbox", 0755) == -1) {
+        if (errno != EEXIST) {
+            printf("failed creating sandbox root: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
+    // Mount new tmpfs - creates isolated filesystem for sandbox
+    if (mount("tmpfs", "/tmp/runbox", "tmpfs", 0, NULL) == -1) {
+        printf("failed mounting tmpfs: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Host-root sandboxes write straight to the tmpfs; the host directories are mounts over it
+    if (mounts->lowerdir) {
+        if (mount_image_root(mounts->lowerdir) != 0) {
+            return -1;
+        }
+    } else if (pin_writable_area("/tmp/runbox") != 0) {
+        return -1;
+    }
+
+    if (mounts->manifest) {
+        if (mount_minimal_root("/tmp/runbox", mounts->manifest) != 0) {
+            return -1;
+        }
+    } else if ((!mounts->lowerdir || mounts->base) && bind_host_root() != 0) {
+        return -1;
+    }
+
+    if (mkdir("/tmp/runbox/tmp", 0755) == -1) {
+        if (errno != EEXIST) {
+            printf("failed creating sandbox tmp: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+    if (mkdir("/tmp/runbox/proc", 0755) == -1) {
+        if (errno != EEXIST) {
+            printf("failed creating sandbox proc: %s\n", strerror(errno));
+            return -1;
+        }
+    }
+
     // Create a writable tmp
     if (mount("tmpfs", "/tmp/runbox/tmp", "tmpfs", 0, NULL) == -1) {
         printf("failed mounting tmp tmpfs: %s\n", strerror(errno));
     }
 
+    // Volumes go last so they can also land inside the sandbox /tmp
+    if (mount_volumes("/tmp/runbox", mounts->volumes, mounts->volume_count) != 0) {
+        return -1;
+    }
+
     return 0;
 }
 
@@ -219,6 +295,27 @@ int setup_network_namespace(int enable_network) {
     return 0;
 }
 
+// A fresh network namespace has lo down; pods and pooled namespaces bring it up for their members
+int bring_up_loopback(void) {
+    struct ifreq ifr = { 0 };
+
+    int sock = socket(AF_INET, SOCK_DGRAM | SOCK_CLOEXEC, 0);
+    if (sock == -1) {
+        return -1;
+    }
+
+    snprintf(ifr.ifr_name, sizeof(ifr.ifr_name), "lo");
+
+    int ret = ioctl(sock, SIOCGIFFLAGS, &ifr);
+    if (ret == 0) {
+        ifr.ifr_flags |= IFF_UP | IFF_RUNNING;
+        ret = ioctl(sock, SIOCSIFFLAGS, &ifr);
+    }
+
+    close(sock);
+    return ret;
+}
+
 int setup_ipc_and_uts_namespace(void) {
     if (unshare(CLONE_NEWUTS | CLONE_NEWIPC) == -1) {
         printf("unshare failed while creating uts & ipc namespace: %s\n", strerror(errno));
@@ -228,6 +325,55 @@ int setup_ipc_and_uts_namespace(void) {
     return 0;
 }
 
+int join_namespaces(int pidfd, pid_t pid) {
+    int flags = CLONE_NEWUSER | CLONE_NEWNS | CLONE_NEWPID | CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWUTS;
+
+    // Since Linux 5.8 a single setns() on a pidfd joins all namespaces atomically
+    if (setns(pidfd, flags) == 0) {
+        return 0;
+    }
+
+    if (errno != EINVAL) {
+        printf("setns failed while joining sandbox %d: %s\n", pid, strerror(errno));
+        return -1;
+    }
+
+    // Older kernels: join through /proc/<pid>/ns one at a time. The user namespace goes
+    // last, since entering it drops our capabilities over the host-owned namespaces
+    static const struct {
+        const char *name;
+        int type;
+    } order[] = {
+        { "ipc", CLONE_NEWIPC },
+        { "uts", CLONE_NEWUTS },
+        { "net", CLONE_NEWNET },
+        { "pid", CLONE_NEWPID },
+        { "mnt", CLONE_NEWNS },
+        { "user", CLONE_NEWUSER },
+    };
+
+    for (size_t i = 0; i < sizeof(order) / sizeof(order[0]); i++) {
+        char path[64];
+        snprintf(path, sizeof(path), "/proc/%d/ns/%s", pid, order[i].name);
+
+        int fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            printf("failed opening %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+
+        if (setns(fd, order[i].type) == -1) {
+            printf("setns failed for %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+
+        close(fd);
+    }
+
+    return 0;
+}
+
 int setup_pivot_root(void) {
     // Create the old_root directory for pivot_root
     if (mkdir("/tmp/runbox/old_root", 0755) == -1) {
@@ -326,3 +472,14 @@ int exec_shell(void) {
     printf("Failed to exec shell: %s\n", strerror(errno));
     return -1;
 }
+
+int exec_command(char **argv) {
+    // Same environment the interactive shell gets
+    setenv("PATH", "/bin:/usr/bin", 1);
+    setenv("HOME", "/tmp", 1);
+
+    execvp(argv[0], argv);
+
+    printf("Failed to exec %s: %s\n", argv[0], strerror(errno));
+    return -1;
+}
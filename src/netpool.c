@@ -0,0 +1,302 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <dirent.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "namespaces.h"
+#include "netpool.h"
+
+// Namespaces created per round; the helper holds all of them open until they are pinned
+#define NETNS_POOL_BATCH 64
+
+static int ensure_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        printf("failed creating %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+static int lock_pool(void) {
+    int fd = open(NETNS_POOL_MUTEX, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        printf("Error opening %s: %s\n", NETNS_POOL_MUTEX, strerror(errno));
+        return -1;
+    }
+
+    while (flock(fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            printf("failed locking %s: %s\n", NETNS_POOL_MUTEX, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+/*
+ * Calls visit() for every pool entry, pinned or not, while the caller holds the pool
+ * mutex. Entries are only ever created and pinned under the mutex, so an unpinned one
+ * is left over from a launcher that died halfway. visit() returns 1 to stop.
+ */
+static int scan_pool(int (*visit)(const char *path, int pinned, void *arg), void *arg) {
+    struct stat parent, st;
+    char path[PATH_MAX];
+
+    DIR *dir = opendir(NETNS_POOL_DIR);
+    if (!dir) {
+        return -1;
+    }
+
+    if (fstat(dirfd(dir), &parent) == -1) {
+        closedir(dir);
+        return -1;
+    }
+
+    struct dirent *entry;
+    while ((entry = readdir(dir)) != NULL) {
+        if (strncmp(entry->d_name, "ns-", 3) != 0) {
+            continue;
+        }
+
+        snprintf(path, sizeof(path), NETNS_POOL_DIR "/%s", entry->d_name);
+        if (stat(path, &st) == -1) {
+            continue;
+        }
+
+        // The pins are nsfs files mounted over regular files in the pool directory
+        if (visit(path, st.st_dev != parent.st_dev, arg)) {
+            break;
+        }
+    }
+
+    closedir(dir);
+    return 0;
+}
+
+static int claim_entry(const char *path, int pinned, void *arg) {
+    int *fd = arg;
+
+    if (pinned) {
+        *fd = open(path, O_RDONLY | O_CLOEXEC);
+    }
+
+    // Unpinning does not end the namespace; the descriptor keeps it alive for the sandbox
+    umount2(path, MNT_DETACH);
+    unlink(path);
+
+    return *fd != -1;
+}
+
+/*
+ * Takes a namespace out of the pool. Returns an open descriptor for it, or -1 if the
+ * pool is empty or was never filled; the caller then creates a namespace as usual.
+ */
+int netns_pool_take(void) {
+    int fd = -1;
+
+    if (access(NETNS_POOL_DIR, F_OK) == -1) {
+        return -1;
+    }
+
+    int mutex_fd = lock_pool();
+    if (mutex_fd == -1) {
+        return -1;
+    }
+
+    scan_pool(claim_entry, &fd);
+    close(mutex_fd);
+
+    return fd;
+}
+
+/*
+ * Runs in a helper that leaves the caller's network namespace alone. Creating the
+ * namespaces is the slow part and happens before the mutex is taken; pinning them is
+ * a bind mount of /proc/self/fd/<n> each.
+ */
+static int create_namespaces(int count) {
+    int fds[NETNS_POOL_BATCH];
+    char path[PATH_MAX], source[64];
+    int ret = 0;
+
+    while (count > 0 && ret == 0) {
+        int batch = count < NETNS_POOL_BATCH ? count : NETNS_POOL_BATCH;
+        int created = 0;
+
+        for (; created < batch; created++) {
+            if (unshare(CLONE_NEWNET) == -1) {
+                printf("unshare failed while creating net namespace: %s\n", strerror(errno));
+                ret = -1;
+                break;
+            }
+
+            // Sandboxes cannot bring it up themselves: the namespace belongs to the host user namespace
+            if (bring_up_loopback() == -1) {
+                printf("failed bringing up loopback in a pooled namespace: %s\n", strerror(errno));
+                ret = -1;
+                break;
+            }
+
+            fds[created] = open("/proc/self/ns/net", O_RDONLY | O_CLOEXEC);
+            if (fds[created] == -1) {
+                printf("Error opening /proc/self/ns/net: %s\n", strerror(errno));
+                ret = -1;
+                break;
+            }
+        }
+
+        int mutex_fd = lock_pool();
+        if (mutex_fd == -1) {
+            ret = -1;
+        }
+
+        for (int i = 0; i < created; i++) {
+            if (mutex_fd != -1) {
+                snprintf(path, sizeof(path), NETNS_POOL_DIR "/ns-XXXXXX");
+
+                int fd = mkostemp(path, O_CLOEXEC);
+                if (fd == -1) {
+                    printf("failed creating %s: %s\n", path, strerror(errno));
+                    ret = -1;
+                } else {
+                    close(fd);
+                    snprintf(source, sizeof(source), "/proc/self/fd/%d", fds[i]);
+
+                    if (mount(source, path, NULL, MS_BIND, NULL) == -1) {
+                        printf("failed pinning %s: %s\n", path, strerror(errno));
+                        unlink(path);
+                        ret = -1;
+                    }
+                }
+            }
+
+            close(fds[i]);
+        }
+
+        if (mutex_fd != -1) {
+            close(mutex_fd);
+        }
+
+        count -= created;
+    }
+
+    return ret;
+}
+
+// Adds count fresh namespaces to the pool
+int netns_pool_add(int count) {
+    if (count <= 0) {
+        return 0;
+    }
+
+    if (ensure_dir(RUNBOX_STATE_DIR) != 0 || ensure_dir(NETNS_POOL_DIR) != 0) {
+        return -1;
+    }
+
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        _exit(create_namespaces(count) == 0 ? 0 : 1);
+    } else if (pid < 0) {
+        perror("fork failed");
+        return -1;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int count_entry(const char *path, int pinned, void *arg) {
+    (void)path;
+
+    if (pinned) {
+        (*(int *)arg)++;
+    }
+
+    return 0;
+}
+
+// Number of namespaces waiting in the pool
+int netns_pool_count(void) {
+    int count = 0;
+
+    if (access(NETNS_POOL_DIR, F_OK) == -1) {
+        return 0;
+    }
+
+    int mutex_fd = lock_pool();
+    if (mutex_fd == -1) {
+        return -1;
+    }
+
+    scan_pool(count_entry, &count);
+    close(mutex_fd);
+
+    return count;
+}
+
+// Tops the pool up to size namespaces
+int netns_pool_fill(int size) {
+    int count = netns_pool_count();
+    if (count < 0) {
+        return -1;
+    }
+
+    if (netns_pool_add(size - count) != 0) {
+        return -1;
+    }
+
+    fprintf(stderr, "runbox: netns pool has %d namespaces (%d added)\n", netns_pool_count(),
+            size > count ? size - count : 0);
+    return 0;
+}
+
+static int remove_entry(const char *path, int pinned, void *arg) {
+    if (pinned) {
+        (*(int *)arg)++;
+    }
+
+    umount2(path, MNT_DETACH);
+    unlink(path);
+    return 0;
+}
+
+// Unpins every pooled namespace; the kernel tears each down once no sandbox uses it
+int netns_pool_drain(void) {
+    int removed = 0;
+
+    if (access(NETNS_POOL_DIR, F_OK) == -1) {
+        return 0;
+    }
+
+    int mutex_fd = lock_pool();
+    if (mutex_fd == -1) {
+        return -1;
+    }
+
+    scan_pool(remove_entry, &removed);
+    close(mutex_fd);
+
+    fprintf(stderr, "runbox: removed %d namespaces from the netns pool\n", removed);
+    return 0;
+}
@@ -0,0 +1,172 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/syscall.h>
+#include <linux/perf_event.h>
+#include <fcntl.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "cgroup.h"
+#include "perf.h"
+
+static const struct {
+    const char *name;
+    uint32_t type;
+    uint64_t config;
+} counters[PERF_COUNTER_COUNT] = {
+    [PERF_TASK_CLOCK] = { "task_clock", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_TASK_CLOCK },
+    [PERF_CONTEXT_SWITCHES] = { "context_switches", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CONTEXT_SWITCHES },
+    [PERF_PAGE_FAULTS] = { "page_faults", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_PAGE_FAULTS },
+    [PERF_CPU_MIGRATIONS] = { "cpu_migrations", PERF_TYPE_SOFTWARE, PERF_COUNT_SW_CPU_MIGRATIONS },
+    [PERF_CYCLES] = { "cycles", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CPU_CYCLES },
+    [PERF_INSTRUCTIONS] = { "instructions", PERF_TYPE_HARDWARE, PERF_COUNT_HW_INSTRUCTIONS },
+    [PERF_CACHE_MISSES] = { "cache_misses", PERF_TYPE_HARDWARE, PERF_COUNT_HW_CACHE_MISSES },
+};
+
+const char *perf_counter_name(enum PerfCounterKind kind) {
+    return counters[kind].name;
+}
+
+// Parses a kernel cpulist such as "0-3,8,10-11"
+static int read_online_cpus(int *cpus, int max) {
+    char buf[4096];
+    int count = 0;
+
+    if (read_file("/sys/devices/system/cpu/online", buf, sizeof(buf)) != 0) {
+        return -1;
+    }
+
+    for (char *p = buf; *p && *p != '\n' && count < max; ) {
+        char *end;
+        long first = strtol(p, &end, 10);
+        long last = first;
+
+        if (end == p) break;
+        if (*end == '-') {
+            p = end + 1;
+            last = strtol(p, &end, 10);
+        }
+
+        for (long cpu = first; cpu <= last && count < max; cpu++) {
+            cpus[count++] = (int)cpu;
+        }
+
+        p = *end == ',' ? end + 1 : end;
+    }
+
+    return count;
+}
+
+static int open_counter(enum PerfCounterKind kind, int cgroup_fd, int cpu) {
+    struct perf_event_attr attr = {
+        .size = sizeof(attr),
+        .type = counters[kind].type,
+        .config = counters[kind].config,
+        .read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING,
+    };
+
+    return (int)syscall(SYS_perf_event_open, &attr, cgroup_fd, cpu, -1, PERF_FLAG_PID_CGROUP | PERF_FLAG_FD_CLOEXEC);
+}
+
+/*
+ * Opens every counter on every online CPU for the sandbox cgroup. Hardware events are
+ * optional (VMs often have no PMU); the software ones only fail when perf is restricted.
+ */
+int perf_open(struct PerfCounters *perf, const char *cgroup) {
+    int cpus[PERF_MAX_CPUS];
+
+    *perf = (struct PerfCounters) { 0 };
+
+    int ncpus = read_online_cpus(cpus, PERF_MAX_CPUS);
+    if (ncpus <= 0) {
+        printf("Warning: cannot list online CPUs, --perf-counters disabled\n");
+        return -1;
+    }
+
+    int cgroup_fd = open(cgroup, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (cgroup_fd == -1) {
+        printf("Error opening %s: %s\n", cgroup, strerror(errno));
+        return -1;
+    }
+
+    perf->ncpus = ncpus;
+
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; kind++) {
+        perf->fds[kind] = malloc(ncpus * sizeof(int));
+        if (!perf->fds[kind]) {
+            printf("failed allocating perf counters\n");
+            close(cgroup_fd);
+            perf_close(perf);
+            return -1;
+        }
+
+        for (int i = 0; i < ncpus; i++) {
+            perf->fds[kind][i] = -1;
+        }
+
+        for (int i = 0; i < ncpus; i++) {
+            perf->fds[kind][i] = open_counter(kind, cgroup_fd, cpus[i]);
+
+            // The cgroup fd is rejected without CONFIG_CGROUP_PERF or outside cgroupfs
+            if (perf->fds[kind][i] == -1 && errno == EBADF) {
+                printf("Warning: no perf_event support for cgroup %s, --perf-counters disabled\n", cgroup);
+                close(cgroup_fd);
+                perf_close(perf);
+                return -1;
+            }
+
+            if (perf->fds[kind][i] == -1 && i == 0 && counters[kind].type == PERF_TYPE_SOFTWARE) {
+                printf("Warning: perf_event_open(%s) failed: %s\n", counters[kind].name, strerror(errno));
+            }
+
+            // Unsupported on the first CPU means unsupported everywhere
+            if (perf->fds[kind][i] == -1 && i == 0) {
+                break;
+            }
+        }
+    }
+
+    close(cgroup_fd);
+    return 0;
+}
+
+void perf_read(const struct PerfCounters *perf, struct PerfTotals *totals) {
+    memset(totals, 0, sizeof(*totals));
+
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; kind++) {
+        if (!perf->fds[kind]) continue;
+
+        for (int i = 0; i < perf->ncpus; i++) {
+            uint64_t value[3]; // count, time enabled, time running
+
+            if (perf->fds[kind][i] == -1 || read(perf->fds[kind][i], value, sizeof(value)) != sizeof(value)) {
+                continue;
+            }
+
+            totals->supported[kind] = 1;
+
+            // Scale up counters the kernel had to time-share with others
+            if (value[2] > 0 && value[2] < value[1]) {
+                value[0] = (uint64_t)((double)value[0] * value[1] / value[2]);
+            }
+            totals->values[kind] += value[0];
+        }
+    }
+}
+
+void perf_close(struct PerfCounters *perf) {
+    for (int kind = 0; kind < PERF_COUNTER_COUNT; kind++) {
+        if (!perf->fds[kind]) continue;
+
+        for (int i = 0; i < perf->ncpus; i++) {
+            if (perf->fds[kind][i] != -1) close(perf->fds[kind][i]);
+        }
+
+        free(perf->fds[kind]);
+        perf->fds[kind] = NULL;
+    }
+}
@@ -0,0 +1,282 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <pthread.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "pipeline.h"
+
+/**
+ * Relay - Supervisor tap on the output of one stage (--tap).
+ *
+ * The stage writes into a pipe we own, and the relay splices it on to the next stage
+ * (or our stdout). splice() only moves page references between the pipes, so the data
+ * is still not copied through user space; it just gets counted on the way.
+ */
+struct Relay {
+    int in;
+    int out;
+    unsigned long long bytes;
+    pthread_t thread;
+};
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+// Fallback for outputs splice() cannot write to, such as some terminals
+static int copy_chunk(struct Relay *relay) {
+    char buffer[65536];
+    ssize_t n = read(relay->in, buffer, sizeof(buffer));
+
+    if (n <= 0) {
+        return (int)n;
+    }
+
+    for (ssize_t done = 0; done < n; ) {
+        ssize_t written = write(relay->out, buffer + done, n - done);
+        if (written == -1 && errno == EINTR) continue;
+        if (written <= 0) return -1;
+        done += written;
+    }
+
+    relay->bytes += n;
+    return 1;
+}
+
+static void *relay_stage_output(void *arg) {
+    struct Relay *relay = arg;
+    int use_splice = 1;
+
+    for (;;) {
+        if (use_splice) {
+            ssize_t n = splice(relay->in, NULL, relay->out, NULL, PIPELINE_PIPE_SIZE, SPLICE_F_MOVE);
+
+            if (n > 0) {
+                relay->bytes += n;
+                continue;
+            }
+
+            if (n == -1 && errno == EINTR) continue;
+
+            if (n == -1 && errno == EINVAL && relay->bytes == 0) {
+                use_splice = 0;
+                continue;
+            }
+
+            break;
+        }
+
+        int ret = copy_chunk(relay);
+        if (ret == -1 && errno == EINTR) continue;
+        if (ret <= 0) break;
+    }
+
+    // Closing our read end hands SIGPIPE to the stage if the consumer went away early
+    close(relay->in);
+    if (relay->out != STDOUT_FILENO) {
+        close(relay->out);
+    }
+
+    return NULL;
+}
+
+static int make_pipe(int fds[2]) {
+    if (pipe2(fds, O_CLOEXEC) == -1) {
+        printf("failed creating pipeline pipe: %s\n", strerror(errno));
+        return -1;
+    }
+
+    // Best effort, the default 64 KiB still works
+    fcntl(fds[1], F_SETPIPE_SZ, PIPELINE_PIPE_SIZE);
+    return 0;
+}
+
+static void close_fds(int *fds, int count) {
+    for (int i = 0; i < count; i++) {
+        if (fds[i] != -1) {
+            close(fds[i]);
+            fds[i] = -1;
+        }
+    }
+}
+
+static pid_t start_stage(struct PipelineStage *stage, int *fds, int fd_count) {
+    fflush(stdout);
+    fflush(stderr);
+
+    pid_t pid = fork();
+
+    if (pid == 0) {
+        // Keep only our own ends, or a stage would never see EOF from the one before it
+        for (int i = 0; i < fd_count; i++) {
+            if (fds[i] != -1 && fds[i] != stage->config.stdio_fds[STDIN_FILENO] &&
+                fds[i] != stage->config.stdio_fds[STDOUT_FILENO]) {
+                close(fds[i]);
+            }
+        }
+
+        // setup_sandbox() also returns in the forked namespace child; both just exit
+        _exit(setup_sandbox(&stage->config, &stage->limits) & 0xff);
+    }
+
+    if (pid < 0) {
+        perror("fork failed");
+    }
+
+    return pid;
+}
+
+static int exit_code(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+
+    return WEXITSTATUS(status);
+}
+
+/*
+ * Starts every stage in its own sandbox and connects stage i's stdout to stage i+1's
+ * stdin. By default the stages get the pipe ends directly and the data never passes
+ * through runbox. With `tap` each stage writes into its own pipe instead and a relay
+ * splices it on, counting bytes for the per-stage throughput in the report.
+ *
+ * Returns the status of the last stage that failed, like `set -o pipefail`.
+ */
+int run_pipeline(struct PipelineStage *stages, int count, int tap) {
+    // fds[2i], fds[2i+1]: read and write end of stage i's output pipe; with tap
+    // fds[2*count + 2i], fds[2*count + 2i+1]: pipe the relay feeds into stage i+1
+    int fds[4 * MAX_PIPELINE_STAGES];
+    int fd_count = 4 * count;
+    struct Relay relays[MAX_PIPELINE_STAGES];
+    pid_t pids[MAX_PIPELINE_STAGES];
+    double started[MAX_PIPELINE_STAGES], finished[MAX_PIPELINE_STAGES];
+    int statuses[MAX_PIPELINE_STAGES];
+    int running = count;   // Stages actually started; count still lays out fds
+    int ret = 0;
+
+    for (int i = 0; i < fd_count; i++) {
+        fds[i] = -1;
+    }
+
+    // The last stage writes straight to our stdout unless it is tapped
+    for (int i = 0; i < count; i++) {
+        if ((i < count - 1 || tap) && make_pipe(&fds[2 * i]) != 0) {
+            close_fds(fds, fd_count);
+            return -1;
+        }
+
+        if (tap && i < count - 1 && make_pipe(&fds[2 * count + 2 * i]) != 0) {
+            close_fds(fds, fd_count);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < count; i++) {
+        struct Config *config = &stages[i].config;
+
+        config->stdio_fds[STDOUT_FILENO] = fds[2 * i + 1];
+        if (i > 0) {
+            config->stdio_fds[STDIN_FILENO] = tap ? fds[2 * count + 2 * (i - 1)] : fds[2 * (i - 1)];
+        }
+    }
+
+    double pipeline_started = monotonic_seconds();
+
+    for (int i = 0; i < count; i++) {
+        started[i] = monotonic_seconds();
+        pids[i] = start_stage(&stages[i], fds, fd_count);
+
+        if (pids[i] < 0) {
+            running = i;
+            ret = -1;
+            break;
+        }
+    }
+
+    // Only now: an ignored SIGPIPE would be inherited by the workloads through exec
+    signal(SIGPIPE, SIG_IGN);
+
+    for (int i = 0; tap && i < running; i++) {
+        relays[i] = (struct Relay) {
+            .in = fds[2 * i],
+            .out = i < count - 1 ? fds[2 * count + 2 * i + 1] : STDOUT_FILENO,
+        };
+        fds[2 * i] = -1;
+        if (i < count - 1) {
+            fds[2 * count + 2 * i + 1] = -1;
+        }
+
+        if (pthread_create(&relays[i].thread, NULL, relay_stage_output, &relays[i]) != 0) {
+            printf("failed starting relay for stage %d\n", i + 1);
+            close(relays[i].in);
+            if (relays[i].out != STDOUT_FILENO) close(relays[i].out);
+            relays[i].thread = 0;
+        }
+    }
+
+    // The stages hold their own ends now
+    close_fds(fds, fd_count);
+
+    for (int reaped = 0; reaped < running; ) {
+        int status;
+        pid_t pid = waitpid(-1, &status, 0);
+
+        if (pid == -1) {
+            if (errno == EINTR) continue;
+            break;
+        }
+
+        for (int i = 0; i < running; i++) {
+            if (pids[i] == pid) {
+                finished[i] = monotonic_seconds();
+                statuses[i] = exit_code(status);
+                reaped++;
+            }
+        }
+    }
+
+    for (int i = 0; tap && i < running; i++) {
+        if (relays[i].thread) {
+            pthread_join(relays[i].thread, NULL);
+        }
+    }
+
+    double pipeline_wall = monotonic_seconds() - pipeline_started;
+
+    for (int i = 0; i < running; i++) {
+        double wall = finished[i] - started[i];
+
+        fprintf(stderr, "runbox: stage %d '%s' exit_status=%d wall=%.3fs", i + 1, stages[i].label,
+                statuses[i], wall);
+
+        if (tap) {
+            fprintf(stderr, " out=%.1fMiB rate=%.1fMiB/s", relays[i].bytes / (1024.0 * 1024.0),
+                    wall > 0 ? relays[i].bytes / (1024.0 * 1024.0) / wall : 0);
+        }
+
+        fprintf(stderr, "\n");
+
+        if (statuses[i] != 0) {
+            ret = statuses[i];
+        }
+    }
+
+    fprintf(stderr, "runbox: pipeline stages=%d wall=%.3fs", running, pipeline_wall);
+    if (tap && running > 0) {
+        fprintf(stderr, " out=%.1fMiB rate=%.1fMiB/s", relays[running - 1].bytes / (1024.0 * 1024.0),
+                pipeline_wall > 0 ? relays[running - 1].bytes / (1024.0 * 1024.0) / pipeline_wall : 0);
+    }
+    fprintf(stderr, "\n");
+
+    return ret;
+}
@@ -0,0 +1,304 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/mount.h>
+#include <sys/wait.h>
+#include <fcntl.h>
+#include <sched.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "namespaces.h"
+#include "pod.h"
+
+static const struct {
+    const char *name;
+    int type;
+} pod_namespaces[] = {
+    { "net", CLONE_NEWNET },
+    { "ipc", CLONE_NEWIPC },
+    { "uts", CLONE_NEWUTS },
+};
+
+#define POD_NAMESPACE_COUNT (sizeof(pod_namespaces) / sizeof(pod_namespaces[0]))
+
+int validate_pod_name(const char *name) {
+    // Becomes a directory, a cgroup and the hostname of the members
+    if (name[0] == '\0' || name[0] == '.' || name[0] == '-' || strlen(name) > POD_NAME_MAX) {
+        return -1;
+    }
+
+    for (const char *p = name; *p; p++) {
+        if (!(*p >= 'a' && *p <= 'z') && !(*p >= 'A' && *p <= 'Z') && !(*p >= '0' && *p <= '9') &&
+            *p != '-' && *p != '_') {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static void pod_path(const struct Pod *pod, const char *file, char *buffer, size_t size) {
+    if (file) {
+        snprintf(buffer, size, POD_DIR "/%s/%s", pod->name, file);
+    } else {
+        snprintf(buffer, size, POD_DIR "/%s", pod->name);
+    }
+}
+
+static int ensure_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        printf("failed creating %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// The pins are nsfs files mounted over regular files in the pod directory
+static int is_pinned(const struct Pod *pod, const char *file) {
+    char path[POD_PATH_MAX], dir[POD_PATH_MAX];
+    struct stat st, parent;
+
+    pod_path(pod, file, path, sizeof(path));
+    pod_path(pod, NULL, dir, sizeof(dir));
+
+    if (stat(path, &st) == -1 || stat(dir, &parent) == -1) {
+        return 0;
+    }
+
+    return st.st_dev != parent.st_dev;
+}
+
+/*
+ * Creates the pod namespaces in a helper that leaves our own alone. The helper stays in
+ * the host mount namespace, so its bind mounts of /proc/self/ns/<type> are the host pins.
+ */
+static int create_pod_namespaces(const struct Pod *pod) {
+    char path[POD_PATH_MAX];
+
+    for (size_t i = 0; i < POD_NAMESPACE_COUNT; i++) {
+        pod_path(pod, pod_namespaces[i].name, path, sizeof(path));
+
+        int fd = open(path, O_WRONLY | O_CREAT | O_CLOEXEC, 0444);
+        if (fd == -1) {
+            printf("failed creating %s: %s\n", path, strerror(errno));
+            return -1;
+        }
+        close(fd);
+    }
+
+    pid_t pid = fork();
+    if (pid == 0) {
+        if (unshare(CLONE_NEWNET | CLONE_NEWIPC | CLONE_NEWUTS) == -1) {
+            printf("unshare failed while creating pod namespaces: %s\n", strerror(errno));
+            _exit(1);
+        }
+
+        // Members talk over localhost, which a fresh network namespace has down
+        if (bring_up_loopback() == -1) {
+            printf("failed bringing up loopback in pod %s: %s\n", pod->name, strerror(errno));
+            _exit(1);
+        }
+
+        if (sethostname(pod->name, strlen(pod->name)) == -1) {
+            printf("sethostname failed for pod %s: %s\n", pod->name, strerror(errno));
+            _exit(1);
+        }
+
+        for (size_t i = 0; i < POD_NAMESPACE_COUNT; i++) {
+            char source[64];
+
+            snprintf(source, sizeof(source), "/proc/self/ns/%s", pod_namespaces[i].name);
+            pod_path(pod, pod_namespaces[i].name, path, sizeof(path));
+
+            if (mount(source, path, NULL, MS_BIND, NULL) == -1) {
+                printf("failed pinning pod namespace %s: %s\n", path, strerror(errno));
+                _exit(1);
+            }
+        }
+
+        _exit(0);
+    } else if (pid < 0) {
+        perror("fork failed");
+        return -1;
+    }
+
+    int status;
+    if (waitpid(pid, &status, 0) == -1 || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return -1;
+    }
+
+    pod_path(pod, "shm", path, sizeof(path));
+    if (ensure_dir(path) != 0) {
+        return -1;
+    }
+
+    if (mount("tmpfs", path, "tmpfs", MS_NOSUID | MS_NODEV, "mode=1777") == -1) {
+        printf("failed mounting pod shm on %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(stderr, "runbox: created pod '%s'\n", pod->name);
+    return 0;
+}
+
+static void remove_pod(const struct Pod *pod) {
+    char path[POD_PATH_MAX];
+
+    for (size_t i = 0; i < POD_NAMESPACE_COUNT; i++) {
+        pod_path(pod, pod_namespaces[i].name, path, sizeof(path));
+        umount2(path, MNT_DETACH);
+        unlink(path);
+    }
+
+    pod_path(pod, "shm", path, sizeof(path));
+    umount2(path, MNT_DETACH);
+    rmdir(path);
+
+    pod_path(pod, "lock", path, sizeof(path));
+    unlink(path);
+
+    pod_path(pod, NULL, path, sizeof(path));
+    rmdir(path);
+
+    // Only empty cgroups can be removed, so this is a no-op while the members' cgroups remain
+    char cgroup[sizeof("/sys/fs/cgroup/runbox/") + sizeof(pod->group)];
+    snprintf(cgroup, sizeof(cgroup), "/sys/fs/cgroup/runbox/%s", pod->group);
+    rmdir(cgroup);
+}
+
+static int lock_file(const char *path, int operation) {
+    int fd = open(path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (fd == -1) {
+        printf("Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    while (flock(fd, operation) == -1) {
+        if (errno != EINTR) {
+            printf("failed locking %s: %s\n", path, strerror(errno));
+            close(fd);
+            return -1;
+        }
+    }
+
+    return fd;
+}
+
+/*
+ * Joins the pod, creating it if this is its first member. Runs in the launcher before
+ * anything is forked; the sandbox init inherits the namespace fds.
+ */
+int open_pod(struct Pod *pod) {
+    char path[POD_PATH_MAX];
+
+    pod->lock_fd = pod->net_fd = pod->ipc_fd = pod->uts_fd = -1;
+    if (pod->tenant) {
+        snprintf(pod->group, sizeof(pod->group), "%s/pod-%s", pod->tenant, pod->name);
+    } else {
+        snprintf(pod->group, sizeof(pod->group), "pod-%s", pod->name);
+    }
+
+    pod_path(pod, NULL, path, sizeof(path));
+    if (ensure_dir(RUNBOX_STATE_DIR) != 0 || ensure_dir(POD_DIR) != 0) {
+        return -1;
+    }
+
+    // Creating, joining and removing pods are serialized host-wide; all of them are quick
+    int mutex_fd = lock_file(POD_MUTEX, LOCK_EX);
+    if (mutex_fd == -1) {
+        return -1;
+    }
+
+    pod_path(pod, NULL, path, sizeof(path));
+    if (ensure_dir(path) != 0) {
+        close(mutex_fd);
+        return -1;
+    }
+
+    // Membership: every member holds the pod lock shared for as long as it runs
+    pod_path(pod, "lock", path, sizeof(path));
+    pod->lock_fd = lock_file(path, LOCK_SH);
+    if (pod->lock_fd == -1) {
+        close(mutex_fd);
+        return -1;
+    }
+
+    int ret = 0;
+
+    if (!is_pinned(pod, "net")) {
+        ret = create_pod_namespaces(pod);
+    }
+
+    int *fds[] = { &pod->net_fd, &pod->ipc_fd, &pod->uts_fd };
+
+    for (size_t i = 0; ret == 0 && i < POD_NAMESPACE_COUNT; i++) {
+        pod_path(pod, pod_namespaces[i].name, path, sizeof(path));
+
+        *fds[i] = open(path, O_RDONLY | O_CLOEXEC);
+        if (*fds[i] == -1) {
+            printf("Error opening %s: %s\n", path, strerror(errno));
+            ret = -1;
+        }
+    }
+
+    close(mutex_fd);
+
+    if (ret != 0) {
+        close_pod(pod);
+        return -1;
+    }
+
+    pod_path(pod, "shm", pod->shm_path, sizeof(pod->shm_path));
+    return 0;
+}
+
+// Called by the sandbox init while it still has its host capabilities
+int join_pod_namespaces(const struct Pod *pod) {
+    const int fds[] = { pod->net_fd, pod->ipc_fd, pod->uts_fd };
+
+    for (size_t i = 0; i < POD_NAMESPACE_COUNT; i++) {
+        if (setns(fds[i], pod_namespaces[i].type) == -1) {
+            printf("setns failed joining the %s namespace of pod %s: %s\n", pod_namespaces[i].name,
+                   pod->name, strerror(errno));
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+// Leaves the pod; the last member out unpins its namespaces
+void close_pod(struct Pod *pod) {
+    int *fds[] = { &pod->net_fd, &pod->ipc_fd, &pod->uts_fd };
+
+    for (size_t i = 0; i < POD_NAMESPACE_COUNT; i++) {
+        if (*fds[i] != -1) {
+            close(*fds[i]);
+            *fds[i] = -1;
+        }
+    }
+
+    if (pod->lock_fd == -1) {
+        return;
+    }
+
+    int mutex_fd = lock_file(POD_MUTEX, LOCK_EX);
+
+    // Only succeeds if no other member holds the pod lock
+    if (mutex_fd != -1 && flock(pod->lock_fd, LOCK_EX | LOCK_NB) == 0) {
+        remove_pod(pod);
+    }
+
+    close(pod->lock_fd);
+    pod->lock_fd = -1;
+
+    if (mutex_fd != -1) {
+        close(mutex_fd);
+    }
+}
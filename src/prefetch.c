@@ -0,0 +1,475 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mman.h>
+#include <sys/fanotify.h>
+#include <sys/syscall.h>
+#include <fcntl.h>
+#include <poll.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "sha256.h"
+#include "runbox.h"
+#include "prefetch.h"
+
+static long long monotonic_ms(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000LL + ts.tv_nsec / 1000000;
+}
+
+static void free_files(struct Prefetch *prefetch) {
+    for (int i = 0; i < prefetch->count; i++) {
+        free(prefetch->files[i].path);
+        free(prefetch->files[i].ranges);
+    }
+    free(prefetch->files);
+    prefetch->files = NULL;
+    prefetch->count = 0;
+}
+
+static struct PrefetchFile *add_file(struct Prefetch *prefetch, const char *path) {
+    if (prefetch->count == PREFETCH_MAX_FILES) {
+        return NULL;
+    }
+
+    struct PrefetchFile *files = realloc(prefetch->files, (prefetch->count + 1) * sizeof(*files));
+    if (!files) {
+        return NULL;
+    }
+
+    prefetch->files = files;
+    files[prefetch->count] = (struct PrefetchFile) { .path = strdup(path) };
+    if (!files[prefetch->count].path) {
+        return NULL;
+    }
+
+    return &files[prefetch->count++];
+}
+
+static int add_range(struct PrefetchFile *file, off_t offset, off_t length) {
+    off_t (*ranges)[2] = realloc(file->ranges, (file->count + 1) * sizeof(*ranges));
+    if (!ranges) {
+        return -1;
+    }
+
+    file->ranges = ranges;
+    ranges[file->count][0] = offset;
+    ranges[file->count][1] = length;
+    file->count++;
+    return 0;
+}
+
+// Lines are "<offset>\t<length>\t<path>"; consecutive lines of one path make up one file
+static int read_list(struct Prefetch *prefetch) {
+    char line[PATH_MAX + 64];
+
+    FILE *f = fopen(prefetch->list_path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    struct PrefetchFile *file = NULL;
+
+    while (fgets(line, sizeof(line), f)) {
+        long long offset, length;
+        int pos;
+
+        line[strcspn(line, "\n")] = '\0';
+        if (sscanf(line, "%lld\t%lld\t%n", &offset, &length, &pos) != 2 || offset < 0 || length <= 0) {
+            continue;
+        }
+
+        if (!file || strcmp(file->path, line + pos) != 0) {
+            file = add_file(prefetch, line + pos);
+        }
+        if (!file || add_range(file, offset, length) != 0) {
+            break;
+        }
+    }
+
+    fclose(f);
+    return 0;
+}
+
+static void write_list(struct Prefetch *prefetch) {
+    char tmp_path[PATH_MAX + 32];
+    unsigned long long bytes = 0;
+
+    if ((mkdir("/var/cache/runbox", 0755) == -1 && errno != EEXIST) ||
+        (mkdir(PREFETCH_DIR, 0755) == -1 && errno != EEXIST)) {
+        printf("Warning: cannot create %s: %s\n", PREFETCH_DIR, strerror(errno));
+        return;
+    }
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s.%d.tmp", prefetch->list_path, getpid());
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        printf("Warning: cannot write %s: %s\n", tmp_path, strerror(errno));
+        return;
+    }
+
+    for (int i = 0; i < prefetch->count; i++) {
+        for (int j = 0; j < prefetch->files[i].count; j++) {
+            fprintf(f, "%lld\t%lld\t%s\n", (long long)prefetch->files[i].ranges[j][0],
+                    (long long)prefetch->files[i].ranges[j][1], prefetch->files[i].path);
+            bytes += prefetch->files[i].ranges[j][1];
+        }
+    }
+
+    if (fclose(f) != 0 || rename(tmp_path, prefetch->list_path) == -1) {
+        printf("Warning: cannot write %s: %s\n", prefetch->list_path, strerror(errno));
+        unlink(tmp_path);
+        return;
+    }
+
+    fprintf(stderr, "runbox: recorded prefetch list (%d files, %.1f MiB)\n", prefetch->count,
+            bytes / (1024.0 * 1024.0));
+}
+
+// Worker: read ahead the ranges of one file after another; the kernel does the I/O in the background
+static void *prefetch_worker(void *arg) {
+    struct Prefetch *prefetch = arg;
+    int i;
+
+    while ((i = __atomic_fetch_add(&prefetch->next, 1, __ATOMIC_RELAXED)) < prefetch->count) {
+        struct PrefetchFile *file = &prefetch->files[i];
+
+        int fd = open(file->path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+        if (fd == -1) {
+            continue;
+        }
+
+        for (int j = 0; j < file->count; j++) {
+            if (readahead(fd, file->ranges[j][0], file->ranges[j][1]) == -1) {
+                posix_fadvise(fd, file->ranges[j][0], file->ranges[j][1], POSIX_FADV_WILLNEED);
+            }
+        }
+
+        close(fd);
+    }
+
+    return NULL;
+}
+
+// The list belongs to what the workload runs and what it runs on
+static void list_path(struct Prefetch *prefetch, const struct Config *config) {
+    char hex[SHA256_HEX_SIZE];
+    struct Sha256 hash;
+
+    sha256_init(&hash);
+    sha256_update(&hash, prefetch->lowerdir, strlen(prefetch->lowerdir) + 1);
+    sha256_update(&hash, prefetch->host_dirs ? "host" : "", prefetch->host_dirs ? 5 : 1);
+
+    if (config->command) {
+        for (char **arg = config->command; *arg; arg++) {
+            sha256_update(&hash, *arg, strlen(*arg) + 1);
+        }
+    } else {
+        sha256_update(&hash, "<shell>", 8);
+    }
+
+    sha256_final_hex(&hash, hex);
+    snprintf(prefetch->list_path, sizeof(prefetch->list_path), PREFETCH_DIR "/%s", hex);
+}
+
+/*
+ * Starts reading ahead the workload's recorded files, or marks the run for recording if
+ * there is no list yet. Called right before the namespace child is forked, so the reads
+ * overlap its setup.
+ */
+int prefetch_begin(struct Prefetch *prefetch, const struct Config *config, const char *lowerdir,
+                   const struct VolumeSpec *volumes, int volume_count) {
+    *prefetch = (struct Prefetch) {
+        .window_ms = config->prefetch,
+        .host_dirs = !config->image,
+        .volumes = volumes,
+        .volume_count = volume_count,
+        .fanotify_fd = -1,
+    };
+
+    snprintf(prefetch->lowerdir, sizeof(prefetch->lowerdir), "%s", lowerdir ? lowerdir : "");
+    list_path(prefetch, config);
+
+    if (read_list(prefetch) != 0) {
+        prefetch->recording = 1;
+        return 0;
+    }
+
+    int threads = prefetch->count < PREFETCH_THREADS ? prefetch->count : PREFETCH_THREADS;
+    for (int i = 0; i < threads; i++) {
+        if (pthread_create(&prefetch->threads[i], NULL, prefetch_worker, prefetch) != 0) {
+            break;
+        }
+        prefetch->nthreads++;
+    }
+
+    return 0;
+}
+
+/*
+ * Namespace child, before the init is forked: watch every mount of the sandbox root for
+ * opened files. Mount marks stay on the mounts through the pivot, and only see accesses
+ * made through them, so nothing else on the host ends up in the list.
+ */
+int prefetch_mark_mounts(const char *root) {
+    char line[PATH_MAX * 2];
+    size_t root_len = strlen(root);
+    int marked = 0;
+
+    int fd = fanotify_init(FAN_CLASS_NOTIF | FAN_CLOEXEC | FAN_NONBLOCK, O_RDONLY | O_LARGEFILE | O_CLOEXEC);
+    if (fd == -1) {
+        printf("Warning: prefetch recording unavailable, fanotify_init failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    FILE *f = fopen("/proc/self/mountinfo", "r");
+    if (!f) {
+        printf("Warning: prefetch recording unavailable: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    while (fgets(line, sizeof(line), f)) {
+        char mount_point[PATH_MAX];
+
+        // Field 5 is the mount point; paths with escaped characters are simply not marked
+        if (sscanf(line, "%*s %*s %*s %*s %4095s", mount_point) != 1 ||
+            strncmp(mount_point, root, root_len) != 0 ||
+            (mount_point[root_len] != '\0' && mount_point[root_len] != '/')) {
+            continue;
+        }
+
+        if (fanotify_mark(fd, FAN_MARK_ADD | FAN_MARK_MOUNT, FAN_OPEN, AT_FDCWD, mount_point) == 0) {
+            marked++;
+        }
+    }
+
+    fclose(f);
+
+    if (marked == 0 || dup3(fd, PREFETCH_FANOTIFY_FD, O_CLOEXEC) == -1) {
+        printf("Warning: prefetch recording unavailable, no mount could be watched\n");
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+static int same_file(const char *path, const struct stat *st) {
+    struct stat host;
+
+    // overlayfs reports the inode number of the layer file, on a device of its own
+    return stat(path, &host) == 0 && S_ISREG(host.st_mode) && host.st_ino == st->st_ino &&
+           host.st_size == st->st_size;
+}
+
+// Finds where on the host a file the sandbox opened lives, so later runs can read it
+static int host_path(const struct Prefetch *prefetch, const char *path, const struct stat *st, char *out,
+                     size_t size) {
+    // Volumes are mounted last, on top of everything else
+    for (int i = prefetch->volume_count - 1; i >= 0; i--) {
+        const char *sandbox_path = prefetch->volumes[i].sandbox_path;
+        size_t len = strlen(sandbox_path);
+
+        if (strncmp(path, sandbox_path, len) == 0 && (path[len] == '/' || path[len] == '\0')) {
+            snprintf(out, size, "%s%s", prefetch->volumes[i].host_path, path + len);
+            return same_file(out, st) ? 0 : -1;
+        }
+    }
+
+    if (prefetch->host_dirs) {
+        snprintf(out, size, "%s", path);
+        if (same_file(out, st)) {
+            return 0;
+        }
+    }
+
+    const char *layer = prefetch->lowerdir;
+    while (*layer) {
+        size_t len = strcspn(layer, ":");
+        snprintf(out, size, "%.*s%s", (int)len, layer, path);
+        if (same_file(out, st)) {
+            return 0;
+        }
+        layer += len + (layer[len] == ':');
+    }
+
+    return -1;
+}
+
+// Records the file behind one event, once per inode
+static void record_event(struct Prefetch *prefetch, int fd, dev_t *devs, ino_t *inos) {
+    char link[64];
+    char path[PATH_MAX];
+    char resolved[PATH_MAX];
+    struct stat st;
+
+    if (fstat(fd, &st) == -1 || !S_ISREG(st.st_mode) || st.st_size == 0) {
+        return;
+    }
+
+    for (int i = 0; i < prefetch->count; i++) {
+        if (devs[i] == st.st_dev && inos[i] == st.st_ino) {
+            return;
+        }
+    }
+
+    // The link shows the path as the sandbox sees it
+    snprintf(link, sizeof(link), "/proc/self/fd/%d", fd);
+    ssize_t n = readlink(link, path, sizeof(path) - 1);
+    if (n <= 0) {
+        return;
+    }
+    path[n] = '\0';
+
+    if (host_path(prefetch, path, &st, resolved, sizeof(resolved)) != 0) {
+        return;
+    }
+
+    devs[prefetch->count] = st.st_dev;
+    inos[prefetch->count] = st.st_ino;
+    add_file(prefetch, resolved);
+}
+
+// Turns each recorded file into the runs of its pages that are in the page cache
+static void record_ranges(struct PrefetchFile *file) {
+    long page = sysconf(_SC_PAGESIZE);
+    struct stat st;
+
+    int fd = open(file->path, O_RDONLY | O_CLOEXEC | O_NOFOLLOW);
+    if (fd == -1) {
+        return;
+    }
+
+    if (fstat(fd, &st) == -1 || st.st_size == 0) {
+        close(fd);
+        return;
+    }
+
+    size_t pages = (st.st_size + page - 1) / page;
+    unsigned char *resident = malloc(pages);
+    void *map = mmap(NULL, st.st_size, PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+
+    // Without residency information the whole file is read ahead
+    if (!resident || map == MAP_FAILED || mincore(map, st.st_size, resident) == -1) {
+        add_range(file, 0, st.st_size);
+    } else {
+        size_t start = 0;
+        for (size_t i = 0; i <= pages; i++) {
+            if (i < pages && (resident[i] & 1)) continue;
+
+            if (i > start) {
+                off_t end = (off_t)i * page < st.st_size ? (off_t)i * page : st.st_size;
+                add_range(file, (off_t)start * page, end - (off_t)start * page);
+            }
+            start = i + 1;
+        }
+    }
+
+    if (map != MAP_FAILED) {
+        munmap(map, st.st_size);
+    }
+    free(resident);
+}
+
+static void *recorder_thread(void *arg) {
+    struct Prefetch *prefetch = arg;
+    char buf[4096] __attribute__((aligned(__alignof__(struct fanotify_event_metadata))));
+    dev_t *devs = calloc(PREFETCH_MAX_FILES, sizeof(*devs));
+    ino_t *inos = calloc(PREFETCH_MAX_FILES, sizeof(*inos));
+    long long deadline = monotonic_ms() + prefetch->window_ms;
+    long long now;
+
+    if (!devs || !inos) {
+        goto out;
+    }
+
+    while ((now = monotonic_ms()) < deadline) {
+        struct pollfd pfd = { .fd = prefetch->fanotify_fd, .events = POLLIN };
+        if (poll(&pfd, 1, (int)(deadline - now)) <= 0) {
+            continue;
+        }
+
+        ssize_t len = read(prefetch->fanotify_fd, buf, sizeof(buf));
+        if (len <= 0) {
+            continue;
+        }
+
+        struct fanotify_event_metadata *event = (struct fanotify_event_metadata *)buf;
+        for (; FAN_EVENT_OK(event, len); event = FAN_EVENT_NEXT(event, len)) {
+            if (event->fd < 0) continue;
+
+            if (prefetch->count < PREFETCH_MAX_FILES) {
+                record_event(prefetch, event->fd, devs, inos);
+            }
+            close(event->fd);
+        }
+    }
+
+    close(prefetch->fanotify_fd);
+    prefetch->fanotify_fd = -1;
+
+    for (int i = 0; i < prefetch->count; i++) {
+        record_ranges(&prefetch->files[i]);
+    }
+
+    if (prefetch->count > 0) {
+        write_list(prefetch);
+    }
+
+out:
+    free(devs);
+    free(inos);
+    return NULL;
+}
+
+// Launcher, before the start signal: take over the init's fanotify group and record from it
+void prefetch_record(struct Prefetch *prefetch, pid_t init_pid) {
+    if (!prefetch->recording) {
+        return;
+    }
+
+    int pidfd = (int)syscall(SYS_pidfd_open, init_pid, 0);
+    if (pidfd == -1) {
+        return;
+    }
+
+    // The namespace child already warned if it could not watch the mounts
+    prefetch->fanotify_fd = (int)syscall(SYS_pidfd_getfd, pidfd, PREFETCH_FANOTIFY_FD, 0);
+    close(pidfd);
+
+    if (prefetch->fanotify_fd == -1) {
+        return;
+    }
+
+    if (pthread_create(&prefetch->recorder, NULL, recorder_thread, prefetch) != 0) {
+        close(prefetch->fanotify_fd);
+        prefetch->fanotify_fd = -1;
+        return;
+    }
+
+    prefetch->recorder_running = 1;
+}
+
+void prefetch_finish(struct Prefetch *prefetch) {
+    for (int i = 0; i < prefetch->nthreads; i++) {
+        pthread_join(prefetch->threads[i], NULL);
+    }
+    prefetch->nthreads = 0;
+
+    if (prefetch->recorder_running) {
+        pthread_join(prefetch->recorder, NULL);
+        prefetch->recorder_running = 0;
+    }
+
+    free_files(prefetch);
+}
@@ -4,112 +4,501 @@
 #include <sys/wait.h>
 #include <sys/prctl.h>
 #include <sys/mount.h>
+#include <sys/syscall.h>
+#include <sys/socket.h>
+#include <fcntl.h>
+#include <sched.h>
 #include <unistd.h>
 #include <stdio.h>
+#include <stdlib.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 #include "namespaces.h"
 #include "seccomp.h"
 #include "cgroup.h"
+#include "state.h"
+#include "supervisor.h"
+#include "trace.h"
+#include "init.h"
+#include "image.h"
+#include "density.h"
+#include "perf.h"
+#include "netpool.h"
 #include "runbox.h"
 
-int setup_sandbox(struct Config *config, struct CgroupLimits *limits) {
+void default_config(struct Config *config, struct CgroupLimits *limits) {
+    *config = (struct Config) {
+        .enable_network = 0,
+        .disable_cgroups = 0,
+        .command = NULL,
+        .payload = NULL,
+        .payload_arg = NULL,
+        .timeout = 0,
+        .cpu_time = 0,
+        .kill_grace = DEFAULT_KILL_GRACE_SECONDS,
+        .report = 0,
+        .trace_file = NULL,
+        .no_init = 0,
+        .image = NULL,
+        .base = NULL,
+        .minimal_root = 0,
+        .admission = ADMISSION_NONE,
+        .memory_merge = 0,
+        .memory_reclaim = 0,
+        .perf_counters = 0,
+        .prefetch = 0,
+        .export_count = 0,
+        .volume_count = 0,
+        .shared_count = 0,
+        .listen_count = 0,
+        .restart = RESTART_NO,
+        .tenant = NULL,
+        .pod = { .name = NULL, .tenant = NULL, .lock_fd = -1, .net_fd = -1, .ipc_fd = -1, .uts_fd = -1 },
+        .netns_pool = 0,
+        .cache = 0,
+        .cache_size = RESULT_CACHE_DEFAULT_SIZE,
+        .input_count = 0,
+        .stdio_fds = { -1, -1, -1 },
+        .exit_report = NULL,
+        .autotune = { 0 }
+    };
+
+    *limits = (struct CgroupLimits) {
+        .memory_enabled = 1,
+        .memory_max = "max",
+        .cpu_enabled = 1,
+        .cpus = 0,
+        .pids_enabled = 1,
+        .pids_max = MAX_CPU_LIMIT,
+        .group = NULL,
+    };
+}
+
+static int lock_down_sandbox(void) {
+    //  To use the `SECCOMP_SET_MODE_FILTER` operation, either the calling thread must have the CAP_SYS_ADMIN
+    //  capability in its user namespace, or the thread must
+    //  already have the no_new_privs bit set
+    if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
+        perror("prctl(PR_SET_NO_NEW_PRIVS)");
+        return -1;
+    }
+
+    // Drop privileged caps
+    drop_bounding_caps();
+
+    // Reset to minimal default capabilities
+    apply_default_capabilities();
+
+    setup_seccomp();
+
+    return 0;
+}
+
+static int exec_workload(char **command) {
+    if (command && command[0]) {
+        return exec_command(command);
+    }
+
+    return exec_shell();
+}
+
+static int exit_code(int status) {
+    if (WIFSIGNALED(status)) {
+        return 128 + WTERMSIG(status);
+    }
+
+    return WEXITSTATUS(status);
+}
+
+static int start_workload(void *arg) {
+    struct Config *config = arg;
+
+    // Built-in workloads (benchmarks) run in-process instead of exec'ing a binary
+    if (config->payload) {
+        return config->payload(config->payload_arg);
+    }
+
+    if (config->listen_count > 0 && pass_listeners(config->listeners, config->listen_count) != 0) {
+        return 127;
+    }
+
+    exec_workload(config->command);
+    return 127;
+}
+
+static void close_hold(int holdfd[2]) {
+    for (int i = 0; i < 2; i++) {
+        if (holdfd[i] != -1) {
+            close(holdfd[i]);
+            holdfd[i] = -1;
+        }
+    }
+}
+
+static void finish_trace(struct Config *config, int ret) {
+    trace_end(TRACE_SANDBOX, ret);
+
+    if (config->trace_file) {
+        trace_dump(config->trace_file);
+        trace_close();
+    }
+}
+
+/*
+ * Used namespaces are replaced rather than put back: sockets the workload left in
+ * TIME_WAIT, or anything else still holding the namespace, would leak into the next
+ * sandbox. Adding the replacement after the sandbox exits keeps it off startup.
+ */
+static void refill_netns_pool(int taken) {
+    if (taken != -1 && netns_pool_add(1) != 0) {
+        fprintf(stderr, "runbox: failed adding a network namespace to the pool\n");
+    }
+}
+
+static int run_sandbox(struct Config *config, struct CgroupLimits *limits, const struct Manifest *manifest,
+                       struct ExitReport *last_report) {
     int pipefd[2];
+    int startfd[2];
+    struct MountSpec mounts = { .manifest = manifest, .volumes = config->volumes, .volume_count = config->volume_count };
+    char lowerdir[IMAGE_LOWERDIR_MAX];
+    struct Admission admission = { .fd = -1, .table = NULL, .slot = -1 };
+    struct Prefetch prefetch = { .fanotify_fd = -1 };
+    int holdfd[2] = { -1, -1 };
+    int netns_fd = -1;
+
+    if (config->cpu_time > 0 && config->disable_cgroups) {
+        printf("--cpu-time requires cgroups\n");
+        return -1;
+    }
+
+    if ((config->autotune.cpu_enabled || config->autotune.memory_enabled) && config->disable_cgroups) {
+        printf("--autotune-cpu / --autotune-memory require cgroups\n");
+        return -1;
+    }
+
+    if (config->memory_reclaim > 0 && config->disable_cgroups) {
+        printf("--memory-reclaim requires cgroups\n");
+        return -1;
+    }
+
+    if (config->perf_counters && config->disable_cgroups) {
+        printf("--perf-counters requires cgroups\n");
+        return -1;
+    }
+
+    if (config->memory_merge) {
+        check_ksm_running();
+    }
+
+    // Resolve the image while errors can still be reported before anything is forked
+    if (config->image || config->base) {
+        if (image_lowerdir(config->image ? config->image : config->base, lowerdir, sizeof(lowerdir)) != 0) {
+            return -1;
+        }
+        mounts.lowerdir = lowerdir;
+        mounts.base = config->base != NULL;
+    }
+
+    // Shared data is mounted like any other read-only volume, after the --volume ones
+    for (int i = 0; i < config->shared_count; i++) {
+        if (mounts.volume_count == MAX_VOLUMES) {
+            printf("too many volumes and shared data files (at most %d)\n", MAX_VOLUMES);
+            return -1;
+        }
+        if (prepare_shared_data(&config->shared[i], &config->volumes[mounts.volume_count]) != 0) {
+            return -1;
+        }
+        mounts.volume_count++;
+    }
+
+    // Every pod member mounts the pod's tmpfs as /dev/shm, for POSIX shared memory between them
+    if (config->pod.name) {
+        if (mounts.volume_count == MAX_VOLUMES) {
+            printf("too many volumes and shared data files (at most %d)\n", MAX_VOLUMES);
+            return -1;
+        }
+        config->volumes[mounts.volume_count++] = (struct VolumeSpec) {
+            .host_path = config->pod.shm_path,
+            .sandbox_path = POD_SHM_SANDBOX_DIR,
+            .read_only = 0,
+        };
+    }
+
+    // The ring buffer has to exist before the first fork so all three processes share it
+    if (config->trace_file && trace_open() != 0) {
+        return -1;
+    }
+
+    trace_begin(TRACE_SANDBOX);
 
     if (pipe(pipefd) == -1) {
         perror("pipe");
         return -1;
     }
 
+    // The launcher releases the workload through this pipe once its cgroup and
+    // supervisor are in place, so limits and accounting cover it from the start
+    if (pipe(startfd) == -1) {
+        perror("pipe");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        return -1;
+    }
+
+    // Lets the namespace child keep the sandbox mounts alive after the init exits, until
+    // the supervisor has copied the exports out
+    if (config->export_count > 0 && socketpair(AF_UNIX, SOCK_STREAM | SOCK_CLOEXEC, 0, holdfd) == -1) {
+        perror("socketpair");
+        close(pipefd[0]);
+        close(pipefd[1]);
+        close(startfd[0]);
+        close(startfd[1]);
+        return -1;
+    }
+
+    // Reserve our limits host-wide before anything is forked; the launcher holds the slot
+    // until the sandbox has exited
+    if (config->admission != ADMISSION_NONE) {
+        trace_begin(TRACE_ADMISSION);
+        int ret = admission_acquire(config->admission, limits, &admission);
+        trace_end(TRACE_ADMISSION, ret);
+
+        if (ret != 0) {
+            close(pipefd[0]);
+            close(pipefd[1]);
+            close(startfd[0]);
+            close(startfd[1]);
+            close_hold(holdfd);
+            finish_trace(config, -1);
+            return -1;
+        }
+    }
+
+    // The reads run in the launcher's threads while the children below set up the sandbox
+    if (config->prefetch) {
+        prefetch_begin(&prefetch, config, mounts.lowerdir, config->volumes, mounts.volume_count);
+    }
+
+    // Claimed here so an empty pool costs the sandbox nothing but the usual unshare()
+    if (config->netns_pool) {
+        netns_fd = netns_pool_take();
+        if (netns_fd == -1) {
+            fprintf(stderr, "runbox: netns pool is empty, creating a network namespace\n");
+        }
+    }
+
     // First fork: isolate namespace setup from main process
+    trace_begin(TRACE_FORK);
     pid_t pid = fork();
     if (pid == 0) {
+        trace_set_role(TRACE_ROLE_NAMESPACE_CHILD);
+
         if (mount(NULL, "/", NULL, MS_REC | MS_PRIVATE, NULL) != 0) {
             printf("failed to private mounts\n");
             return -1;
         }
 
         close(pipefd[0]);
+        close(startfd[1]);
+        if (holdfd[0] != -1) {
+            close(holdfd[0]);
+        }
 
-        if (setup_mount_namespace() != 0) {
+        // Redirected stdio (result cache recorder, pipeline stages) applies to everything in the sandbox
+        for (int fd = 0; fd < 3; fd++) {
+            if (config->stdio_fds[fd] != -1 && dup2(config->stdio_fds[fd], fd) == -1) {
+                perror("dup2");
+                return -1;
+            }
+        }
+
+        int ret;
+
+        trace_begin(TRACE_MOUNT_NS);
+        ret = setup_mount_namespace(&mounts);
+        trace_end(TRACE_MOUNT_NS, ret);
+        if (ret != 0) {
             close(pipefd[1]);
             return -1;
         }
 
-        if (setup_pid_namespace() != 0) {
+        // Recording is best effort; without the watch the run simply records nothing
+        if (prefetch.recording) {
+            prefetch_mark_mounts("/tmp/runbox");
+        }
+
+        trace_begin(TRACE_PID_NS);
+        ret = setup_pid_namespace();
+        trace_end(TRACE_PID_NS, ret);
+        if (ret != 0) {
             close(pipefd[1]);
             return -1;
         }
 
         // Second fork: actually enter the PID namespace (becomes PID 1 (the init process))
+        trace_begin(TRACE_FORK);
         pid_t child_pid = fork();
 
         if (child_pid == 0) {
+            trace_set_role(TRACE_ROLE_INIT);
             close(pipefd[1]);
             close(pipefd[0]);
+            close_hold(holdfd);
 
-            if (setup_pivot_root() != 0) {
+            trace_begin(TRACE_PIVOT_ROOT);
+            ret = setup_pivot_root();
+            trace_end(TRACE_PIVOT_ROOT, ret);
+            if (ret != 0) {
                 printf("failed to pivot root\n");
                 return -1;
             }
 
             // Mount /proc to show processes from the new PID namespace
-            if (mount("proc", "/proc", "proc", 0, NULL) == -1) {
+            trace_begin(TRACE_MOUNT_PROC);
+            ret = mount("proc", "/proc", "proc", 0, NULL);
+            trace_end(TRACE_MOUNT_PROC, ret);
+            if (ret == -1) {
                 printf("failed mounting proc: %s\n", strerror(errno));
                 return -1;
             }
 
-            if (setup_ipc_and_uts_namespace() != 0) {
+            // Pod members join the pod's namespaces (network included) while they still hold
+            // host capabilities; everyone else gets fresh ones
+            trace_begin(TRACE_IPC_UTS_NS);
+            ret = config->pod.name ? join_pod_namespaces(&config->pod) : setup_ipc_and_uts_namespace();
+            trace_end(TRACE_IPC_UTS_NS, ret);
+            if (ret != 0) {
                 return -1;
             }
 
-            if (setup_user_namespace() != 0) {
+            // A pooled namespace belongs to the host user namespace, so it is joined before we leave it
+            if (netns_fd != -1) {
+                trace_begin(TRACE_NET_NS);
+                ret = setns(netns_fd, CLONE_NEWNET);
+                trace_end(TRACE_NET_NS, ret);
+                if (ret == -1) {
+                    printf("setns failed joining the pooled network namespace: %s\n", strerror(errno));
+                    return -1;
+                }
+                close(netns_fd);
+            }
+
+            // PR_SET_MEMORY_MERGE needs CAP_SYS_RESOURCE in the initial user namespace, so it
+            // has to happen before we leave it; the flag then survives fork and exec
+            if (config->memory_merge) {
+                enable_memory_merge();
+            }
+
+            trace_begin(TRACE_USER_NS);
+            ret = setup_user_namespace();
+            trace_end(TRACE_USER_NS, ret);
+            if (ret != 0) {
                 close(pipefd[1]);
                 return -1;
             }
 
             // Currently there is no functionality to forward ports or create a tunnel for 
             // getting network connection, so network is fully isolated
-            setup_network_namespace(config->enable_network);
+            if (netns_fd == -1) {
+                trace_begin(TRACE_NET_NS);
+                ret = config->pod.name ? 0 : setup_network_namespace(config->enable_network);
+                trace_end(TRACE_NET_NS, ret);
+            }
 
-            //  To use the `SECCOMP_SET_MODE_FILTER` operation, either the calling thread must have the CAP_SYS_ADMIN
-            //  capability in its user namespace, or the thread must
-            //  already have the no_new_privs bit set
-            if (prctl(PR_SET_NO_NEW_PRIVS, 1, 0, 0, 0) != 0) {
-                perror("prctl(PR_SET_NO_NEW_PRIVS)");
+            // Wait until the launcher has placed us in the sandbox cgroup
+            char go;
+            trace_begin(TRACE_WAIT_START);
+            ret = read(startfd[0], &go, 1) == 1 ? 0 : -1;
+            trace_end(TRACE_WAIT_START, ret);
+            if (ret != 0) {
+                printf("launcher exited before starting the sandbox\n");
                 return -1;
             }
+            close(startfd[0]);
 
-            // Drop privileged caps
-            drop_bounding_caps();
+            // The launcher has its copy of the recording group by now
+            if (prefetch.recording) {
+                close(PREFETCH_FANOTIFY_FD);
+            }
 
-            // Reset to minimal default capabilities
-            apply_default_capabilities();
+            trace_begin(TRACE_LOCKDOWN);
+            ret = lock_down_sandbox();
+            trace_end(TRACE_LOCKDOWN, ret);
+            if (ret != 0) {
+                return -1;
+            }
 
-            setup_seccomp();
+            // The exec'd image drops the trace mapping, so only its start can be recorded
+            trace_instant(TRACE_EXEC);
 
-            exec_shell();
+            if (config->no_init) {
+                exit(start_workload(config));
+            }
+
+            // Stay PID 1 ourselves so orphans get reaped and signals reach the workload
+            exit(run_init(start_workload, config));
         } else if (child_pid > 0) {
+            trace_end(TRACE_FORK, 0);
+
             if (write(pipefd[1], &child_pid, sizeof(child_pid)) != sizeof(child_pid)) {
                 perror("write pid to parent");
             }
 
             close(pipefd[1]);
+            close(startfd[0]);
+            if (prefetch.recording) {
+                close(PREFETCH_FANOTIFY_FD);
+            }
+            if (netns_fd != -1) {
+                close(netns_fd);
+            }
 
             int status;
             waitpid(child_pid, &status, 0);
-            return WEXITSTATUS(status);
+
+            // The PID namespace is gone, but we still hold the mount namespace. Tell the
+            // supervisor and wait until it is done copying (it closes its end)
+            if (holdfd[1] != -1) {
+                char byte = 1;
+                if (write(holdfd[1], &byte, 1) == 1) {
+                    while (read(holdfd[1], &byte, 1) == -1 && errno == EINTR) { }
+                }
+                close(holdfd[1]);
+            }
+
+            return exit_code(status);
         } else {
             perror("fork failed");
             return -1;
         }
 
     } else if (pid > 0) {
+        trace_end(TRACE_FORK, 0);
         close(pipefd[1]); // parent doesn't write
+        close(startfd[0]);
+        if (netns_fd != -1) {
+            close(netns_fd);
+        }
+        if (holdfd[1] != -1) {
+            close(holdfd[1]);
+        }
         pid_t gpid;
         ssize_t n = read(pipefd[0], &gpid, sizeof(gpid));
         close(pipefd[0]);
 
+        if (n != sizeof(gpid)) {
+            close(startfd[1]);
+            if (holdfd[0] != -1) {
+                close(holdfd[0]);
+            }
+            waitpid(pid, NULL, 0);
+            admission_release(&admission);
+            prefetch_finish(&prefetch);
+            refill_netns_pool(netns_fd);
+            finish_trace(config, -1);
+        }
+
         if (n < 0) {
             printf("error while reading grandchild pid: %s\n", strerror(errno));
             return -1;
@@ -121,29 +510,429 @@ int setup_sandbox(struct Config *config, struct CgroupLimits *limits) {
             return -1;
         }
 
+        struct SandboxState state = { .pid = gpid };
+        snprintf(state.root, sizeof(state.root), "%s",
+                 config->image ? "image" : config->base ? "base" : config->minimal_root ? "minimal" : "host");
+        snprintf(state.image, sizeof(state.image), "%s",
+                 config->image ? config->image : config->base ? config->base : "");
+        struct PerfCounters perf = { 0 };
+        int registered = 0;
+        int counting = 0;
+
         if (config->disable_cgroups) {
             printf("Warning: cgroup setup skipped. Resource limits will NOT be applied!\n");
-            goto wait_pid;
+            goto register_sandbox;
         }
 
         if (gpid > 0) {
-            if (setup_cgroup(limits, gpid) != 0) {
+            trace_begin(TRACE_CGROUP);
+            int ret = setup_cgroup(limits, gpid);
+            trace_end(TRACE_CGROUP, ret);
+
+            if (ret != 0) {
                 printf("error: failed to setup cgroup for pid %d\n", gpid);
 
-                goto wait_pid;
+                goto register_sandbox;
+            }
+
+            sandbox_cgroup_path(limits, gpid, state.cgroup, sizeof(state.cgroup));
+
+            // Opened before the start signal so the counters see the whole workload
+            if (config->perf_counters && perf_open(&perf, state.cgroup) == 0) {
+                counting = 1;
             }
         } else {
             printf("Warning: cgroup setup skipped (invalid grandchild pid). Resource limits will NOT be applied!\n");
         }
 
-    wait_pid:
-        int status;
-        waitpid(pid, &status, 0);
-        return WEXITSTATUS(status);
+    register_sandbox:
+        // Watches the workload's first file accesses from the moment it is released
+        prefetch_record(&prefetch, gpid);
+
+        // Make the sandbox reachable by its id (the grandchild pid) for `runbox exec`
+        if (gpid > 0 && read_process_start_time(gpid, &state.start_time) == 0 &&
+            save_sandbox_state(&state) == 0) {
+            registered = 1;
+        }
+
+        // The init blocks on the start signal, so this pidfd is certain to refer to it. The
+        // supervisor signals through it because it never reaps the init and its pid may be reused
+        int init_pidfd = -1;
+        if (gpid > 0) {
+            init_pidfd = (int)syscall(SYS_pidfd_open, gpid, 0);
+            if (init_pidfd == -1) {
+                printf("pidfd_open failed for sandbox init %d: %s\n", gpid, strerror(errno));
+            }
+        }
+
+        if (write(startfd[1], "1", 1) != 1) {
+            perror("write start signal");
+        }
+        close(startfd[1]);
+
+        struct ExitReport report;
+        trace_begin(TRACE_SUPERVISE);
+        int status = supervise_sandbox(config, limits, pid, gpid, init_pidfd, state.cgroup, holdfd[0], &report);
+        trace_end(TRACE_SUPERVISE, 0);
+
+        if (init_pidfd != -1) {
+            close(init_pidfd);
+        }
+
+        if (counting) {
+            perf_read(&perf, &report.perf);
+            report.perf_measured = 1;
+            perf_close(&perf);
+        }
+
+        if (registered) {
+            remove_sandbox_state(gpid);
+        }
+
+        admission_release(&admission);
+        prefetch_finish(&prefetch);
+        refill_netns_pool(netns_fd);
+
+        finish_trace(config, 0);
+
+        if (config->report || config->memory_merge || config->memory_reclaim > 0 || config->perf_counters ||
+            report.limit != LIMIT_NONE) {
+            print_exit_report(&report);
+        }
+
+        *last_report = report;
+
+        return status;
     } else {
+        // Nothing was forked, so everything taken above is still ours to give back
         perror("fork failed");
+        trace_end(TRACE_FORK, -1);
+        close(pipefd[0]);
+        close(pipefd[1]);
+        close(startfd[0]);
+        close(startfd[1]);
+        close_hold(holdfd);
+        if (netns_fd != -1) {
+            close(netns_fd);
+        }
+        admission_release(&admission);
+        prefetch_finish(&prefetch);
+        refill_netns_pool(netns_fd);
+        finish_trace(config, -1);
         return -1;
     }
 
     return 0;
 }
+
+static int should_restart(const struct Config *config, int status) {
+    // -1 means the sandbox could not even be set up; trying again would fail the same way
+    if (status == -1) {
+        return 0;
+    }
+
+    return config->restart == RESTART_ALWAYS || (config->restart == RESTART_ON_FAILURE && status != 0);
+}
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+/*
+ * Runs the sandbox, and again per --restart. The --listen sockets are bound once up front
+ * and stay open in the launcher across restarts, so their backlog survives them.
+ */
+int setup_sandbox(struct Config *config, struct CgroupLimits *limits) {
+    pid_t launcher = getpid();
+    long delay_ms = RESTART_DELAY_MIN_MS;
+    int restarts = 0;
+    int status;
+    struct Manifest manifest = { 0 };
+    struct ResultCache cache;
+    struct ExitReport report = { .limit = LIMIT_NONE };
+
+    if (config->minimal_root && config->image) {
+        printf("--minimal-root cannot be combined with --image\n");
+        return -1;
+    }
+
+    if (config->base && (config->image || config->minimal_root)) {
+        printf("--base cannot be combined with --image or --minimal-root\n");
+        return -1;
+    }
+
+    if (config->cache && (!config->command || config->listen_count > 0 || config->restart != RESTART_NO)) {
+        printf("--cache needs a command and cannot be combined with --listen or --restart\n");
+        return -1;
+    }
+
+    if (config->pod.name && (config->enable_network || config->cache)) {
+        printf("--pod cannot be combined with --enable-network or --cache\n");
+        return -1;
+    }
+
+    if (config->netns_pool && (config->pod.name || config->enable_network)) {
+        printf("--netns-pool cannot be combined with --pod or --enable-network\n");
+        return -1;
+    }
+
+    // Resolved (or read from the cache) once; restarts reuse it
+    if (config->minimal_root) {
+        trace_begin(TRACE_MINIMAL_ROOT);
+        int ret = load_manifest(config->command, &manifest);
+        trace_end(TRACE_MINIMAL_ROOT, ret);
+
+        if (ret != 0) {
+            return -1;
+        }
+    }
+
+    if (config->cache) {
+        int cached = cache_lookup(config, limits, config->minimal_root ? &manifest : NULL, &cache, &status);
+
+        if (cached == 0 && cache_begin(config, &cache) != 0) {
+            cached = -1;
+        }
+        if (cached != 0) {
+            free_manifest(&manifest);
+            return cached < 0 ? -1 : status;
+        }
+    }
+
+    if (open_listeners(config->listeners, config->listen_count) != 0) {
+        free_manifest(&manifest);
+        return -1;
+    }
+
+    limits->group = config->tenant;
+
+    // Joined once; restarted members stay in the pod
+    if (config->pod.name) {
+        config->pod.tenant = config->tenant;
+        if (open_pod(&config->pod) != 0) {
+            close_listeners(config->listeners, config->listen_count);
+            free_manifest(&manifest);
+            return -1;
+        }
+        limits->group = config->pod.group;
+    }
+
+    for (;;) {
+        // Anything still buffered would be printed again by every forked process
+        fflush(stdout);
+        fflush(stderr);
+
+        double started = monotonic_seconds();
+        status = run_sandbox(config, limits, config->minimal_root ? &manifest : NULL, &report);
+
+        // run_sandbox() also returns in the namespace child, which must not loop
+        if (getpid() != launcher) {
+            return status;
+        }
+
+        if (!should_restart(config, status)) {
+            break;
+        }
+
+        if (monotonic_seconds() - started >= RESTART_RESET_SECONDS) {
+            delay_ms = RESTART_DELAY_MIN_MS;
+        }
+
+        restarts++;
+        fprintf(stderr, "runbox: sandbox exited with status %d, restart #%d in %.1fs\n",
+                status, restarts, delay_ms / 1000.0);
+
+        struct timespec delay = { .tv_sec = delay_ms / 1000, .tv_nsec = (delay_ms % 1000) * 1000000L };
+        while (nanosleep(&delay, &delay) == -1 && errno == EINTR) { }
+
+        delay_ms = delay_ms * 2 > RESTART_DELAY_MAX_MS ? RESTART_DELAY_MAX_MS : delay_ms * 2;
+    }
+
+    close_listeners(config->listeners, config->listen_count);
+    close_pod(&config->pod);
+    free_manifest(&manifest);
+
+    if (config->exit_report) {
+        *config->exit_report = report;
+    }
+
+    // Results cut short by a limit say nothing about the job itself
+    if (config->cache) {
+        cache_finish(config, &cache, status, status >= 0 && report.limit == LIMIT_NONE);
+    }
+
+    return status;
+}
+
+int exec_in_sandbox(const char *id, char **command) {
+    struct SandboxState state;
+
+    if (load_sandbox_state(id, &state) != 0) {
+        return -1;
+    }
+
+    int pidfd = (int)syscall(SYS_pidfd_open, state.pid, 0);
+    if (pidfd == -1) {
+        printf("pidfd_open failed for sandbox %s: %s\n", id, strerror(errno));
+        return -1;
+    }
+
+    // The pidfd now pins the process, so re-checking the start time closes the PID reuse window
+    unsigned long long start_time;
+    if (read_process_start_time(state.pid, &start_time) != 0 || start_time != state.start_time) {
+        printf("Sandbox '%s' is no longer running\n", id);
+        close(pidfd);
+        return -1;
+    }
+
+    // Join the sandbox cgroup while the host cgroupfs is still visible; children inherit it
+    if (state.cgroup[0] != '\0' && attach_to_cgroup(state.cgroup, getpid()) != 0) {
+        close(pidfd);
+        return -1;
+    }
+
+    if (join_namespaces(pidfd, state.pid) != 0) {
+        close(pidfd);
+        return -1;
+    }
+
+    close(pidfd);
+
+    // Joining a PID namespace only applies to children, so fork to actually enter it
+    pid_t child_pid = fork();
+
+    if (child_pid == 0) {
+        if (chdir("/") == -1) {
+            printf("failed to chdir to /: %s\n", strerror(errno));
+            return -1;
+        }
+
+        if (lock_down_sandbox() != 0) {
+            return -1;
+        }
+
+        exec_workload(command);
+        return -1;
+    } else if (child_pid < 0) {
+        perror("fork failed");
+        return -1;
+    }
+
+    int status;
+    waitpid(child_pid, &status, 0);
+    return exit_code(status);
+}
+
+int update_sandbox(const char *id, struct CgroupLimits *limits) {
+    struct SandboxState state;
+    unsigned long long start_time;
+
+    if (!limits->cpu_enabled && !limits->memory_enabled && !limits->pids_enabled) {
+        printf("Nothing to update, pass --memory, --cpu and/or --pids\n");
+        return -1;
+    }
+
+    if (load_sandbox_state(id, &state) != 0) {
+        return -1;
+    }
+
+    if (read_process_start_time(state.pid, &start_time) != 0 || start_time != state.start_time) {
+        printf("Sandbox '%s' is no longer running\n", id);
+        return -1;
+    }
+
+    if (state.cgroup[0] == '\0') {
+        printf("Sandbox '%s' runs without cgroups, its limits cannot be changed\n", id);
+        return -1;
+    }
+
+    return update_cgroup_limits(state.cgroup, limits);
+}
+
+// Waits for every process of the cgroup to stop (or run again), at most about a second
+static int freeze_sandbox(const char *cgroup, int frozen) {
+    char freeze[512];
+    char path[512];
+    char events[512];
+    char want[16];
+
+    snprintf(freeze, sizeof(freeze), "%s/cgroup.freeze", cgroup);
+    if (write_file(freeze, frozen ? "1" : "0") != 0) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "%s/cgroup.events", cgroup);
+    snprintf(want, sizeof(want), "frozen %d", frozen);
+
+    for (int i = 0; i < 100; i++) {
+        if (read_file(path, events, sizeof(events)) != 0) {
+            return -1;
+        }
+        if (strstr(events, want)) {
+            return 0;
+        }
+        usleep(10000);
+    }
+
+    // Never leave a sandbox half frozen
+    if (frozen) {
+        write_file(freeze, "0");
+    }
+    return -1;
+}
+
+/*
+ * Stores the sandbox's writes as image `name`, on top of the image it was started from.
+ * The sandbox is frozen meanwhile so the layer is one consistent snapshot.
+ */
+int commit_sandbox(const char *id, const char *name) {
+    struct SandboxState state;
+    unsigned long long start_time;
+    char path[64];
+
+    if (load_sandbox_state(id, &state) != 0) {
+        return -1;
+    }
+
+    if (strcmp(state.root, "minimal") == 0) {
+        printf("Sandbox '%s' runs on a --minimal-root, which cannot be committed\n", id);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), "/proc/%d/fd/%d", state.pid, SANDBOX_WRITABLE_FD);
+
+    int fd = open(path, O_RDONLY | O_DIRECTORY | O_CLOEXEC);
+    if (fd == -1) {
+        printf("Cannot reach the writable area of sandbox '%s' (started with --no-init?): %s\n", id,
+               strerror(errno));
+        return -1;
+    }
+
+    // The descriptor pins the directory, so re-checking the start time closes the PID reuse window
+    if (read_process_start_time(state.pid, &start_time) != 0 || start_time != state.start_time) {
+        printf("Sandbox '%s' is no longer running\n", id);
+        close(fd);
+        return -1;
+    }
+
+    int frozen = state.cgroup[0] != '\0' && freeze_sandbox(state.cgroup, 1) == 0;
+    if (!frozen) {
+        printf("Warning: sandbox '%s' keeps running while it is committed\n", id);
+    }
+
+    int ret = image_commit(fd, name, state.image[0] ? state.image : NULL);
+
+    if (frozen) {
+        freeze_sandbox(state.cgroup, 0);
+    }
+    close(fd);
+
+    if (ret == 0) {
+        printf("  start sandboxes from it with %s=%s\n", strcmp(state.root, "image") == 0 ? "--image" : "--base",
+               name);
+    }
+
+    return ret;
+}
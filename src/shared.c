@@ -0,0 +1,277 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/file.h>
+#include <sys/ioctl.h>
+#include <sys/mount.h>
+#include <sys/sendfile.h>
+#include <linux/fs.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "shared.h"
+
+int parse_shared_data(char *arg, struct SharedDataSpec *spec) {
+    char *eq = strchr(arg, '=');
+    if (!eq || eq == arg || eq[1] == '\0') {
+        return -1;
+    }
+
+    *eq = '\0';
+    spec->name = arg;
+    spec->source = eq + 1;
+    spec->huge = 0;
+
+    size_t len = strlen(spec->source);
+    if (len > 5 && strcmp(spec->source + len - 5, ":huge") == 0) {
+        eq[1 + len - 5] = '\0';
+        spec->huge = 1;
+    }
+
+    // The name becomes a file name on the host and in the sandbox; the dot prefix is ours
+    if (strlen(spec->name) > SHARED_DATA_NAME_MAX || spec->name[0] == '.') {
+        return -1;
+    }
+
+    for (const char *p = spec->name; *p; p++) {
+        if (!(*p >= 'a' && *p <= 'z') && !(*p >= 'A' && *p <= 'Z') && !(*p >= '0' && *p <= '9') &&
+            *p != '.' && *p != '-' && *p != '_') {
+            return -1;
+        }
+    }
+
+    return 0;
+}
+
+static int ensure_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        printf("failed creating %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+/*
+ * The copies must live in memory whatever /run happens to be, so the shared directory gets
+ * its own tmpfs; huge copies get a second one, since tmpfs huge pages are a mount option.
+ */
+static int ensure_tmpfs(const char *path, const char *parent_path, const char *options) {
+    struct stat dir, parent;
+
+    if (ensure_dir(path) != 0) {
+        return -1;
+    }
+
+    if (stat(path, &dir) == -1 || stat(parent_path, &parent) == -1) {
+        printf("failed inspecting %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    // Already a mount point from an earlier run
+    if (dir.st_dev != parent.st_dev) {
+        return 0;
+    }
+
+    if (mount("tmpfs", path, "tmpfs", MS_NOSUID | MS_NODEV | MS_NOEXEC, options) == -1) {
+        printf("failed mounting tmpfs on %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// The in-memory copy is reused as long as the source file is the same one, unchanged
+static int copy_is_current(const char *meta_path, const char *host_path, const struct stat *src) {
+    unsigned long long dev, ino;
+    long long size, mtime_sec, mtime_nsec;
+
+    if (access(host_path, F_OK) == -1) {
+        return 0;
+    }
+
+    FILE *f = fopen(meta_path, "r");
+    if (!f) {
+        return 0;
+    }
+
+    int fields = fscanf(f, "%llu %llu %lld %lld %lld", &dev, &ino, &size, &mtime_sec, &mtime_nsec);
+    fclose(f);
+
+    return fields == 5 && dev == (unsigned long long)src->st_dev && ino == (unsigned long long)src->st_ino &&
+           size == (long long)src->st_size && mtime_sec == (long long)src->st_mtim.tv_sec &&
+           mtime_nsec == (long long)src->st_mtim.tv_nsec;
+}
+
+static int write_meta(const char *dir, const char *name, const char *meta_path, const struct stat *src) {
+    char tmp_path[SHARED_DATA_PATH_MAX + 16];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.meta.%d", dir, name, getpid());
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        printf("Error opening %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "%llu %llu %lld %lld %lld\n", (unsigned long long)src->st_dev, (unsigned long long)src->st_ino,
+            (long long)src->st_size, (long long)src->st_mtim.tv_sec, (long long)src->st_mtim.tv_nsec);
+
+    if (fclose(f) != 0 || rename(tmp_path, meta_path) == -1) {
+        printf("failed writing %s: %s\n", meta_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+static int set_immutable(int fd, int immutable) {
+    int flags;
+
+    if (ioctl(fd, FS_IOC_GETFLAGS, &flags) == -1) {
+        return -1;
+    }
+
+    flags = immutable ? (flags | FS_IMMUTABLE_FL) : (flags & ~FS_IMMUTABLE_FL);
+    return ioctl(fd, FS_IOC_SETFLAGS, &flags);
+}
+
+// An immutable target cannot be renamed over, so unseal the previous copy first
+static void unseal_old_copy(const char *host_path) {
+    int fd = open(host_path, O_RDONLY | O_NOFOLLOW | O_CLOEXEC);
+    if (fd != -1) {
+        set_immutable(fd, 0);
+        close(fd);
+    }
+}
+
+/*
+ * Loads the source into a tmpfs file next to the final name and swaps it in. Sandboxes
+ * still mapping a previous copy keep its pages; the file is only freed once they are gone.
+ */
+static int load_copy(const struct SharedDataSpec *spec, const char *dir, int src_fd, const struct stat *src) {
+    char tmp_path[SHARED_DATA_PATH_MAX + 16];
+
+    snprintf(tmp_path, sizeof(tmp_path), "%s/.%s.%d", dir, spec->name, getpid());
+
+    int fd = open(tmp_path, O_WRONLY | O_CREAT | O_TRUNC | O_NOFOLLOW | O_CLOEXEC, 0444);
+    if (fd == -1) {
+        printf("Error opening %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    off_t done = 0;
+    while (done < src->st_size) {
+        ssize_t n = sendfile(fd, src_fd, NULL, src->st_size - done > (1 << 30) ? (1 << 30) : src->st_size - done);
+        if (n == -1 && errno == EINTR) continue;
+
+        if (n <= 0) {
+            printf("failed loading %s: %s\n", spec->source, n == 0 ? "file shrank while reading" : strerror(errno));
+            close(fd);
+            unlink(tmp_path);
+            return -1;
+        }
+
+        done += n;
+    }
+
+    unseal_old_copy(spec->host_path);
+
+    if (rename(tmp_path, spec->host_path) == -1) {
+        printf("failed publishing %s: %s\n", spec->host_path, strerror(errno));
+        close(fd);
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // Our stand-in for memfd seals: nobody on the host can write, truncate or replace it in place
+    if (set_immutable(fd, 1) == -1) {
+        printf("Warning: could not make %s immutable: %s\n", spec->host_path, strerror(errno));
+    }
+
+    close(fd);
+    return 0;
+}
+
+/*
+ * Makes sure an up to date in-memory copy of the source exists on the host (loading it
+ * only if no earlier sandbox already did) and describes the read-only mount of it into
+ * the sandbox. Every sandbox mapping the copy shares the same physical pages.
+ */
+int prepare_shared_data(struct SharedDataSpec *spec, struct VolumeSpec *volume) {
+    char meta_path[SHARED_DATA_PATH_MAX + 8];
+    char lock_path[SHARED_DATA_PATH_MAX + 8];
+    const char *dir = spec->huge ? SHARED_DATA_HUGE_DIR : SHARED_DATA_DIR;
+    struct stat src;
+
+    if (ensure_dir(RUNBOX_STATE_DIR) != 0 ||
+        ensure_tmpfs(SHARED_DATA_DIR, RUNBOX_STATE_DIR, "mode=0755") != 0 ||
+        (spec->huge && ensure_tmpfs(SHARED_DATA_HUGE_DIR, SHARED_DATA_DIR, "mode=0755,huge=always") != 0)) {
+        return -1;
+    }
+
+    int src_fd = open(spec->source, O_RDONLY | O_CLOEXEC);
+    if (src_fd == -1) {
+        printf("Error opening shared data %s: %s\n", spec->source, strerror(errno));
+        return -1;
+    }
+
+    if (fstat(src_fd, &src) == -1 || !S_ISREG(src.st_mode)) {
+        printf("shared data %s is not a regular file\n", spec->source);
+        close(src_fd);
+        return -1;
+    }
+
+    snprintf(spec->host_path, sizeof(spec->host_path), "%s/%s", dir, spec->name);
+    snprintf(spec->sandbox_path, sizeof(spec->sandbox_path), SHARED_DATA_SANDBOX_DIR "/%s", spec->name);
+    snprintf(meta_path, sizeof(meta_path), "%s/.%s.meta", dir, spec->name);
+    snprintf(lock_path, sizeof(lock_path), "%s/.%s.lock", dir, spec->name);
+
+    // Launchers starting together must not all load the same file
+    int lock_fd = open(lock_path, O_RDWR | O_CREAT | O_CLOEXEC, 0600);
+    if (lock_fd == -1) {
+        printf("Error opening %s: %s\n", lock_path, strerror(errno));
+        close(src_fd);
+        return -1;
+    }
+
+    while (flock(lock_fd, LOCK_EX) == -1) {
+        if (errno != EINTR) {
+            printf("failed locking %s: %s\n", lock_path, strerror(errno));
+            close(lock_fd);
+            close(src_fd);
+            return -1;
+        }
+    }
+
+    int ret = 0;
+
+    if (!copy_is_current(meta_path, spec->host_path, &src)) {
+        ret = load_copy(spec, dir, src_fd, &src);
+        if (ret == 0) {
+            ret = write_meta(dir, spec->name, meta_path, &src);
+        }
+        if (ret == 0) {
+            fprintf(stderr, "runbox: loaded shared data '%s' (%.1f MiB%s)\n", spec->name,
+                    src.st_size / (1024.0 * 1024.0), spec->huge ? ", huge pages" : "");
+        }
+    }
+
+    flock(lock_fd, LOCK_UN);
+    close(lock_fd);
+    close(src_fd);
+
+    if (ret != 0) {
+        return -1;
+    }
+
+    volume->host_path = spec->host_path;
+    volume->sandbox_path = spec->sandbox_path;
+    volume->read_only = 1;
+    return 0;
+}
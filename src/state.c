@@ -0,0 +1,160 @@
+#include "state.h"
+#include <stdio.h>
+#include <errno.h>
+#include <string.h>
+#include <stdlib.h>
+#include <unistd.h>
+#include <sys/stat.h>
+#include <sys/types.h>
+
+static int ensure_dir(const char *path) {
+    if (mkdir(path, 0755) == -1 && errno != EEXIST) {
+        printf("failed creating %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int save_sandbox_state(const struct SandboxState *state) {
+    char path[256];
+    char tmp_path[256];
+
+    if (ensure_dir(RUNBOX_STATE_DIR) != 0 || ensure_dir(RUNBOX_SANDBOX_STATE_DIR) != 0) {
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), RUNBOX_SANDBOX_STATE_DIR "/%d", state->pid);
+    snprintf(tmp_path, sizeof(tmp_path), RUNBOX_SANDBOX_STATE_DIR "/.%d.tmp", state->pid);
+
+    FILE *f = fopen(tmp_path, "w");
+    if (!f) {
+        printf("Error opening %s: %s\n", tmp_path, strerror(errno));
+        return -1;
+    }
+
+    fprintf(f, "pid=%d\n", state->pid);
+    fprintf(f, "start_time=%llu\n", state->start_time);
+    fprintf(f, "cgroup=%s\n", state->cgroup);
+    fprintf(f, "root=%s\n", state->root);
+    fprintf(f, "image=%s\n", state->image);
+
+    if (fclose(f) != 0) {
+        printf("Error writing to %s: %s\n", tmp_path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    // Publish the entry atomically so readers never see a half-written file
+    if (rename(tmp_path, path) == -1) {
+        printf("failed publishing sandbox state %s: %s\n", path, strerror(errno));
+        unlink(tmp_path);
+        return -1;
+    }
+
+    return 0;
+}
+
+int load_sandbox_state(const char *id, struct SandboxState *state) {
+    char path[256];
+    char line[512];
+
+    char *end;
+    long pid = strtol(id, &end, 10);
+    if (pid <= 0 || *end != '\0') {
+        printf("Invalid sandbox id: '%s'\n", id);
+        return -1;
+    }
+
+    snprintf(path, sizeof(path), RUNBOX_SANDBOX_STATE_DIR "/%ld", pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        printf("No such sandbox '%s': %s\n", id, strerror(errno));
+        return -1;
+    }
+
+    memset(state, 0, sizeof(*state));
+
+    while (fgets(line, sizeof(line), f)) {
+        line[strcspn(line, "\n")] = '\0';
+
+        if (strncmp(line, "pid=", 4) == 0) {
+            state->pid = (pid_t)atoi(line + 4);
+        } else if (strncmp(line, "start_time=", 11) == 0) {
+            state->start_time = strtoull(line + 11, NULL, 10);
+        } else if (strncmp(line, "cgroup=", 7) == 0) {
+            snprintf(state->cgroup, sizeof(state->cgroup), "%s", line + 7);
+        } else if (strncmp(line, "root=", 5) == 0) {
+            snprintf(state->root, sizeof(state->root), "%s", line + 5);
+        } else if (strncmp(line, "image=", 6) == 0) {
+            snprintf(state->image, sizeof(state->image), "%s", line + 6);
+        }
+    }
+
+    fclose(f);
+
+    if (state->pid != (pid_t)pid) {
+        printf("Corrupt sandbox state in %s\n", path);
+        return -1;
+    }
+
+    // The entry may outlive the sandbox if the supervisor was killed; make sure the
+    // PID still belongs to the process that was registered
+    unsigned long long start_time;
+    if (read_process_start_time(state->pid, &start_time) != 0 || start_time != state->start_time) {
+        printf("Sandbox '%s' is no longer running\n", id);
+        return -1;
+    }
+
+    return 0;
+}
+
+int remove_sandbox_state(pid_t pid) {
+    char path[256];
+    snprintf(path, sizeof(path), RUNBOX_SANDBOX_STATE_DIR "/%d", pid);
+
+    if (unlink(path) == -1 && errno != ENOENT) {
+        printf("failed removing sandbox state %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+int read_process_start_time(pid_t pid, unsigned long long *start_time) {
+    char path[64];
+    char buffer[1024];
+
+    snprintf(path, sizeof(path), "/proc/%d/stat", pid);
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        return -1;
+    }
+
+    size_t n = fread(buffer, 1, sizeof(buffer) - 1, f);
+    buffer[n] = '\0';
+    fclose(f);
+
+    // comm (field 2) may contain spaces and parentheses, so start after the last ')'
+    char *p = strrchr(buffer, ')');
+    if (!p) {
+        return -1;
+    }
+
+    // Skip fields 3..21 to reach starttime (field 22)
+    p++;
+    for (int field = 3; field <= 22; field++) {
+        while (*p == ' ') p++;
+        if (field == 22) break;
+        while (*p && *p != ' ') p++;
+    }
+
+    if (*p == '\0') {
+        return -1;
+    }
+
+    *start_time = strtoull(p, NULL, 10);
+    return 0;
+}
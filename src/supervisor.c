@@ -0,0 +1,390 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/wait.h>
+#include <sys/epoll.h>
+#include <sys/timerfd.h>
+#include <sys/syscall.h>
+#include <stdint.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <signal.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "cgroup.h"
+#include "export.h"
+#include "density.h"
+#include "supervisor.h"
+
+// Event sources watched by the supervisor loop (stored in epoll_event.data.u32)
+enum {
+    SRC_CHILD,
+    SRC_TIMEOUT,
+    SRC_CPU_POLL,
+    SRC_GRACE,
+    SRC_AUTOTUNE,
+    SRC_HOLD,
+    SRC_DENSITY,
+};
+
+struct Supervisor {
+    struct Config *config;
+    pid_t init_pid;
+    int init_pidfd;
+    const char *cgroup;
+    struct ExitReport *report;
+
+    int epfd;
+    int timeout_fd;
+    int cpu_fd;
+    int grace_fd;
+    int autotune_fd;
+    int hold_fd;
+    int density_fd;
+
+    struct Autotuner tuner;
+    struct DensityMonitor density;
+};
+
+static double monotonic_seconds(void) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+static int add_source(int epfd, int fd, uint32_t source) {
+    struct epoll_event ev = { .events = EPOLLIN, .data.u32 = source };
+
+    if (epoll_ctl(epfd, EPOLL_CTL_ADD, fd, &ev) == -1) {
+        printf("epoll_ctl failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
+
+// Creates a timerfd that first fires after `seconds` and then every `interval` seconds (0 = one-shot)
+static int create_timer(int epfd, uint32_t source, double seconds, double interval) {
+    int fd = timerfd_create(CLOCK_MONOTONIC, TFD_CLOEXEC | TFD_NONBLOCK);
+    if (fd == -1) {
+        printf("timerfd_create failed: %s\n", strerror(errno));
+        return -1;
+    }
+
+    struct itimerspec spec = {
+        .it_value = { .tv_sec = (time_t)seconds,
+                      .tv_nsec = (long)((seconds - (time_t)seconds) * 1e9) },
+        .it_interval = { .tv_sec = (time_t)interval,
+                         .tv_nsec = (long)((interval - (time_t)interval) * 1e9) },
+    };
+
+    // A zero it_value would disarm the timer instead of firing immediately
+    if (spec.it_value.tv_sec == 0 && spec.it_value.tv_nsec == 0) {
+        spec.it_value.tv_nsec = 1;
+    }
+
+    if (timerfd_settime(fd, 0, &spec, NULL) == -1 || add_source(epfd, fd, source) != 0) {
+        printf("failed arming supervisor timer: %s\n", strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    return fd;
+}
+
+static void drain_timer(int fd) {
+    uint64_t expirations;
+    if (read(fd, &expirations, sizeof(expirations)) < 0 && errno != EAGAIN) {
+        printf("failed reading supervisor timer: %s\n", strerror(errno));
+    }
+}
+
+static int read_cpu_usage(const char *cgroup, double *seconds) {
+    char path[256];
+    char buffer[1024];
+
+    snprintf(path, sizeof(path), "%s/cpu.stat", cgroup);
+    if (read_file(path, buffer, sizeof(buffer)) != 0) {
+        return -1;
+    }
+
+    char *p = strstr(buffer, "usage_usec ");
+    if (!p) {
+        return -1;
+    }
+
+    *seconds = (double)strtoull(p + strlen("usage_usec "), NULL, 10) / 1e6;
+    return 0;
+}
+
+/*
+ * Signals the sandbox init through its pidfd. Nobody reaps it on our side, so once it is
+ * gone its pid may belong to an unrelated host process; the pidfd then just fails with ESRCH.
+ */
+static void signal_init(struct Supervisor *sv, int sig) {
+    if (sv->init_pidfd == -1) {
+        printf("no pidfd for sandbox init %d, cannot send it %s\n", sv->init_pid, strsignal(sig));
+        return;
+    }
+
+    if (syscall(SYS_pidfd_send_signal, sv->init_pidfd, sig, NULL, 0) == -1 && errno != ESRCH) {
+        printf("failed sending %s to sandbox init %d: %s\n", strsignal(sig), sv->init_pid, strerror(errno));
+    }
+}
+
+// First stage of enforcement: ask the sandbox init to shut down, then give it a grace period
+static void limit_exceeded(struct Supervisor *sv, enum LimitKind limit) {
+    if (sv->report->limit != LIMIT_NONE) {
+        return;
+    }
+
+    sv->report->limit = limit;
+
+    signal_init(sv, SIGTERM);
+
+    sv->grace_fd = create_timer(sv->epfd, SRC_GRACE, sv->config->kill_grace, 0);
+}
+
+// Second stage: the grace period is over, kill everything left in the sandbox
+static void kill_sandbox(struct Supervisor *sv) {
+    char path[256];
+
+    if (sv->cgroup && sv->cgroup[0] != '\0') {
+        snprintf(path, sizeof(path), "%s/cgroup.kill", sv->cgroup);
+        if (write_file(path, "1") == 0) {
+            return;
+        }
+    }
+
+    // Without cgroup.kill, killing the PID namespace init takes the whole namespace down
+    signal_init(sv, SIGKILL);
+}
+
+static void close_fd(int *fd) {
+    if (*fd >= 0) {
+        close(*fd);
+        *fd = -1;
+    }
+}
+
+// The namespace child reports that the workload is gone and it is holding the sandbox
+// mounts for us: copy the exports out, then let it exit
+static void export_from_sandbox(struct Supervisor *sv, pid_t child_pid, double started) {
+    char byte;
+    ssize_t n = read(sv->hold_fd, &byte, 1);
+
+    if (n == 1) {
+        // The job is over: a limit firing during a long copy would record it as killed
+        // and signal an init that has already been reaped
+        close_fd(&sv->timeout_fd);
+        close_fd(&sv->cpu_fd);
+
+        sv->report->wall_seconds = monotonic_seconds() - started;
+        export_artifacts(child_pid, sv->config->exports, sv->config->export_count);
+    }
+
+    epoll_ctl(sv->epfd, EPOLL_CTL_DEL, sv->hold_fd, NULL);
+    close_fd(&sv->hold_fd);
+}
+
+int supervise_sandbox(struct Config *config, struct CgroupLimits *limits, pid_t child_pid,
+                      pid_t init_pid, int init_pidfd, const char *cgroup, int hold_fd,
+                      struct ExitReport *report) {
+    struct Supervisor sv = {
+        .config = config,
+        .init_pid = init_pid,
+        .init_pidfd = init_pidfd,
+        .cgroup = cgroup,
+        .report = report,
+        .epfd = -1,
+        .timeout_fd = -1,
+        .cpu_fd = -1,
+        .grace_fd = -1,
+        .autotune_fd = -1,
+        .hold_fd = hold_fd,
+        .density_fd = -1,
+    };
+
+    memset(report, 0, sizeof(*report));
+    report->cpu_seconds = -1;
+    report->merged_pages = -1;
+    report->reclaimed_bytes = -1;
+
+    double started = monotonic_seconds();
+    int has_cgroup = cgroup && cgroup[0] != '\0';
+    int has_density = has_cgroup && (config->memory_merge || config->memory_reclaim > 0);
+    int status = 0;
+
+    if (has_density) {
+        density_init(&sv.density, cgroup, config->memory_merge, config->memory_reclaim);
+    }
+
+    if (config->cpu_time > 0 && !has_cgroup) {
+        printf("Warning: no sandbox cgroup, --cpu-time will NOT be enforced!\n");
+    }
+
+    int pidfd = (int)syscall(SYS_pidfd_open, child_pid, 0);
+    sv.epfd = epoll_create1(EPOLL_CLOEXEC);
+
+    if (pidfd == -1 || sv.epfd == -1 || add_source(sv.epfd, pidfd, SRC_CHILD) != 0) {
+        // Nothing to watch with; fall back to a plain wait without enforcement
+        printf("Warning: supervisor unavailable (%s), limits will NOT be enforced!\n", strerror(errno));
+        goto wait_child;
+    }
+
+    if (sv.hold_fd >= 0 && add_source(sv.epfd, sv.hold_fd, SRC_HOLD) != 0) {
+        close_fd(&sv.hold_fd);
+    }
+
+    if (config->timeout > 0) {
+        sv.timeout_fd = create_timer(sv.epfd, SRC_TIMEOUT, config->timeout, 0);
+    }
+
+    if (config->cpu_time > 0 && has_cgroup) {
+        sv.cpu_fd = create_timer(sv.epfd, SRC_CPU_POLL, CPU_TIME_POLL_MS / 1000.0, CPU_TIME_POLL_MS / 1000.0);
+    }
+
+    if ((config->autotune.cpu_enabled || config->autotune.memory_enabled) && has_cgroup &&
+        autotune_init(&sv.tuner, &config->autotune, cgroup, limits->cpus, limits->memory_max) == 0) {
+        sv.autotune_fd = create_timer(sv.epfd, SRC_AUTOTUNE, AUTOTUNE_INTERVAL_MS / 1000.0,
+                                      AUTOTUNE_INTERVAL_MS / 1000.0);
+    }
+
+    if (has_density) {
+        sv.density_fd = create_timer(sv.epfd, SRC_DENSITY, DENSITY_INTERVAL_MS / 1000.0,
+                                     DENSITY_INTERVAL_MS / 1000.0);
+    }
+
+    for (;;) {
+        struct epoll_event events[8];
+        int n = epoll_wait(sv.epfd, events, 8, -1);
+
+        if (n == -1) {
+            if (errno == EINTR) continue;
+            printf("epoll_wait failed: %s\n", strerror(errno));
+            break;
+        }
+
+        int child_exited = 0;
+
+        for (int i = 0; i < n; i++) {
+            switch (events[i].data.u32) {
+                case SRC_CHILD:
+                    child_exited = 1;
+                    break;
+
+                case SRC_TIMEOUT:
+                    // Already closed by an export earlier in this batch
+                    if (sv.timeout_fd < 0) break;
+                    drain_timer(sv.timeout_fd);
+                    limit_exceeded(&sv, LIMIT_TIMEOUT);
+                    break;
+
+                case SRC_CPU_POLL: {
+                    if (sv.cpu_fd < 0) break;
+                    drain_timer(sv.cpu_fd);
+
+                    double used;
+                    if (read_cpu_usage(cgroup, &used) == 0 && used >= config->cpu_time) {
+                        limit_exceeded(&sv, LIMIT_CPU_TIME);
+                        close_fd(&sv.cpu_fd);
+                    }
+                    break;
+                }
+
+                case SRC_GRACE:
+                    drain_timer(sv.grace_fd);
+                    close_fd(&sv.grace_fd);
+                    kill_sandbox(&sv);
+                    break;
+
+                case SRC_AUTOTUNE:
+                    drain_timer(sv.autotune_fd);
+                    autotune_step(&sv.tuner);
+                    break;
+
+                case SRC_HOLD:
+                    export_from_sandbox(&sv, child_pid, started);
+                    break;
+
+                case SRC_DENSITY:
+                    drain_timer(sv.density_fd);
+                    density_step(&sv.density);
+                    break;
+            }
+        }
+
+        if (child_exited) break;
+    }
+
+wait_child:
+    // Never leave the namespace child waiting for an export that will not happen
+    close_fd(&sv.hold_fd);
+    waitpid(child_pid, &status, 0);
+
+    // With exports the workload ended before the copy started
+    if (report->wall_seconds == 0) {
+        report->wall_seconds = monotonic_seconds() - started;
+    }
+    report->exit_status = WIFSIGNALED(status) ? 128 + WTERMSIG(status) : WEXITSTATUS(status);
+
+    if (has_cgroup) {
+        read_cpu_usage(cgroup, &report->cpu_seconds);
+    }
+
+    if (has_density) {
+        if (config->memory_merge) {
+            report->merged_pages = (long long)sv.density.merged_pages_peak;
+        }
+        if (config->memory_reclaim > 0) {
+            report->reclaimed_bytes = (long long)sv.density.reclaimed_bytes;
+        }
+    }
+
+    close_fd(&sv.timeout_fd);
+    close_fd(&sv.cpu_fd);
+    close_fd(&sv.grace_fd);
+    close_fd(&sv.autotune_fd);
+    close_fd(&sv.density_fd);
+    close_fd(&sv.epfd);
+    close_fd(&pidfd);
+
+    return report->exit_status;
+}
+
+void print_exit_report(const struct ExitReport *report) {
+    static const char *limit_names[] = {
+        [LIMIT_NONE] = "none",
+        [LIMIT_TIMEOUT] = "timeout",
+        [LIMIT_CPU_TIME] = "cpu-time",
+    };
+
+    fprintf(stderr, "runbox: exit_status=%d limit=%s wall=%.3fs",
+            report->exit_status, limit_names[report->limit], report->wall_seconds);
+
+    if (report->cpu_seconds >= 0) {
+        fprintf(stderr, " cpu=%.3fs", report->cpu_seconds);
+    }
+
+    if (report->merged_pages >= 0) {
+        fprintf(stderr, " ksm_merged_pages=%lld", report->merged_pages);
+    }
+
+    if (report->reclaimed_bytes >= 0) {
+        fprintf(stderr, " reclaimed=%.1fMiB", report->reclaimed_bytes / (1024.0 * 1024.0));
+    }
+
+    for (int kind = 0; report->perf_measured && kind < PERF_COUNTER_COUNT; kind++) {
+        if (!report->perf.supported[kind]) continue;
+
+        if (kind == PERF_TASK_CLOCK) {
+            fprintf(stderr, " %s=%.3fs", perf_counter_name(kind), report->perf.values[kind] / 1e9);
+        } else {
+            fprintf(stderr, " %s=%llu", perf_counter_name(kind), report->perf.values[kind]);
+        }
+    }
+
+    fprintf(stderr, "\n");
+}
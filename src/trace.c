@@ -0,0 +1,169 @@
+#define _GNU_SOURCE
+
+#include <sys/mman.h>
+#include <stdio.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include "trace.h"
+
+// NULL unless tracing was requested; every hook starts with this check, so a
+// disabled trace costs one predictable branch per phase
+static struct TraceBuffer *trace_buffer = NULL;
+static enum TraceRole trace_role = TRACE_ROLE_LAUNCHER;
+
+static const char *phase_names[TRACE_PHASE_COUNT] = {
+    [TRACE_SANDBOX] = "sandbox",
+    [TRACE_ADMISSION] = "admission",
+    [TRACE_MINIMAL_ROOT] = "minimal_root",
+    [TRACE_MOUNT_NS] = "mount_namespace",
+    [TRACE_PID_NS] = "pid_namespace",
+    [TRACE_FORK] = "fork",
+    [TRACE_PIVOT_ROOT] = "pivot_root",
+    [TRACE_MOUNT_PROC] = "mount_proc",
+    [TRACE_IPC_UTS_NS] = "ipc_uts_namespace",
+    [TRACE_USER_NS] = "user_namespace",
+    [TRACE_NET_NS] = "network_namespace",
+    [TRACE_CGROUP] = "cgroup",
+    [TRACE_WAIT_START] = "wait_start",
+    [TRACE_LOCKDOWN] = "lockdown",
+    [TRACE_EXEC] = "exec",
+    [TRACE_SUPERVISE] = "supervise",
+};
+
+static const char *role_names[] = {
+    [TRACE_ROLE_LAUNCHER] = "launcher",
+    [TRACE_ROLE_NAMESPACE_CHILD] = "namespace child",
+    [TRACE_ROLE_INIT] = "sandbox init",
+};
+
+// Must run before the first fork so all three processes share the same ring
+int trace_open(void) {
+    void *p = mmap(NULL, sizeof(struct TraceBuffer), PROT_READ | PROT_WRITE,
+                   MAP_SHARED | MAP_ANONYMOUS, -1, 0);
+    if (p == MAP_FAILED) {
+        printf("failed mapping trace buffer: %s\n", strerror(errno));
+        return -1;
+    }
+
+    trace_buffer = p;
+    trace_role = TRACE_ROLE_LAUNCHER;
+    return 0;
+}
+
+void trace_close(void) {
+    if (trace_buffer) {
+        munmap(trace_buffer, sizeof(*trace_buffer));
+        trace_buffer = NULL;
+    }
+}
+
+int trace_enabled(void) {
+    return trace_buffer != NULL;
+}
+
+void trace_set_role(enum TraceRole role) {
+    trace_role = role;
+}
+
+static void trace_append(enum TracePhase phase, char type, int err) {
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+
+    // Claim a slot; writers in different processes never share one until the ring wraps
+    uint64_t index = __atomic_fetch_add(&trace_buffer->head, 1, __ATOMIC_RELAXED);
+    struct TraceEvent *event = &trace_buffer->events[index % TRACE_CAPACITY];
+
+    event->ts_ns = (uint64_t)ts.tv_sec * 1000000000ull + (uint64_t)ts.tv_nsec;
+    event->pid = getpid();
+    event->err = err;
+    event->role = (uint8_t)trace_role;
+    event->phase = (uint8_t)phase;
+    event->type = type;
+
+    // Publish the slot only once all fields are visible
+    __atomic_store_n(&event->seq, index + 1, __ATOMIC_RELEASE);
+}
+
+void trace_begin(enum TracePhase phase) {
+    if (!trace_buffer) return;
+    trace_append(phase, 'B', 0);
+}
+
+void trace_end(enum TracePhase phase, int ret) {
+    if (!trace_buffer) return;
+
+    // Keep errno intact for the caller's own error message
+    int err = ret != 0 ? errno : 0;
+    trace_append(phase, 'E', err);
+    if (err) errno = err;
+}
+
+void trace_instant(enum TracePhase phase) {
+    if (!trace_buffer) return;
+    trace_append(phase, 'i', 0);
+}
+
+// Writes the ring as Chrome trace-event JSON (chrome://tracing, Perfetto)
+int trace_dump(const char *path) {
+    if (!trace_buffer) return 0;
+
+    FILE *f = fopen(path, "w");
+    if (!f) {
+        printf("Error opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    uint64_t head = __atomic_load_n(&trace_buffer->head, __ATOMIC_ACQUIRE);
+    uint64_t first = head > TRACE_CAPACITY ? head - TRACE_CAPACITY : 0;
+    uint64_t origin = 0;
+
+    for (uint64_t i = first; i < head; i++) {
+        struct TraceEvent *event = &trace_buffer->events[i % TRACE_CAPACITY];
+        if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) == i + 1 && (origin == 0 || event->ts_ns < origin)) {
+            origin = event->ts_ns;
+        }
+    }
+
+    pid_t pid = getpid();
+
+    fprintf(f, "{\"displayTimeUnit\":\"ns\",\"traceEvents\":[\n");
+    fprintf(f, "{\"name\":\"process_name\",\"ph\":\"M\",\"pid\":%d,\"args\":{\"name\":\"runbox\"}}", pid);
+
+    for (int role = TRACE_ROLE_LAUNCHER; role <= TRACE_ROLE_INIT; role++) {
+        fprintf(f, ",\n{\"name\":\"thread_name\",\"ph\":\"M\",\"pid\":%d,\"tid\":%d,\"args\":{\"name\":\"%s\"}}",
+                pid, role, role_names[role]);
+    }
+
+    for (uint64_t i = first; i < head; i++) {
+        struct TraceEvent *event = &trace_buffer->events[i % TRACE_CAPACITY];
+
+        if (__atomic_load_n(&event->seq, __ATOMIC_ACQUIRE) != i + 1 || event->phase >= TRACE_PHASE_COUNT) {
+            continue;
+        }
+
+        fprintf(f, ",\n{\"name\":\"%s\",\"cat\":\"setup\",\"ph\":\"%c\",\"ts\":%.3f,\"pid\":%d,\"tid\":%d,",
+                phase_names[event->phase], event->type, (double)(event->ts_ns - origin) / 1000.0,
+                pid, event->role);
+
+        if (event->type == 'i') {
+            fprintf(f, "\"s\":\"t\",");
+        }
+
+        fprintf(f, "\"args\":{\"pid\":%d", event->pid);
+        if (event->err) {
+            fprintf(f, ",\"errno\":%d,\"error\":\"%s\"", event->err, strerror(event->err));
+        }
+        fprintf(f, "}}");
+    }
+
+    fprintf(f, "\n]}\n");
+
+    if (fclose(f) != 0) {
+        printf("Error writing to %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    return 0;
+}
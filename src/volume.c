@@ -0,0 +1,290 @@
+#define _GNU_SOURCE
+
+#include <sys/types.h>
+#include <sys/stat.h>
+#include <sys/mount.h>
+#include <sys/syscall.h>
+#include <sys/wait.h>
+#include <linux/openat2.h>
+#include <fcntl.h>
+#include <limits.h>
+#include <sched.h>
+#include <signal.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <errno.h>
+#include <unistd.h>
+#include "volume.h"
+
+int parse_volume(char *arg, struct VolumeSpec *spec) {
+    char *sep = strchr(arg, ':');
+    if (!sep || sep == arg) {
+        return -1;
+    }
+
+    *sep = '\0';
+    spec->host_path = arg;
+    spec->sandbox_path = sep + 1;
+    spec->read_only = 0;
+
+    char *mode = strchr(sep + 1, ':');
+    if (mode) {
+        *mode++ = '\0';
+
+        if (strcmp(mode, "ro") == 0) {
+            spec->read_only = 1;
+        } else if (strcmp(mode, "rw") != 0) {
+            return -1;
+        }
+    }
+
+    // The mount point is created under the sandbox root, so it must not climb out of it
+    if (spec->sandbox_path[0] != '/' || spec->sandbox_path[1] == '\0' || strstr(spec->sandbox_path, "..")) {
+        return -1;
+    }
+
+    return 0;
+}
+
+static int write_id_map(pid_t pid, const char *file, unsigned int inside, unsigned int outside) {
+    char path[64];
+    char map[64];
+
+    snprintf(path, sizeof(path), "/proc/%d/%s", pid, file);
+    int len = snprintf(map, sizeof(map), "%u %u 1", inside, outside);
+
+    int fd = open(path, O_WRONLY | O_CLOEXEC);
+    if (fd == -1) {
+        printf("failed opening %s: %s\n", path, strerror(errno));
+        return -1;
+    }
+
+    if (write(fd, map, len) != len) {
+        printf("failed writing %s: %s\n", path, strerror(errno));
+        close(fd);
+        return -1;
+    }
+
+    close(fd);
+    return 0;
+}
+
+/*
+ * Returns a user namespace fd whose mapping takes the volume owner's ids (as stored on
+ * disk) to the caller's. As the idmapping of the volume mount it makes the owner's files
+ * appear as the caller's, which the sandbox user namespace in turn shows as root.
+ */
+static int create_idmap_userns(uid_t owner_uid, gid_t owner_gid, uid_t uid, gid_t gid) {
+    int sync[2];
+
+    if (pipe2(sync, O_CLOEXEC) == -1) {
+        perror("pipe");
+        return -1;
+    }
+
+    // A bare clone starts the helper inside its new user namespace, so the maps can be
+    // written right away; it only has to stay alive until we hold the namespace fd
+    pid_t pid = (pid_t)syscall(SYS_clone, CLONE_NEWUSER | SIGCHLD, NULL, NULL, NULL, NULL);
+
+    if (pid == 0) {
+        char byte;
+        close(sync[1]);
+        while (read(sync[0], &byte, 1) == -1 && errno == EINTR) { }
+        _exit(0);
+    } else if (pid < 0) {
+        printf("failed creating idmap user namespace: %s\n", strerror(errno));
+        close(sync[0]);
+        close(sync[1]);
+        return -1;
+    }
+
+    close(sync[0]);
+
+    int fd = -1;
+    char path[64];
+    snprintf(path, sizeof(path), "/proc/%d/ns/user", pid);
+
+    if (write_id_map(pid, "uid_map", owner_uid, uid) == 0 &&
+        write_id_map(pid, "gid_map", owner_gid, gid) == 0) {
+        fd = open(path, O_RDONLY | O_CLOEXEC);
+        if (fd == -1) {
+            printf("failed opening %s: %s\n", path, strerror(errno));
+        }
+    }
+
+    close(sync[1]);
+    waitpid(pid, NULL, 0);
+
+    return fd;
+}
+
+// Opens path as if root_fd were "/": absolute symlinks and ".." in the image stay inside it
+static int open_in_root(int root_fd, const char *path, int flags) {
+    struct open_how how = {
+        .flags = flags | O_PATH | O_CLOEXEC,
+        .resolve = RESOLVE_IN_ROOT | RESOLVE_NO_MAGICLINKS,
+    };
+
+    return (int)syscall(SYS_openat2, root_fd, path, &how, sizeof(how));
+}
+
+/*
+ * Creates the mount point for a volume (a directory, or an empty file for a file volume)
+ * and returns an O_PATH descriptor for it. Every component is resolved inside the sandbox
+ * root and created relative to its resolved parent, so a symlink in an image can never
+ * make us create or mount anything on the host.
+ */
+static int create_mount_point(int root_fd, const char *sandbox_path, int is_dir) {
+    char path[PATH_MAX];
+
+    snprintf(path, sizeof(path), "%s", sandbox_path);
+
+    int parent = open_in_root(root_fd, "/", O_DIRECTORY);
+    if (parent == -1) {
+        printf("failed opening sandbox root: %s\n", strerror(errno));
+        return -1;
+    }
+
+    char *name = path + 1;
+    while (*name) {
+        char *end = strchr(name, '/');
+        int last = !end || end[1] == '\0';
+        int want_dir = !last || is_dir;
+
+        if (end) {
+            *end = '\0';
+        }
+
+        int fd = open_in_root(root_fd, path, want_dir ? O_DIRECTORY : 0);
+
+        if (fd == -1 && errno == ENOENT) {
+            int ret;
+
+            if (want_dir) {
+                ret = mkdirat(parent, name, 0755);
+            } else {
+                ret = openat(parent, name, O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, 0644);
+                if (ret != -1) {
+                    close(ret);
+                }
+            }
+
+            if (ret == -1 && errno != EEXIST) {
+                printf("failed creating volume mount point %s: %s\n", path, strerror(errno));
+                close(parent);
+                return -1;
+            }
+
+            fd = open_in_root(root_fd, path, want_dir ? O_DIRECTORY : 0);
+        }
+
+        if (fd == -1) {
+            printf("failed opening volume mount point %s: %s\n", path, strerror(errno));
+            close(parent);
+            return -1;
+        }
+
+        close(parent);
+        parent = fd;
+
+        if (!end) {
+            break;
+        }
+
+        *end = '/';
+        name = end + 1;
+    }
+
+    return parent;
+}
+
+static int mount_volume(int root_fd, const struct VolumeSpec *volume) {
+    struct stat st;
+
+    if (stat(volume->host_path, &st) == -1) {
+        printf("failed accessing volume %s: %s\n", volume->host_path, strerror(errno));
+        return -1;
+    }
+
+    int target = create_mount_point(root_fd, volume->sandbox_path, S_ISDIR(st.st_mode));
+    if (target == -1) {
+        return -1;
+    }
+
+    // A detached copy of the host mount that we can reconfigure before attaching it
+    int tree = (int)syscall(SYS_open_tree, AT_FDCWD, volume->host_path, OPEN_TREE_CLONE | OPEN_TREE_CLOEXEC);
+    if (tree == -1) {
+        printf("open_tree failed for volume %s: %s\n", volume->host_path, strerror(errno));
+        close(target);
+        return -1;
+    }
+
+    struct mount_attr attr = { 0 };
+    int userns = -1;
+
+    if (volume->read_only) {
+        attr.attr_set |= MOUNT_ATTR_RDONLY;
+    }
+
+    // Files owned by the caller already show up as root in the sandbox; anyone else's need the idmapping
+    if (st.st_uid != getuid() || st.st_gid != getgid()) {
+        userns = create_idmap_userns(st.st_uid, st.st_gid, getuid(), getgid());
+        if (userns == -1) {
+            close(tree);
+            close(target);
+            return -1;
+        }
+
+        attr.attr_set |= MOUNT_ATTR_IDMAP;
+        attr.userns_fd = userns;
+    }
+
+    if (attr.attr_set != 0 &&
+        syscall(SYS_mount_setattr, tree, "", AT_EMPTY_PATH, &attr, sizeof(attr)) == -1) {
+        if (errno == EINVAL && userns != -1) {
+            printf("filesystem of volume %s does not support idmapped mounts\n", volume->host_path);
+        } else {
+            printf("mount_setattr failed for volume %s: %s\n", volume->host_path, strerror(errno));
+        }
+        close(tree);
+        close(target);
+        if (userns != -1) close(userns);
+        return -1;
+    }
+
+    if (userns != -1) {
+        close(userns);
+    }
+
+    int ret = (int)syscall(SYS_move_mount, tree, "", target, "", MOVE_MOUNT_F_EMPTY_PATH | MOVE_MOUNT_T_EMPTY_PATH);
+    if (ret == -1) {
+        printf("failed attaching volume %s at %s: %s\n", volume->host_path, volume->sandbox_path, strerror(errno));
+    }
+
+    close(tree);
+    close(target);
+    return ret;
+}
+
+// Attaches the volumes below the (not yet pivoted) sandbox root; nested mounts are not carried over
+int mount_volumes(const char *root, const struct VolumeSpec *volumes, int count) {
+    int ret = 0;
+
+    if (count == 0) {
+        return 0;
+    }
+
+    int root_fd = open(root, O_PATH | O_DIRECTORY | O_CLOEXEC);
+    if (root_fd == -1) {
+        printf("Error opening %s: %s\n", root, strerror(errno));
+        return -1;
+    }
+
+    for (int i = 0; i < count && ret == 0; i++) {
+        ret = mount_volume(root_fd, &volumes[i]);
+    }
+
+    close(root_fd);
+    return ret;
+}
@@ -0,0 +1,130 @@
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include "workqueue.h"
+
+struct WorkItem {
+    void (*fn)(void *arg);
+    void *arg;
+    size_t bytes;
+    struct WorkItem *next;
+};
+
+static void *worker_main(void *arg) {
+    struct WorkQueue *wq = arg;
+
+    pthread_mutex_lock(&wq->lock);
+
+    for (;;) {
+        while (!wq->head && !wq->stopping) {
+            pthread_cond_wait(&wq->work_ready, &wq->lock);
+        }
+
+        if (!wq->head) {
+            break;
+        }
+
+        struct WorkItem *item = wq->head;
+        wq->head = item->next;
+        if (!wq->head) {
+            wq->tail = NULL;
+        }
+
+        pthread_mutex_unlock(&wq->lock);
+        item->fn(item->arg);
+        pthread_mutex_lock(&wq->lock);
+
+        wq->in_flight--;
+        wq->bytes -= item->bytes;
+        free(item);
+
+        // Wakes both a blocked producer and workqueue_wait()
+        pthread_cond_broadcast(&wq->work_done);
+    }
+
+    pthread_mutex_unlock(&wq->lock);
+    return NULL;
+}
+
+int workqueue_init(struct WorkQueue *wq, int nthreads, size_t max_jobs, size_t max_bytes) {
+    memset(wq, 0, sizeof(*wq));
+
+    if (nthreads < 1) nthreads = 1;
+    if (nthreads > WORKQUEUE_MAX_THREADS) nthreads = WORKQUEUE_MAX_THREADS;
+
+    wq->max_jobs = max_jobs > 0 ? max_jobs : 1;
+    wq->max_bytes = max_bytes;
+
+    pthread_mutex_init(&wq->lock, NULL);
+    pthread_cond_init(&wq->work_ready, NULL);
+    pthread_cond_init(&wq->work_done, NULL);
+
+    for (int i = 0; i < nthreads; i++) {
+        int err = pthread_create(&wq->threads[i], NULL, worker_main, wq);
+        if (err != 0) {
+            printf("failed starting worker thread: %s\n", strerror(err));
+            workqueue_destroy(wq);
+            return -1;
+        }
+        wq->nthreads++;
+    }
+
+    return 0;
+}
+
+int workqueue_submit(struct WorkQueue *wq, void (*fn)(void *arg), void *arg, size_t bytes) {
+    struct WorkItem *item = malloc(sizeof(*item));
+    if (!item) {
+        printf("failed allocating work item\n");
+        return -1;
+    }
+
+    *item = (struct WorkItem) { .fn = fn, .arg = arg, .bytes = bytes, .next = NULL };
+
+    pthread_mutex_lock(&wq->lock);
+
+    // Backpressure: an oversized job waits for an idle queue instead of blocking forever
+    while (wq->in_flight >= wq->max_jobs ||
+           (wq->in_flight > 0 && wq->bytes + bytes > wq->max_bytes)) {
+        pthread_cond_wait(&wq->work_done, &wq->lock);
+    }
+
+    if (wq->tail) {
+        wq->tail->next = item;
+    } else {
+        wq->head = item;
+    }
+    wq->tail = item;
+    wq->in_flight++;
+    wq->bytes += bytes;
+
+    pthread_cond_signal(&wq->work_ready);
+    pthread_mutex_unlock(&wq->lock);
+
+    return 0;
+}
+
+void workqueue_wait(struct WorkQueue *wq) {
+    pthread_mutex_lock(&wq->lock);
+    while (wq->in_flight > 0) {
+        pthread_cond_wait(&wq->work_done, &wq->lock);
+    }
+    pthread_mutex_unlock(&wq->lock);
+}
+
+// Runs whatever is still queued, then joins the workers
+void workqueue_destroy(struct WorkQueue *wq) {
+    pthread_mutex_lock(&wq->lock);
+    wq->stopping = 1;
+    pthread_cond_broadcast(&wq->work_ready);
+    pthread_mutex_unlock(&wq->lock);
+
+    for (int i = 0; i < wq->nthreads; i++) {
+        pthread_join(wq->threads[i], NULL);
+    }
+
+    wq->nthreads = 0;
+    pthread_cond_destroy(&wq->work_done);
+    pthread_cond_destroy(&wq->work_ready);
+    pthread_mutex_destroy(&wq->lock);
+}